@@ -0,0 +1,138 @@
+// Copyright (C) 2019-2023 Zilliz. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance
+// with the License. You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied. See the License for the specific language governing permissions and limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "benchmark_knowhere.h"
+#include "knowhere/comp/index_param.h"
+#include "knowhere/comp/knowhere_config.h"
+#include "knowhere/dataset.h"
+
+// Insert throughput of a growing IVF_FLAT_CC against the latency of searches running meanwhile: the index is trained
+// on a part of the base, then one writer adds the rest batch by batch while searchers issue single-query requests.
+class Benchmark_float_concurrent_add : public Benchmark_knowhere, public ::testing::Test {
+ public:
+    void
+    test_ivf_flat_cc(const knowhere::Json& cfg) {
+        auto conf = cfg;
+        auto nlist = conf[knowhere::indexparam::NLIST].get<int32_t>();
+        int32_t nb_train = nb_ * TRAIN_RATIO_;
+
+        for (auto batch : BATCHs_) {
+            for (auto thread_num : THREAD_NUMs_) {
+                index_ = knowhere::IndexFactory::Instance().Create(index_type_);
+                auto train_ds = knowhere::GenDataSet(nb_train, dim_, xb_);
+                index_.Build(*train_ds, conf);
+
+                std::atomic<bool> adding = true;
+                double add_time = 0;
+                auto writer = [&]() {
+                    double t_start = elapsed();
+                    for (int32_t i = nb_train; i < nb_; i += batch) {
+                        auto rows = std::min(batch, nb_ - i);
+                        auto ds_ptr = knowhere::GenDataSet(rows, dim_, (const float*)xb_ + (int64_t)i * dim_);
+                        index_.Add(*ds_ptr, conf);
+                    }
+                    add_time = elapsed() - t_start;
+                    adding = false;
+                };
+
+                std::vector<std::vector<double>> latencies(thread_num);
+                auto searcher = [&](int32_t idx) {
+                    for (int32_t i = idx; adding; i = (i + thread_num) % nq_) {
+                        auto ds_ptr = knowhere::GenDataSet(1, dim_, (const float*)xq_ + (int64_t)i * dim_);
+                        double t_start = elapsed();
+                        index_.Search(*ds_ptr, conf, nullptr);
+                        latencies[idx].push_back(elapsed() - t_start);
+                    }
+                };
+
+                std::vector<std::thread> thread_vector;
+                thread_vector.emplace_back(writer);
+                for (int32_t i = 0; i < thread_num; i++) {
+                    thread_vector.emplace_back(searcher, i);
+                }
+                for (auto& t : thread_vector) {
+                    t.join();
+                }
+
+                std::vector<double> all;
+                for (auto& l : latencies) {
+                    all.insert(all.end(), l.begin(), l.end());
+                }
+                std::sort(all.begin(), all.end());
+                double avg = 0;
+                for (auto l : all) {
+                    avg += l;
+                }
+                avg = all.empty() ? 0 : avg / all.size();
+                double p99 = all.empty() ? 0 : all[all.size() * 99 / 100];
+
+                auto ds_ptr = knowhere::GenDataSet(nq_, dim_, xq_);
+                auto result = index_.Search(*ds_ptr, conf, nullptr);
+                float recall = CalcRecall(result.value()->GetIds(), nq_, topk_);
+
+                printf("  nlist = %d, nprobe = %d, batch = %6d, search threads = %2d, insert = %10.1f rows/s, "
+                       "searches = %7zu, latency avg = %7.3f ms, p99 = %7.3f ms, R@ = %.4f\n",
+                       nlist, conf[knowhere::indexparam::NPROBE].get<int32_t>(), batch, thread_num,
+                       (nb_ - nb_train) / add_time, all.size(), avg * 1000, p99 * 1000, recall);
+                std::fflush(stdout);
+            }
+        }
+        printf("[%.3f s] Test '%s/%s' done\n\n", get_time_diff(), ann_test_name_.c_str(), index_type_.c_str());
+    }
+
+ protected:
+    void
+    SetUp() override {
+        T0_ = elapsed();
+        set_ann_test_name("sift-128-euclidean");
+        parse_ann_test_name();
+        load_hdf5_data<false>();
+
+        assert(metric_str_ == METRIC_IP_STR || metric_str_ == METRIC_L2_STR);
+        metric_type_ = (metric_str_ == METRIC_IP_STR) ? knowhere::metric::IP : knowhere::metric::L2;
+        cfg_[knowhere::meta::METRIC_TYPE] = metric_type_;
+        cfg_[knowhere::meta::TOPK] = topk_;
+        knowhere::KnowhereConfig::SetSimdType(knowhere::KnowhereConfig::SimdType::AUTO);
+    }
+
+    void
+    TearDown() override {
+        free_all();
+    }
+
+ protected:
+    const int32_t topk_ = 100;
+    const float TRAIN_RATIO_ = 0.1;
+    const std::vector<int32_t> BATCHs_ = {1000, 10000};
+    const std::vector<int32_t> THREAD_NUMs_ = {1, 4};
+
+    // IVF index params
+    const int32_t NLIST_ = 1024;
+    const int32_t NPROBE_ = 16;
+    const int32_t SSIZE_ = 48;
+};
+
+TEST_F(Benchmark_float_concurrent_add, TEST_IVF_FLAT_CC) {
+    index_type_ = knowhere::IndexEnum::INDEX_FAISS_IVFFLAT_CC;
+
+    knowhere::Json conf = cfg_;
+    conf[knowhere::indexparam::NLIST] = NLIST_;
+    conf[knowhere::indexparam::NPROBE] = NPROBE_;
+    conf[knowhere::indexparam::SSIZE] = SSIZE_;
+    test_ivf_flat_cc(conf);
+}
@@ -40,7 +40,11 @@ constexpr const char* INDEX_RAFT_IVFPQ = "GPU_RAFT_IVF_PQ";
 constexpr const char* INDEX_RAFT_CAGRA = "GPU_RAFT_CAGRA";
 
 constexpr const char* INDEX_HNSW = "HNSW";
+constexpr const char* INDEX_HNSW_SQ8 = "HNSW_SQ8";
+constexpr const char* INDEX_HNSW_FP16 = "HNSW_FP16";
+constexpr const char* INDEX_HNSW_PQ = "HNSW_PQ";
 constexpr const char* INDEX_DISKANN = "DISKANN";
+constexpr const char* INDEX_DISK_IVF = "DISK_IVF";
 
 }  // namespace IndexEnum
 
@@ -61,22 +65,43 @@ constexpr const char* OUTPUT_TENSOR = "output_tensor";
 constexpr const char* DEVICE_ID = "gpu_id";
 constexpr const char* NUM_BUILD_THREAD = "num_build_thread";
 constexpr const char* TRACE_VISIT = "trace_visit";
+constexpr const char* ENABLE_MMAP = "enable_mmap";
 constexpr const char* JSON_INFO = "json_info";
 constexpr const char* JSON_ID_SET = "json_id_set";
+constexpr const char* LISTS_SCANNED = "lists_scanned";
 };  // namespace meta
 
 namespace indexparam {
 // IVF Params
 constexpr const char* NPROBE = "nprobe";
 constexpr const char* NLIST = "nlist";
-constexpr const char* NBITS = "nbits";  // PQ/SQ
-constexpr const char* M = "m";          // PQ param for IVFPQ
+constexpr const char* NBITS = "nbits";      // PQ/SQ
+constexpr const char* M = "m";              // PQ param for IVFPQ
+constexpr const char* SQ_TYPE = "sq_type";  // SQ param for IVFSQ
 constexpr const char* SSIZE = "ssize";
+constexpr const char* REFINE = "refine";                // refine param for IVFPQ/IVFSQ
+constexpr const char* REFINE_TYPE = "refine_type";      // refine param for IVFPQ/IVFSQ
+constexpr const char* REFINE_FACTOR = "refine_factor";  // refine param for IVFPQ/IVFSQ
+constexpr const char* QUANTIZER_TYPE = "quantizer_type";  // coarse quantizer for float IVF, FLAT or HNSW
+constexpr const char* QUANTIZER_EF = "quantizer_ef";      // HNSW coarse quantizer search depth
+constexpr const char* BATCH_SEARCH = "batch_search";      // list-major batch search for IVFFLAT
+constexpr const char* KMEANS_N_ITERS = "kmeans_n_iters";                      // IVF kmeans iterations
+constexpr const char* KMEANS_TRAINSET_FRACTION = "kmeans_trainset_fraction";  // IVF kmeans sample ratio
+constexpr const char* KMEANS_BATCH_SIZE = "kmeans_batch_size";                // IVF mini-batch size, 0 is full-batch
+constexpr const char* KMEANS_INIT = "kmeans_init";                            // IVF seeding, RANDOM or KMEANS_PARALLEL
+constexpr const char* KMEANS_MAX_LIST_RATIO = "kmeans_max_list_ratio";        // IVF list size bound, 0 is unbounded
+constexpr const char* ADAPTIVE_PROBE_FACTOR = "adaptive_probe_factor";        // IVF list skipping, 0 is off
+constexpr const char* RANGE_LIST_PRUNING = "range_list_pruning";  // IVF range search by list radius, not nprobe
+constexpr const char* REUSE_QUANTIZER = "reuse_quantizer";        // IVF build keeps the trained quantizers
+constexpr const char* SHARE_QUANTIZER = "share_quantizer";        // IVF load shares equal coarse quantizers
 // HNSW Params
 constexpr const char* EFCONSTRUCTION = "efConstruction";
 constexpr const char* HNSW_M = "M";
 constexpr const char* EF = "ef";
 constexpr const char* OVERVIEW_LEVELS = "overview_levels";
+constexpr const char* REORDER = "reorder";  // HNSW graph renumbering, NONE, BFS or RCM
+constexpr const char* ENTRY_POINTS = "entry_points";  // HNSW centroids searches start next to, 0 is off
+constexpr const char* BUILD_METHOD = "build_method";  // HNSW graph construction, INCREMENTAL or NNDESCENT
 }  // namespace indexparam
 
 using MetricType = std::string;
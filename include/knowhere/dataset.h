@@ -78,6 +78,13 @@ class DataSet {
         this->data_[meta::IDS] = Var(std::in_place_index<2>, ids);
     }
 
+    // number of inverted lists each query actually scanned, set by adaptive IVF probing
+    void
+    SetListsScanned(const int64_t* lists_scanned) {
+        std::unique_lock lock(mutex_);
+        this->data_[meta::LISTS_SCANNED] = Var(std::in_place_index<2>, lists_scanned);
+    }
+
     void
     SetTensor(const void* tensor) {
         std::unique_lock lock(mutex_);
@@ -141,6 +148,17 @@ class DataSet {
         return nullptr;
     }
 
+    const int64_t*
+    GetListsScanned() const {
+        std::shared_lock lock(mutex_);
+        auto it = this->data_.find(meta::LISTS_SCANNED);
+        if (it != this->data_.end()) {
+            const int64_t* res = *std::get_if<2>(&it->second);
+            return res;
+        }
+        return nullptr;
+    }
+
     const void*
     GetTensor() const {
         std::shared_lock lock(mutex_);
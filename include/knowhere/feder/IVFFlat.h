@@ -73,15 +73,36 @@ class IVFFlatMeta {
                const int64_t dim) {
         assert(dim == dim_);
         clusters_.emplace_back(ClusterInfo(id, node_id_addr, node_num, centroid_addr, dim));
+        AddListSize(node_num);
     }
 
-    NLOHMANN_DEFINE_TYPE_INTRUSIVE(IVFFlatMeta, nlist_, dim_, ntotal_, clusters_);
+    // bucket 0 counts empty lists, bucket b > 0 counts lists holding [2^(b-1), 2^b) vectors
+    const std::vector<int64_t>&
+    GetListSizeHistogram() const {
+        return list_size_histogram_;
+    }
+
+    NLOHMANN_DEFINE_TYPE_INTRUSIVE(IVFFlatMeta, nlist_, dim_, ntotal_, clusters_, list_size_histogram_);
 
  private:
+    void
+    AddListSize(int64_t size) {
+        size_t bucket = 0;
+        while (size > 0) {
+            size >>= 1;
+            bucket++;
+        }
+        if (list_size_histogram_.size() <= bucket) {
+            list_size_histogram_.resize(bucket + 1, 0);
+        }
+        list_size_histogram_[bucket]++;
+    }
+
     int64_t nlist_;
     int64_t dim_;
     int64_t ntotal_;
     std::vector<ClusterInfo> clusters_;
+    std::vector<int64_t> list_size_histogram_;
 };
 
 }  // namespace knowhere::feder::ivfflat
@@ -160,6 +160,31 @@ class Index {
         return this->node->Add(dataset, *cfg);
     }
 
+    Status
+    Merge(const std::vector<Index<IndexNode>>& sources, const Json& json, const std::vector<BitsetView>& deleted = {}) {
+        auto cfg = this->node->CreateConfig();
+        RETURN_IF_ERROR(LoadConfig(cfg.get(), json, knowhere::TRAIN, "Merge"));
+        if (!deleted.empty() && deleted.size() != sources.size()) {
+            LOG_KNOWHERE_ERROR_ << "Merge needs one deleted bitset per source, got " << deleted.size() << " for "
+                                << sources.size() << " sources";
+            return Status::invalid_args;
+        }
+        std::vector<const IndexNode*> nodes;
+        nodes.reserve(sources.size());
+        for (auto& source : sources) {
+            if (source.node == nullptr || source.node == this->node) {
+                return Status::invalid_args;
+            }
+            nodes.push_back(source.node);
+        }
+        return this->node->Merge(nodes, *cfg, deleted);
+    }
+
+    Status
+    MarkDeleted(const DataSet& dataset) {
+        return this->node->MarkDeleted(dataset);
+    }
+
     expected<DataSetPtr>
     Search(const DataSet& dataset, const Json& json, const BitsetView& bitset) const {
         auto cfg = this->node->CreateConfig();
@@ -226,6 +251,11 @@ class Index {
         return this->node->Serialize(binset);
     }
 
+    Status
+    SerializeTemplate(BinarySet& binset) const {
+        return this->node->SerializeTemplate(binset);
+    }
+
     Status
     Deserialize(const BinarySet& binset, const Json& json = {}) {
         Json json_(json);
@@ -245,8 +275,21 @@ class Index {
     }
 
     Status
-    DeserializeFromFile(const std::string& filename, const Config& config = {}) {
-        return this->node->Deserialize(filename, config);
+    DeserializeFromFile(const std::string& filename, const Json& json = {}) {
+        Json json_(json);
+        auto cfg = this->node->CreateConfig();
+        {
+            auto res = Config::FormatAndCheck(*cfg, json_);
+            LOG_KNOWHERE_DEBUG_ << "DeserializeFromFile config dump: " << json_.dump();
+            if (res != Status::success) {
+                return res;
+            }
+        }
+        auto res = Config::Load(*cfg, json_, knowhere::DESERIALIZE_FROM_FILE);
+        if (res != Status::success) {
+            return res;
+        }
+        return this->node->DeserializeFromFile(filename, *cfg);
     }
 
     int64_t
@@ -35,6 +35,26 @@ class IndexNode : public Object {
     virtual Status
     Add(const DataSet& dataset, const Config& cfg) = 0;
 
+    /**
+     * @brief Append the vectors of other indexes of the same type, trained with the same quantizers, without
+     * retraining. An untrained index takes the quantizers of the first source. Rows set in deleted[i] are dropped, and
+     * the remaining rows of each source get consecutive ids after the current ones, in source order. cfg is read as
+     * for Add, e.g. for num_build_thread.
+     */
+    virtual Status
+    Merge(const std::vector<const IndexNode*>& sources, const Config& cfg, const std::vector<BitsetView>& deleted) {
+        return Status::not_implemented;
+    }
+
+    /**
+     * @brief Delete the rows of the given ids: searches no longer return them. The index may keep them in its structure
+     * and repair it on its own as deletions pile up, the ids of the other rows stay the same.
+     */
+    virtual Status
+    MarkDeleted(const DataSet& dataset) {
+        return Status::not_implemented;
+    }
+
     virtual expected<DataSetPtr>
     Search(const DataSet& dataset, const Config& cfg, const BitsetView& bitset) const = 0;
 
@@ -53,6 +73,15 @@ class IndexNode : public Object {
     virtual Status
     Serialize(BinarySet& binset) const = 0;
 
+    /**
+     * @brief Serialize only the trained quantizers, as a binary set that Deserialize loads into an empty index of the
+     * same type. Indexes created from one template only need Add, and their codes can be merged with each other.
+     */
+    virtual Status
+    SerializeTemplate(BinarySet& binset) const {
+        return Status::not_implemented;
+    }
+
     virtual Status
     Deserialize(const BinarySet& binset, const Config& config) = 0;
 
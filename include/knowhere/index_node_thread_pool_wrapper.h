@@ -27,6 +27,11 @@ class IndexNodeThreadPoolWrapper : public IndexNode {
         : index_node_(std::move(index_node)), thread_pool_(thread_pool) {
     }
 
+    Status
+    Build(const DataSet& dataset, const Config& cfg) {
+        return index_node_->Build(dataset, cfg);
+    }
+
     Status
     Train(const DataSet& dataset, const Config& cfg) {
         return index_node_->Train(dataset, cfg);
@@ -37,6 +42,16 @@ class IndexNodeThreadPoolWrapper : public IndexNode {
         return index_node_->Add(dataset, cfg);
     }
 
+    Status
+    Merge(const std::vector<const IndexNode*>& sources, const Config& cfg, const std::vector<BitsetView>& deleted) {
+        return index_node_->Merge(sources, cfg, deleted);
+    }
+
+    Status
+    MarkDeleted(const DataSet& dataset) {
+        return index_node_->MarkDeleted(dataset);
+    }
+
     expected<DataSetPtr>
     Search(const DataSet& dataset, const Config& cfg, const BitsetView& bitset) const {
         return thread_pool_->push([&]() { return this->index_node_->Search(dataset, cfg, bitset); }).get();
@@ -67,6 +82,11 @@ class IndexNodeThreadPoolWrapper : public IndexNode {
         return index_node_->Serialize(binset);
     }
 
+    Status
+    SerializeTemplate(BinarySet& binset) const {
+        return index_node_->SerializeTemplate(binset);
+    }
+
     Status
     Deserialize(const BinarySet& binset, const Config& config) {
         return index_node_->Deserialize(binset, config);
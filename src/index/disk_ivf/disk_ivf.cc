@@ -0,0 +1,663 @@
+// Copyright (C) 2019-2023 Zilliz. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance
+// with the License. You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied. See the License for the specific language governing permissions and limitations under the License.
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <numeric>
+
+#include "common/metric.h"
+#include "common/range_util.h"
+#include "diskann/linux_aligned_file_reader.h"
+#include "diskann/utils.h"
+#include "faiss/IndexFlat.h"
+#include "faiss/IndexScalarQuantizer.h"
+#include "faiss/impl/AuxIndexStructures.h"
+#include "faiss/impl/io.h"
+#include "faiss/index_io.h"
+#include "faiss/utils/Heap.h"
+#include "index/disk_ivf/disk_ivf_config.h"
+#include "knowhere/comp/index_param.h"
+#include "knowhere/comp/thread_pool.h"
+#include "knowhere/expected.h"
+#include "knowhere/factory.h"
+#include "knowhere/file_manager.h"
+#include "knowhere/log.h"
+#include "knowhere/utils.h"
+
+namespace knowhere {
+
+namespace {
+// every inverted list starts on its own page, so a probed list is one O_DIRECT read
+constexpr uint64_t kListAlign = 4096;
+constexpr int64_t kMinPointsPerCentroid = 39;
+// a single synchronous batch while warming the cache, well below the events of one aio context
+constexpr size_t kCacheReadBatch = 128;
+
+inline uint64_t
+RoundUp(uint64_t x) {
+    return (x + kListAlign - 1) / kListAlign * kListAlign;
+}
+
+inline std::string
+GetMetaFilename(const std::string& prefix) {
+    return prefix + "_disk_ivf_meta.index";
+}
+
+inline std::string
+GetListsFilename(const std::string& prefix) {
+    return prefix + "_disk_ivf_lists.index";
+}
+
+struct AlignedFree {
+    void
+    operator()(uint8_t* p) const {
+        diskann::aligned_free(p);
+    }
+};
+using AlignedBuffer = std::unique_ptr<uint8_t, AlignedFree>;
+
+AlignedBuffer
+AllocAligned(uint64_t size) {
+    void* p = nullptr;
+    diskann::alloc_aligned(&p, std::max(size, kListAlign), kListAlign);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return AlignedBuffer(static_cast<uint8_t*>(p));
+}
+
+Status
+TryDiskIvfCall(std::function<void()>&& call) {
+    try {
+        call();
+        return Status::success;
+    } catch (const diskann::FileException& e) {
+        LOG_KNOWHERE_ERROR_ << "DiskIVF File Exception: " << e.what();
+        return Status::diskann_file_error;
+    } catch (const diskann::ANNException& e) {
+        LOG_KNOWHERE_ERROR_ << "DiskIVF Exception: " << e.what();
+        return Status::diskann_inner_error;
+    } catch (const std::exception& e) {
+        LOG_KNOWHERE_ERROR_ << "DiskIVF Other Exception: " << e.what();
+        return Status::diskann_inner_error;
+    }
+}
+
+inline bool
+CheckMetric(const std::string& metric) {
+    if (!IsMetricType(metric, metric::L2) && !IsMetricType(metric, metric::IP) &&
+        !IsMetricType(metric, metric::COSINE)) {
+        LOG_KNOWHERE_ERROR_ << "DiskIVF only supports L2, IP and COSINE, got " << metric;
+        return false;
+    }
+    return true;
+}
+}  // namespace
+
+// IVF index whose inverted lists live on disk. The coarse centroids and the scalar quantizer stay in memory; every
+// list is an [ids | SQ8 codes] block starting on a page boundary of the lists file, so that probing a list costs one
+// aligned read. Probed lists are fetched with batches of async reads, the next batch being in flight while the current
+// one is scanned, and the most populated lists can be pinned in memory at load time.
+class DiskIvfIndexNode : public IndexNode {
+ public:
+    DiskIvfIndexNode(const Object& object) : is_prepared_(false), ntotal_(0) {
+        assert(typeid(object) == typeid(Pack<std::shared_ptr<FileManager>>));
+        auto disk_ivf_index_pack = dynamic_cast<const Pack<std::shared_ptr<FileManager>>*>(&object);
+        assert(disk_ivf_index_pack != nullptr);
+        file_manager_ = disk_ivf_index_pack->GetPack();
+        pool_ = ThreadPool::GetGlobalThreadPool();
+    }
+
+    ~DiskIvfIndexNode() override {
+        if (reader_ != nullptr) {
+            reader_->close();
+        }
+    }
+
+    Status
+    Build(const DataSet& dataset, const Config& cfg) override;
+
+    Status
+    Train(const DataSet& dataset, const Config& cfg) override {
+        return Status::not_implemented;
+    }
+
+    Status
+    Add(const DataSet& dataset, const Config& cfg) override {
+        return Status::not_implemented;
+    }
+
+    expected<DataSetPtr>
+    Search(const DataSet& dataset, const Config& cfg, const BitsetView& bitset) const override;
+
+    expected<DataSetPtr>
+    RangeSearch(const DataSet& dataset, const Config& cfg, const BitsetView& bitset) const override;
+
+    expected<DataSetPtr>
+    GetVectorByIds(const DataSet& dataset) const override {
+        LOG_KNOWHERE_ERROR_ << "DiskIVF doesn't keep raw data.";
+        return Status::not_implemented;
+    }
+
+    bool
+    HasRawData(const std::string& metric_type) const override {
+        return false;
+    }
+
+    expected<DataSetPtr>
+    GetIndexMeta(const Config& cfg) const override {
+        return Status::not_implemented;
+    }
+
+    Status
+    Serialize(BinarySet& binset) const override {
+        LOG_KNOWHERE_ERROR_ << "DiskIVF doesn't support Serialize.";
+        return Status::not_implemented;
+    }
+
+    Status
+    Deserialize(const BinarySet& binset, const Config& cfg) override;
+
+    Status
+    DeserializeFromFile(const std::string& filename, const Config& config) override {
+        LOG_KNOWHERE_ERROR_ << "DiskIVF doesn't support Deserialization from file.";
+        return Status::not_implemented;
+    }
+
+    std::unique_ptr<BaseConfig>
+    CreateConfig() const override {
+        return std::make_unique<DiskIvfConfig>();
+    }
+
+    int64_t
+    Dim() const override {
+        if (!index_) {
+            LOG_KNOWHERE_ERROR_ << "Dim() function is not supported when index is not ready yet.";
+            return 0;
+        }
+        return index_->d;
+    }
+
+    int64_t
+    Size() const override {
+        if (!index_) {
+            return 0;
+        }
+        // only what sits in memory: the centroids and the cached lists
+        int64_t size = index_->d * index_->nlist * sizeof(float);
+        for (size_t i = 0; i < cached_lists_.size(); ++i) {
+            if (cached_lists_[i] != nullptr) {
+                size += RoundUp(ListBytes(i));
+            }
+        }
+        return size;
+    }
+
+    int64_t
+    Count() const override {
+        return ntotal_;
+    }
+
+    std::string
+    Type() const override {
+        return std::string(knowhere::IndexEnum::INDEX_DISK_IVF);
+    }
+
+ private:
+    // called with the list number, its coarse distance, and the list's ids and codes
+    using ListVisitor = std::function<void(faiss::idx_t, float, size_t, const int64_t*, const uint8_t*)>;
+
+    bool
+    LoadFile(const std::string& filename) {
+        if (!file_manager_->LoadFile(filename)) {
+            LOG_KNOWHERE_ERROR_ << "Failed to load file " << filename << ".";
+            return false;
+        }
+        return true;
+    }
+
+    bool
+    AddFile(const std::string& filename) {
+        if (!file_manager_->AddFile(filename)) {
+            LOG_KNOWHERE_ERROR_ << "Failed to add file " << filename << ".";
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t
+    ListBytes(size_t list_no) const {
+        return list_sizes_[list_no] * (sizeof(int64_t) + index_->code_size);
+    }
+
+    void
+    CacheLists(float budget_gb);
+
+    void
+    VisitLists(const faiss::idx_t* keys, const float* coarse_dis, size_t nprobe, size_t beamwidth,
+               const ListVisitor& visit) const;
+
+    std::string index_prefix_;
+    mutable std::mutex preparation_lock_;
+    std::atomic_bool is_prepared_;
+    std::shared_ptr<FileManager> file_manager_;
+    // coarse quantizer and SQ8 codec, its own inverted lists are always empty
+    std::unique_ptr<faiss::IndexIVFScalarQuantizer> index_;
+    int64_t ntotal_;
+    std::vector<uint64_t> list_offsets_;
+    std::vector<uint64_t> list_sizes_;
+    // lists pinned in memory, nullptr for the ones read from disk
+    std::vector<AlignedBuffer> cached_lists_;
+    std::shared_ptr<AlignedFileReader> reader_;
+    std::shared_ptr<ThreadPool> pool_;
+};
+
+Status
+DiskIvfIndexNode::Build(const DataSet& dataset, const Config& cfg) {
+    assert(file_manager_ != nullptr);
+    std::lock_guard<std::mutex> lock(preparation_lock_);
+    auto build_conf = static_cast<const DiskIvfConfig&>(cfg);
+    if (!CheckMetric(build_conf.metric_type.value())) {
+        return Status::invalid_metric_type;
+    }
+    index_prefix_ = build_conf.index_prefix.value();
+    auto meta_filename = GetMetaFilename(index_prefix_);
+    auto lists_filename = GetListsFilename(index_prefix_);
+    if (file_exists(meta_filename) || file_exists(lists_filename)) {
+        LOG_KNOWHERE_ERROR_ << "This index prefix already has index files.";
+        return Status::diskann_file_error;
+    }
+    if (!LoadFile(build_conf.data_path.value())) {
+        LOG_KNOWHERE_ERROR_ << "Failed load the raw data before building.";
+        return Status::diskann_file_error;
+    }
+
+    auto metric = Str2FaissMetricType(build_conf.metric_type.value()).value();
+    RETURN_IF_ERROR(TryDiskIvfCall([&]() {
+        float* data = nullptr;
+        size_t rows, dim;
+        diskann::load_bin<float>(build_conf.data_path.value(), data, rows, dim);
+        std::unique_ptr<float[]> data_guard(data);
+        if (IsMetricType(build_conf.metric_type.value(), metric::COSINE)) {
+            NormalizeVecs(data, rows, dim);
+        }
+
+        auto nlist = std::max<int64_t>(1, std::min<int64_t>(build_conf.nlist.value(), rows / kMinPointsPerCentroid));
+        if (nlist != build_conf.nlist.value()) {
+            LOG_KNOWHERE_WARNING_ << "nlist is reduced to " << nlist << " for " << rows << " rows";
+        }
+        auto index = std::make_unique<faiss::IndexIVFScalarQuantizer>(
+            new faiss::IndexFlat(dim, metric), dim, nlist, faiss::QuantizerType::QT_8bit, metric);
+        index->own_fields = true;
+        index->train(rows, data);
+        index->add(rows, data);
+
+        auto invlists = index->invlists;
+        std::vector<uint64_t> offsets(nlist), sizes(nlist);
+        std::ofstream writer(lists_filename, std::ios::binary);
+        writer.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        std::vector<char> padding(kListAlign, 0);
+        uint64_t offset = 0;
+        for (int64_t i = 0; i < nlist; ++i) {
+            auto n = invlists->list_size(i);
+            auto bytes = n * (sizeof(int64_t) + index->code_size);
+            offsets[i] = offset;
+            sizes[i] = n;
+            if (n == 0) {
+                continue;
+            }
+            writer.write((const char*)invlists->get_ids(i), n * sizeof(int64_t));
+            writer.write((const char*)invlists->get_codes(i), n * index->code_size);
+            writer.write(padding.data(), RoundUp(bytes) - bytes);
+            offset += RoundUp(bytes);
+        }
+        writer.close();
+
+        // the meta file keeps the trained quantizers only, the lists are addressed through offsets and sizes
+        invlists->reset();
+        faiss::FileIOWriter meta_writer(meta_filename.c_str());
+        faiss::write_index(index.get(), &meta_writer);
+        uint64_t ntotal = rows;
+        meta_writer(&ntotal, sizeof(ntotal), 1);
+        meta_writer(offsets.data(), sizeof(uint64_t), nlist);
+        meta_writer(sizes.data(), sizeof(uint64_t), nlist);
+    }));
+
+    for (auto& filename : {meta_filename, lists_filename}) {
+        if (!AddFile(filename)) {
+            return Status::diskann_file_error;
+        }
+    }
+    is_prepared_.store(false);
+    return Status::success;
+}
+
+void
+DiskIvfIndexNode::CacheLists(float budget_gb) {
+    auto nlist = list_sizes_.size();
+    cached_lists_.clear();
+    cached_lists_.resize(nlist);
+    auto budget = static_cast<uint64_t>(budget_gb * 1024 * 1024 * 1024);
+    if (budget == 0) {
+        return;
+    }
+
+    std::vector<size_t> order(nlist);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return list_sizes_[a] > list_sizes_[b]; });
+    std::vector<size_t> to_cache;
+    uint64_t used = 0;
+    for (auto list_no : order) {
+        auto bytes = RoundUp(ListBytes(list_no));
+        if (bytes == 0 || used + bytes > budget) {
+            break;
+        }
+        used += bytes;
+        to_cache.push_back(list_no);
+    }
+
+    auto ctx = reader_->get_ctx();
+    try {
+        for (size_t begin = 0; begin < to_cache.size(); begin += kCacheReadBatch) {
+            auto end = std::min(to_cache.size(), begin + kCacheReadBatch);
+            std::vector<AlignedRead> reqs;
+            for (size_t i = begin; i < end; ++i) {
+                auto list_no = to_cache[i];
+                cached_lists_[list_no] = AllocAligned(RoundUp(ListBytes(list_no)));
+                reqs.emplace_back(list_offsets_[list_no], RoundUp(ListBytes(list_no)), cached_lists_[list_no].get());
+            }
+            reader_->read(reqs, ctx);
+        }
+    } catch (...) {
+        reader_->put_ctx(ctx);
+        throw;
+    }
+    reader_->put_ctx(ctx);
+    LOG_KNOWHERE_INFO_ << "DiskIVF cached " << to_cache.size() << " of " << nlist << " lists in " << used << " bytes";
+}
+
+Status
+DiskIvfIndexNode::Deserialize(const BinarySet& binset, const Config& cfg) {
+    std::lock_guard<std::mutex> lock(preparation_lock_);
+    auto prep_conf = static_cast<const DiskIvfConfig&>(cfg);
+    if (!CheckMetric(prep_conf.metric_type.value())) {
+        return Status::invalid_metric_type;
+    }
+    if (is_prepared_.load()) {
+        return Status::success;
+    }
+
+    index_prefix_ = prep_conf.index_prefix.value();
+    auto meta_filename = GetMetaFilename(index_prefix_);
+    auto lists_filename = GetListsFilename(index_prefix_);
+    for (auto& filename : {meta_filename, lists_filename}) {
+        if (!LoadFile(filename)) {
+            return Status::diskann_file_error;
+        }
+    }
+
+    RETURN_IF_ERROR(TryDiskIvfCall([&]() {
+        faiss::FileIOReader meta_reader(meta_filename.c_str());
+        auto index = dynamic_cast<faiss::IndexIVFScalarQuantizer*>(faiss::read_index(&meta_reader));
+        if (index == nullptr) {
+            throw diskann::ANNException("DiskIVF meta file doesn't hold an IVF_SQ8 index", -1);
+        }
+        index_.reset(index);
+        uint64_t ntotal;
+        meta_reader(&ntotal, sizeof(ntotal), 1);
+        list_offsets_.resize(index_->nlist);
+        list_sizes_.resize(index_->nlist);
+        meta_reader(list_offsets_.data(), sizeof(uint64_t), index_->nlist);
+        meta_reader(list_sizes_.data(), sizeof(uint64_t), index_->nlist);
+        ntotal_ = ntotal;
+
+        reader_ = std::make_shared<LinuxAlignedFileReader>();
+        reader_->open(lists_filename);
+        CacheLists(prep_conf.search_cache_budget_gb.value());
+    }));
+
+    is_prepared_.store(true);
+    return Status::success;
+}
+
+void
+DiskIvfIndexNode::VisitLists(const faiss::idx_t* keys, const float* coarse_dis, size_t nprobe, size_t beamwidth,
+                             const ListVisitor& visit) const {
+    auto code_size = index_->code_size;
+    auto visit_block = [&](size_t i, const uint8_t* block) {
+        auto n = list_sizes_[keys[i]];
+        auto ids = reinterpret_cast<const int64_t*>(block);
+        visit(keys[i], coarse_dis[i], n, ids, block + n * sizeof(int64_t));
+    };
+
+    std::vector<size_t> cached, pending;
+    for (size_t i = 0; i < nprobe; ++i) {
+        if (keys[i] < 0 || list_sizes_[keys[i]] == 0) {
+            continue;
+        }
+        (cached_lists_[keys[i]] != nullptr ? cached : pending).push_back(i);
+    }
+
+    std::vector<uint64_t> buf_offsets(pending.size() + 1, 0);
+    for (size_t j = 0; j < pending.size(); ++j) {
+        buf_offsets[j + 1] = buf_offsets[j] + RoundUp(ListBytes(keys[pending[j]]));
+    }
+    AlignedBuffer buf;
+    if (!pending.empty()) {
+        buf = AllocAligned(buf_offsets.back());
+    }
+
+    auto nbatch = (pending.size() + beamwidth - 1) / beamwidth;
+    auto batch_end = [&](size_t b) { return std::min(pending.size(), (b + 1) * beamwidth); };
+    std::vector<AlignedRead> reqs;
+    auto ctx = reader_->get_ctx();
+    size_t in_flight = 0;
+    auto submit = [&](size_t b) {
+        reqs.clear();
+        for (size_t j = b * beamwidth; j < batch_end(b); ++j) {
+            auto key = keys[pending[j]];
+            reqs.emplace_back(list_offsets_[key], RoundUp(ListBytes(key)), buf.get() + buf_offsets[j]);
+        }
+        reader_->submit_req(ctx, reqs);
+        in_flight = reqs.size();
+    };
+    auto wait = [&]() {
+        auto n = in_flight;
+        in_flight = 0;
+        reader_->get_submitted_req(ctx, n);
+    };
+
+    try {
+        // the pinned lists are scanned while the first batch is read
+        if (nbatch > 0) {
+            submit(0);
+        }
+        for (auto i : cached) {
+            visit_block(i, cached_lists_[keys[i]].get());
+        }
+        if (in_flight > 0) {
+            wait();
+        }
+        for (size_t b = 0; b < nbatch; ++b) {
+            if (b + 1 < nbatch) {
+                submit(b + 1);
+            }
+            for (size_t j = b * beamwidth; j < batch_end(b); ++j) {
+                visit_block(pending[j], buf.get() + buf_offsets[j]);
+            }
+            if (in_flight > 0) {
+                wait();
+            }
+        }
+    } catch (...) {
+        // the buffer must outlive the reads still in flight
+        if (in_flight > 0) {
+            try {
+                wait();
+            } catch (...) {
+            }
+        }
+        reader_->put_ctx(ctx);
+        throw;
+    }
+    reader_->put_ctx(ctx);
+}
+
+expected<DataSetPtr>
+DiskIvfIndexNode::Search(const DataSet& dataset, const Config& cfg, const BitsetView& bitset) const {
+    if (!is_prepared_.load() || !index_) {
+        LOG_KNOWHERE_ERROR_ << "Failed to load disk IVF.";
+        return Status::empty_index;
+    }
+    auto search_conf = static_cast<const DiskIvfConfig&>(cfg);
+    if (!CheckMetric(search_conf.metric_type.value())) {
+        return Status::invalid_metric_type;
+    }
+    if (IsMetricType(search_conf.metric_type.value(), metric::COSINE)) {
+        Normalize(dataset);
+    }
+
+    auto k = search_conf.k.value();
+    auto nprobe = std::min<size_t>(search_conf.nprobe.value(), index_->nlist);
+    auto beamwidth = static_cast<size_t>(search_conf.beamwidth.value());
+    // the SQ scanners don't set keep_max, the heap follows the metric as in IndexIVF
+    bool is_ip = (index_->metric_type == faiss::METRIC_INNER_PRODUCT);
+    auto nq = dataset.GetRows();
+    auto dim = dataset.GetDim();
+    auto xq = static_cast<const float*>(dataset.GetTensor());
+
+    auto p_id = new int64_t[k * nq];
+    auto p_dist = new float[k * nq];
+
+    bool all_searches_are_good = true;
+    std::vector<std::future<void>> futures;
+    futures.reserve(nq);
+    for (int64_t row = 0; row < nq; ++row) {
+        futures.push_back(pool_->push([&, index = row]() {
+            ThreadPool::ScopedOmpSetter setter(1);
+            auto query = xq + index * dim;
+            std::vector<faiss::idx_t> keys(nprobe);
+            std::vector<float> coarse_dis(nprobe);
+            index_->quantizer->search(1, query, nprobe, coarse_dis.data(), keys.data());
+
+            std::unique_ptr<faiss::InvertedListScanner> scanner(index_->get_InvertedListScanner(false));
+            scanner->set_query(query);
+            auto distances = p_dist + index * k;
+            auto labels = p_id + index * k;
+            if (is_ip) {
+                faiss::heap_heapify<faiss::CMin<float, int64_t>>(k, distances, labels);
+            } else {
+                faiss::heap_heapify<faiss::CMax<float, int64_t>>(k, distances, labels);
+            }
+            VisitLists(keys.data(), coarse_dis.data(), nprobe, beamwidth,
+                       [&](faiss::idx_t list_no, float dis, size_t n, const int64_t* ids, const uint8_t* codes) {
+                           scanner->set_list(list_no, dis);
+                           scanner->scan_codes(n, codes, nullptr, ids, distances, labels, k, bitset);
+                       });
+            if (is_ip) {
+                faiss::heap_reorder<faiss::CMin<float, int64_t>>(k, distances, labels);
+            } else {
+                faiss::heap_reorder<faiss::CMax<float, int64_t>>(k, distances, labels);
+            }
+        }));
+    }
+    for (auto& future : futures) {
+        if (TryDiskIvfCall([&]() { future.get(); }) != Status::success) {
+            all_searches_are_good = false;
+        }
+    }
+    if (!all_searches_are_good) {
+        delete[] p_id;
+        delete[] p_dist;
+        return Status::diskann_inner_error;
+    }
+
+    return GenResultDataSet(nq, k, p_id, p_dist);
+}
+
+expected<DataSetPtr>
+DiskIvfIndexNode::RangeSearch(const DataSet& dataset, const Config& cfg, const BitsetView& bitset) const {
+    if (!is_prepared_.load() || !index_) {
+        LOG_KNOWHERE_ERROR_ << "Failed to load disk IVF.";
+        return Status::empty_index;
+    }
+    auto search_conf = static_cast<const DiskIvfConfig&>(cfg);
+    if (!CheckMetric(search_conf.metric_type.value())) {
+        return Status::invalid_metric_type;
+    }
+    if (IsMetricType(search_conf.metric_type.value(), metric::COSINE)) {
+        Normalize(dataset);
+    }
+
+    auto nprobe = std::min<size_t>(search_conf.nprobe.value(), index_->nlist);
+    auto beamwidth = static_cast<size_t>(search_conf.beamwidth.value());
+    auto radius = search_conf.radius.value();
+    auto range_filter = search_conf.range_filter.value();
+    bool is_ip = (index_->metric_type == faiss::METRIC_INNER_PRODUCT);
+    auto nq = dataset.GetRows();
+    auto dim = dataset.GetDim();
+    auto xq = static_cast<const float*>(dataset.GetTensor());
+
+    int64_t* p_id = nullptr;
+    float* p_dist = nullptr;
+    size_t* p_lims = nullptr;
+
+    std::vector<std::vector<int64_t>> result_id_array(nq);
+    std::vector<std::vector<float>> result_dist_array(nq);
+
+    bool all_searches_are_good = true;
+    std::vector<std::future<void>> futures;
+    futures.reserve(nq);
+    for (int64_t row = 0; row < nq; ++row) {
+        futures.push_back(pool_->push([&, index = row]() {
+            ThreadPool::ScopedOmpSetter setter(1);
+            auto query = xq + index * dim;
+            std::vector<faiss::idx_t> keys(nprobe);
+            std::vector<float> coarse_dis(nprobe);
+            index_->quantizer->search(1, query, nprobe, coarse_dis.data(), keys.data());
+
+            std::unique_ptr<faiss::InvertedListScanner> scanner(index_->get_InvertedListScanner(false));
+            scanner->set_query(query);
+            faiss::RangeSearchResult res(1);
+            faiss::RangeSearchPartialResult pres(&res);
+            auto& qres = pres.new_result(0);
+            VisitLists(keys.data(), coarse_dis.data(), nprobe, beamwidth,
+                       [&](faiss::idx_t list_no, float dis, size_t n, const int64_t* ids, const uint8_t* codes) {
+                           scanner->set_list(list_no, dis);
+                           scanner->scan_codes_range(n, codes, nullptr, ids, radius, qres, bitset);
+                       });
+            pres.finalize();
+
+            auto elem_cnt = res.lims[1];
+            result_dist_array[index].assign(res.distances, res.distances + elem_cnt);
+            result_id_array[index].assign(res.labels, res.labels + elem_cnt);
+            if (range_filter != defaultRangeFilter) {
+                FilterRangeSearchResultForOneNq(result_dist_array[index], result_id_array[index], is_ip, radius,
+                                                range_filter);
+            }
+        }));
+    }
+    for (auto& future : futures) {
+        if (TryDiskIvfCall([&]() { future.get(); }) != Status::success) {
+            all_searches_are_good = false;
+        }
+    }
+    if (!all_searches_are_good) {
+        return Status::diskann_inner_error;
+    }
+
+    GetRangeSearchResult(result_dist_array, result_id_array, is_ip, nq, radius, range_filter, p_dist, p_id, p_lims);
+    return GenResultDataSet(nq, p_id, p_dist, p_lims);
+}
+
+KNOWHERE_REGISTER_GLOBAL(DISK_IVF, [](const Object& object) { return Index<DiskIvfIndexNode>::Create(object); });
+}  // namespace knowhere
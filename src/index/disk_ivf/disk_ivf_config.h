@@ -0,0 +1,70 @@
+// Copyright (C) 2019-2023 Zilliz. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance
+// with the License. You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied. See the License for the specific language governing permissions and limitations under the License.
+
+#ifndef DISK_IVF_CONFIG_H
+#define DISK_IVF_CONFIG_H
+
+#include "knowhere/config.h"
+
+namespace knowhere {
+
+class DiskIvfConfig : public BaseConfig {
+ public:
+    // Path prefix to load or save the index files.
+    CFG_STRING index_prefix;
+    // The path to the raw data file. Raw data's format should be [row_num(4 bytes) | dim_num(4 bytes) | vectors].
+    CFG_STRING data_path;
+    CFG_INT nlist;
+    CFG_INT nprobe;
+    // Inverted lists kept in memory after loading, in GB. The largest lists go first: queries follow the data
+    // distribution, so the most populated cells are also the most probed ones.
+    CFG_FLOAT search_cache_budget_gb;
+    // Probed lists fetched by one batch of async reads. The next batch is in flight while the current one is scanned,
+    // so larger values trade memory per query for fewer round-trips.
+    CFG_INT beamwidth;
+    KNOHWERE_DECLARE_CONFIG(DiskIvfConfig) {
+        KNOWHERE_CONFIG_DECLARE_FIELD(metric_type)
+            .set_default("L2")
+            .description("metric type")
+            .for_train_and_search()
+            .for_deserialize();
+        KNOWHERE_CONFIG_DECLARE_FIELD(index_prefix)
+            .description("path to load or save the disk IVF index.")
+            .for_train()
+            .for_deserialize();
+        KNOWHERE_CONFIG_DECLARE_FIELD(data_path).description("raw data path.").for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(nlist)
+            .set_default(128)
+            .description("number of inverted lists.")
+            .for_train()
+            .set_range(1, 1048576);
+        KNOWHERE_CONFIG_DECLARE_FIELD(nprobe)
+            .set_default(8)
+            .description("number of probes at query time.")
+            .for_search()
+            .set_range(1, 65536)
+            .for_range_search();
+        KNOWHERE_CONFIG_DECLARE_FIELD(search_cache_budget_gb)
+            .description("the size of cached inverted lists in GB.")
+            .set_default(0)
+            .set_range(0, std::numeric_limits<CFG_FLOAT::value_type>::max())
+            .for_deserialize();
+        KNOWHERE_CONFIG_DECLARE_FIELD(beamwidth)
+            .description("the number of inverted lists read from disk by one batch of IO requests.")
+            .set_default(8)
+            .set_range(1, 128)
+            .for_search()
+            .for_range_search();
+    }
+};
+
+}  // namespace knowhere
+#endif /* DISK_IVF_CONFIG_H */
@@ -13,8 +13,13 @@
 
 #include <omp.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <exception>
+#include <mutex>
 #include <new>
+#include <numeric>
 
 #include "common/range_util.h"
 #include "hnswlib/hnswalg.h"
@@ -79,19 +84,60 @@ class HnswIndexNode : public IndexNode {
 
         knowhere::TimeRecorder build_time("Building HNSW cost");
         auto rows = dataset.GetRows();
-        auto tensor = dataset.GetTensor();
+        auto tensor = (const char*)dataset.GetTensor();
         auto hnsw_cfg = static_cast<const HnswConfig&>(cfg);
-        index_->addPoint(tensor, 0);
+        auto method = hnsw_cfg.build_method.value();
+        if (method != "INCREMENTAL" && method != "NNDESCENT") {
+            LOG_KNOWHERE_ERROR_ << "invalid build method " << method;
+            return Status::invalid_args;
+        }
+        // points added to a built or loaded index take the ids after the current ones, with room made in place
+        int64_t base = index_->cur_element_count;
+        if (base + rows > static_cast<int64_t>(index_->max_elements_)) {
+            try {
+                index_->resizeIndex(base + rows);
+            } catch (std::exception& e) {
+                LOG_KNOWHERE_WARNING_ << "hnsw inner error: " << e.what();
+                return Status::hnsw_inner_error;
+            }
+        }
+        std::unique_ptr<ThreadPool::ScopedOmpSetter> setter;
+        if (hnsw_cfg.num_build_thread.has_value()) {
+            setter = std::make_unique<ThreadPool::ScopedOmpSetter>(hnsw_cfg.num_build_thread.value());
+        }
 
-#pragma omp parallel for
-        for (int i = 1; i < rows; ++i) {
-            index_->addPoint(((const char*)tensor + index_->data_size_ * i), i);
+        // points added to a built index, or too few to sample a kNN graph from, are inserted whatever the method
+        if (method == "NNDESCENT" && index_->canBuildByNNDescent(rows)) {
+            try {
+                index_->buildByNNDescent(tensor, rows);
+            } catch (std::exception& e) {
+                LOG_KNOWHERE_WARNING_ << "hnsw inner error: " << e.what();
+                return Status::hnsw_inner_error;
+            }
+        } else {
+            auto status = Insert(tensor, rows, base);
+            if (status != Status::success) {
+                return status;
+            }
+        }
+        index_->compactLinkLists();
+        if (hnsw_cfg.entry_points.value() > 0) {
+            try {
+                index_->buildEntryPoints(hnsw_cfg.entry_points.value());
+            } catch (std::exception& e) {
+                LOG_KNOWHERE_WARNING_ << "hnsw inner error: " << e.what();
+                return Status::hnsw_inner_error;
+            }
         }
         build_time.RecordSection("");
         LOG_KNOWHERE_INFO_ << "HNSW built with #points num:" << index_->max_elements_ << " #M:" << index_->M_
                            << " #max level:" << index_->maxlevel_ << " #ef_construction:" << index_->ef_construction_
                            << " #dim:" << *(size_t*)(index_->space_->get_dist_func_param());
-        return Status::success;
+        // renumbering rewrites the whole graph, so it is done on the initial build only
+        if (base > 0) {
+            return Status::success;
+        }
+        return Reorder(hnsw_cfg.reorder.value());
     }
 
     expected<DataSetPtr>
@@ -250,7 +296,7 @@ class HnswIndexNode : public IndexNode {
             for (int64_t i = 0; i < rows; i++) {
                 int64_t id = ids[i];
                 assert(id >= 0 && id < (int64_t)index_->cur_element_count);
-                std::copy_n(index_->getDataByInternalId(id), index_->data_size_, data + i * index_->data_size_);
+                index_->copyDataByInternalId(index_->getInternalId(id), data + i * index_->data_size_);
             }
             return GenResultDataSet(rows, dim, data);
         } catch (std::exception& e) {
@@ -294,6 +340,36 @@ class HnswIndexNode : public IndexNode {
         return GenResultDataSet(json_meta.dump(), json_id_set.dump());
     }
 
+    Status
+    MarkDeleted(const DataSet& dataset) override {
+        if (!index_) {
+            return Status::empty_index;
+        }
+        auto rows = dataset.GetRows();
+        auto ids = dataset.GetIds();
+        // a batch with any invalid id is rejected before anything is deleted
+        for (int64_t i = 0; i < rows; ++i) {
+            if (ids[i] < 0 || ids[i] >= Count()) {
+                LOG_KNOWHERE_ERROR_ << "id " << ids[i] << " is not in the HNSW index";
+                return Status::invalid_args;
+            }
+        }
+        try {
+            for (int64_t i = 0; i < rows; ++i) {
+                index_->markDeleted(index_->getInternalId(ids[i]));
+            }
+            if (index_->needsRepair()) {
+                knowhere::TimeRecorder repair_time("Repairing HNSW cost");
+                index_->repairDeleted();
+                repair_time.RecordSection("");
+            }
+        } catch (std::exception& e) {
+            LOG_KNOWHERE_WARNING_ << "hnsw inner error: " << e.what();
+            return Status::hnsw_inner_error;
+        }
+        return Status::success;
+    }
+
     Status
     Serialize(BinarySet& binset) const override {
         if (!index_) {
@@ -339,7 +415,7 @@ class HnswIndexNode : public IndexNode {
             LOG_KNOWHERE_WARNING_ << "hnsw inner error: " << e.what();
             return Status::hnsw_inner_error;
         }
-        return Status::success;
+        return Reorder(static_cast<const HnswConfig&>(config).reorder.value());
     }
 
     Status
@@ -355,7 +431,12 @@ class HnswIndexNode : public IndexNode {
             LOG_KNOWHERE_WARNING_ << "hnsw inner error: " << e.what();
             return Status::hnsw_inner_error;
         }
-        return Status::success;
+        auto hnsw_cfg = static_cast<const HnswConfig&>(config);
+        // a mapped level 0 is read-only
+        if (hnsw_cfg.enable_mmap.value()) {
+            return Status::success;
+        }
+        return Reorder(hnsw_cfg.reorder.value());
     }
 
     std::unique_ptr<BaseConfig>
@@ -399,6 +480,86 @@ class HnswIndexNode : public IndexNode {
     }
 
  private:
+    // inserts the points one by one, taking the ids from base on
+    Status
+    Insert(const char* tensor, int64_t rows, int64_t base) {
+        // Levels are drawn up front and the points inserted from the highest level down: the first one is the entry
+        // point for good, so no later insertion holds the global lock to raise it, and the upper layers are in place
+        // before the bulk of the level 0 insertions runs.
+        std::vector<int> levels(rows);
+        for (auto& level : levels) {
+            level = index_->getRandomLevel(index_->mult_);
+        }
+        std::vector<int64_t> order(rows);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](int64_t a, int64_t b) { return levels[a] > levels[b]; });
+        auto upper_rows = std::count_if(levels.begin(), levels.end(), [](int level) { return level > 0; });
+
+        std::atomic<int64_t> inserted = 0;
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto progress_step = std::max<int64_t>(rows / 10, 1);
+        auto start = std::chrono::steady_clock::now();
+        auto insert = [&](int64_t i) {
+            try {
+                auto id = order[i];
+                index_->addPoint(tensor + index_->data_size_ * id, base + id, levels[id]);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                error = std::current_exception();
+            }
+            auto n = ++inserted;
+            if (n % progress_step == 0 || n == rows) {
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                LOG_KNOWHERE_INFO_ << "HNSW build progress " << n << "/" << rows << ", "
+                                   << static_cast<int64_t>(n / std::max(elapsed.count(), 1e-6)) << " points/s";
+            }
+        };
+        if (rows > 0) {
+            insert(0);
+        }
+#pragma omp parallel for schedule(dynamic, 16)
+        for (int64_t i = 1; i < upper_rows; ++i) {
+            insert(i);
+        }
+#pragma omp parallel for schedule(dynamic, 256)
+        for (int64_t i = std::max<int64_t>(upper_rows, 1); i < rows; ++i) {
+            insert(i);
+        }
+        if (error) {
+            try {
+                std::rethrow_exception(error);
+            } catch (std::exception& e) {
+                LOG_KNOWHERE_WARNING_ << "hnsw inner error: " << e.what();
+                return Status::hnsw_inner_error;
+            }
+        }
+        return Status::success;
+    }
+
+    Status
+    Reorder(const std::string& method) {
+        if (method == "NONE") {
+            return Status::success;
+        }
+        if (method != "BFS" && method != "RCM") {
+            LOG_KNOWHERE_ERROR_ << "invalid reorder method " << method;
+            return Status::invalid_args;
+        }
+        if (index_->cur_element_count == 0) {
+            return Status::success;
+        }
+        try {
+            knowhere::TimeRecorder reorder_time("Reordering HNSW cost");
+            index_->reorder(index_->getLocalityOrder(method == "RCM"));
+            reorder_time.RecordSection(method);
+        } catch (std::exception& e) {
+            LOG_KNOWHERE_WARNING_ << "hnsw inner error: " << e.what();
+            return Status::hnsw_inner_error;
+        }
+        return Status::success;
+    }
+
     void
     UpdateLevelLinkList(int32_t level, feder::hnsw::HNSWMeta& meta, std::unordered_set<int64_t>& id_set) const {
         if (!(level > 0 && level <= index_->maxlevel_)) {
@@ -413,7 +574,7 @@ class HnswIndexNode : public IndexNode {
         // get all elements in current level
         for (size_t i = 0; i < index_->cur_element_count; i++) {
             // elements in high level also exist in low level
-            if (index_->element_levels_[i] >= level) {
+            if (index_->elementLevel(i) >= level) {
                 level_elements.emplace_back(i);
             }
         }
@@ -435,11 +596,97 @@ class HnswIndexNode : public IndexNode {
         }
     }
 
- private:
+ protected:
     hnswlib::HierarchicalNSW<float>* index_;
     std::shared_ptr<ThreadPool> pool_;
 };
 
+// HNSW searching over compressed vectors. The graph is built on the float vectors, which are then replaced by their
+// codes; with refine, the float vectors are kept to re-rank the candidates by exact distance.
+template <hnswlib::QuantType quant_type>
+class HnswQuantIndexNode : public HnswIndexNode {
+ public:
+    HnswQuantIndexNode(const Object& object) : HnswIndexNode(object) {
+    }
+
+    Status
+    Train(const DataSet& dataset, const Config& cfg) override {
+        auto hnsw_cfg = static_cast<const HnswSqConfig&>(cfg);
+        auto metric_type = hnsw_cfg.metric_type.value();
+        if (!IsMetricType(metric_type, metric::L2) && !IsMetricType(metric_type, metric::IP) &&
+            !IsMetricType(metric_type, metric::COSINE)) {
+            LOG_KNOWHERE_WARNING_ << "metric type not support in " << Type() << ": " << metric_type;
+            return Status::invalid_metric_type;
+        }
+        if constexpr (quant_type == hnswlib::QuantType::PQ) {
+            auto m = static_cast<const HnswPqConfig&>(cfg).m.value();
+            if (dataset.GetDim() % m != 0) {
+                LOG_KNOWHERE_ERROR_ << "dim(" << dataset.GetDim() << ") is not a multiple of m(" << m << ")";
+                return Status::invalid_args;
+            }
+        }
+        return HnswIndexNode::Train(dataset, cfg);
+    }
+
+    Status
+    Add(const DataSet& dataset, const Config& cfg) override {
+        if (index_ && index_->quant_type_ != hnswlib::QuantType::NONE) {
+            LOG_KNOWHERE_ERROR_ << "Can not add data to quantized HNSW index.";
+            return Status::not_implemented;
+        }
+        auto status = HnswIndexNode::Add(dataset, cfg);
+        if (status != Status::success) {
+            return status;
+        }
+        auto hnsw_cfg = static_cast<const HnswSqConfig&>(cfg);
+        size_t m = 0;
+        if constexpr (quant_type == hnswlib::QuantType::PQ) {
+            m = static_cast<const HnswPqConfig&>(cfg).m.value();
+        }
+        try {
+            index_->quantize(quant_type, m, hnsw_cfg.refine.value());
+        } catch (std::exception& e) {
+            LOG_KNOWHERE_WARNING_ << "hnsw inner error: " << e.what();
+            return Status::hnsw_inner_error;
+        }
+        return Status::success;
+    }
+
+    bool
+    HasRawData(const std::string& metric_type) const override {
+        return index_ && index_->hasRefineData();
+    }
+
+    std::unique_ptr<BaseConfig>
+    CreateConfig() const override {
+        if constexpr (quant_type == hnswlib::QuantType::PQ) {
+            return std::make_unique<HnswPqConfig>();
+        } else {
+            return std::make_unique<HnswSqConfig>();
+        }
+    }
+
+    std::string
+    Type() const override {
+        if constexpr (quant_type == hnswlib::QuantType::SQ8) {
+            return knowhere::IndexEnum::INDEX_HNSW_SQ8;
+        } else if constexpr (quant_type == hnswlib::QuantType::FP16) {
+            return knowhere::IndexEnum::INDEX_HNSW_FP16;
+        } else {
+            return knowhere::IndexEnum::INDEX_HNSW_PQ;
+        }
+    }
+};
+
 KNOWHERE_REGISTER_GLOBAL(HNSW, [](const Object& object) { return Index<HnswIndexNode>::Create(object); });
+KNOWHERE_REGISTER_GLOBAL(HNSW_SQ8, [](const Object& object) {
+    return Index<HnswQuantIndexNode<hnswlib::QuantType::SQ8>>::Create(object);
+});
+KNOWHERE_REGISTER_GLOBAL(HNSW_FP16, [](const Object& object) {
+    return Index<HnswQuantIndexNode<hnswlib::QuantType::FP16>>::Create(object);
+});
+KNOWHERE_REGISTER_GLOBAL(HNSW_PQ, [](const Object& object) {
+    return Index<HnswQuantIndexNode<hnswlib::QuantType::PQ>>::Create(object);
+});
 
 }  // namespace knowhere
@@ -30,6 +30,9 @@ class HnswConfig : public BaseConfig {
     CFG_INT efConstruction;
     CFG_INT ef;
     CFG_INT overview_levels;
+    CFG_STRING reorder;
+    CFG_INT entry_points;
+    CFG_STRING build_method;
     KNOHWERE_DECLARE_CONFIG(HnswConfig) {
         KNOWHERE_CONFIG_DECLARE_FIELD(M).description("hnsw M").set_default(30).set_range(1, 2048).for_train();
         KNOWHERE_CONFIG_DECLARE_FIELD(efConstruction)
@@ -48,6 +51,21 @@ class HnswConfig : public BaseConfig {
             .set_default(3)
             .set_range(1, 5)
             .for_feder();
+        KNOWHERE_CONFIG_DECLARE_FIELD(reorder)
+            .description("renumber the graph for locality after the initial build or load, one of NONE, BFS, RCM")
+            .set_default("NONE")
+            .for_train()
+            .for_deserialize()
+            .for_deserialize_from_file();
+        KNOWHERE_CONFIG_DECLARE_FIELD(entry_points)
+            .description("number of centroids searches start next to in place of the upper layers, 0 is off")
+            .set_default(0)
+            .set_range(0, 65536)
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(build_method)
+            .description("how the graph is built, INCREMENTAL insertions or NNDESCENT from an approximate kNN graph")
+            .set_default("INCREMENTAL")
+            .for_train();
     }
 
     inline Status
@@ -72,6 +90,25 @@ class HnswConfig : public BaseConfig {
     }
 };
 
+class HnswSqConfig : public HnswConfig {
+ public:
+    CFG_BOOL refine;
+    KNOHWERE_DECLARE_CONFIG(HnswSqConfig) {
+        KNOWHERE_CONFIG_DECLARE_FIELD(refine)
+            .description("whether to keep vectors for exact re-ranking")
+            .set_default(false)
+            .for_train();
+    }
+};
+
+class HnswPqConfig : public HnswSqConfig {
+ public:
+    CFG_INT m;
+    KNOHWERE_DECLARE_CONFIG(HnswPqConfig) {
+        KNOWHERE_CONFIG_DECLARE_FIELD(m).description("m").set_default(4).for_train().set_range(1, 65536);
+    }
+};
+
 }  // namespace knowhere
 
 #endif /* HNSW_CONFIG_H */
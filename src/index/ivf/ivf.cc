@@ -9,28 +9,46 @@
 // is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
 // or implied. See the License for the specific language governing permissions and limitations under the License.
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+#include <typeinfo>
+#include <unordered_map>
+
 #include "common/metric.h"
 #include "common/range_util.h"
 #include "faiss/IndexBinaryFlat.h"
 #include "faiss/IndexBinaryIVF.h"
 #include "faiss/IndexFlat.h"
+#include "faiss/IndexHNSW.h"
 #include "faiss/IndexIVFFlat.h"
 #include "faiss/IndexIVFPQ.h"
+#include "faiss/IndexRefine.h"
 #include "faiss/IndexScalarQuantizer.h"
+#include "faiss/impl/AuxIndexStructures.h"
 #include "faiss/index_io.h"
+#include "faiss/utils/Heap.h"
 #include "index/ivf/ivf_config.h"
+#include "index/ivf/kmeans.h"
 #include "io/FaissIO.h"
 #include "knowhere/factory.h"
 #include "knowhere/feder/IVFFlat.h"
 #include "knowhere/index_node_thread_pool_wrapper.h"
 #include "knowhere/log.h"
 #include "knowhere/utils.h"
+#include "simd/hook.h"
 
 namespace knowhere {
 
 template <typename T>
 struct QuantizerT {
-    typedef faiss::IndexFlat type;
+    typedef faiss::Index type;
 };
 
 template <>
@@ -50,9 +68,20 @@ class IvfIndexNode : public IndexNode {
         pool_ = ThreadPool::GetGlobalThreadPool();
     }
     Status
+    Build(const DataSet& dataset, const Config& cfg) override {
+        RETURN_IF_ERROR(Train(dataset, cfg));
+        // Train has normalized COSINE data already
+        return AddData(dataset, cfg, false);
+    }
+    Status
     Train(const DataSet& dataset, const Config& cfg) override;
     Status
-    Add(const DataSet& dataset, const Config& cfg) override;
+    Add(const DataSet& dataset, const Config& cfg) override {
+        return AddData(dataset, cfg, true);
+    }
+    Status
+    Merge(const std::vector<const IndexNode*>& sources, const Config& cfg,
+          const std::vector<BitsetView>& deleted) override;
     expected<DataSetPtr>
     Search(const DataSet& dataset, const Config& cfg, const BitsetView& bitset) const override;
     expected<DataSetPtr>
@@ -67,11 +96,11 @@ class IvfIndexNode : public IndexNode {
         if constexpr (std::is_same<faiss::IndexIVFFlatCC, T>::value) {
             return true;
         }
-        if constexpr (std::is_same<faiss::IndexIVFPQ, T>::value) {
-            return false;
-        }
-        if constexpr (std::is_same<faiss::IndexIVFScalarQuantizer, T>::value) {
-            return false;
+        if constexpr (std::is_same<faiss::IndexIVFPQ, T>::value ||
+                      std::is_same<faiss::IndexIVFScalarQuantizer, T>::value) {
+            // only an fp32 refine store keeps the original vectors
+            return dynamic_cast<faiss::IndexFlat*>(refine_index_.get()) != nullptr &&
+                   !IsMetricType(metric_type, metric::COSINE);
         }
         if constexpr (std::is_same<faiss::IndexBinaryIVF, T>::value) {
             return true;
@@ -84,6 +113,8 @@ class IvfIndexNode : public IndexNode {
     Status
     Serialize(BinarySet& binset) const override;
     Status
+    SerializeTemplate(BinarySet& binset) const override;
+    Status
     Deserialize(const BinarySet& binset, const Config& config) override;
     Status
     DeserializeFromFile(const std::string& filename, const Config& config) override;
@@ -119,39 +150,38 @@ class IvfIndexNode : public IndexNode {
         }
         if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
             auto nb = index_->invlists->compute_ntotal();
-            auto nlist = index_->nlist;
             auto code_size = index_->code_size;
-            return (nb * code_size + nb * sizeof(int64_t) + nlist * code_size);
+            return (nb * code_size + nb * sizeof(int64_t) + QuantizerSize() + DirectMapSize());
         }
         if constexpr (std::is_same<T, faiss::IndexIVFFlatCC>::value) {
             auto nb = index_->invlists->compute_ntotal();
-            auto nlist = index_->nlist;
             auto code_size = index_->code_size;
-            return (nb * code_size + nb * sizeof(int64_t) + nlist * code_size);
+            return (nb * code_size + nb * sizeof(int64_t) + QuantizerSize());
         }
         if constexpr (std::is_same<T, faiss::IndexIVFPQ>::value) {
             auto nb = index_->invlists->compute_ntotal();
             auto code_size = index_->code_size;
             auto pq = index_->pq;
             auto nlist = index_->nlist;
-            auto d = index_->d;
 
-            auto capacity = nb * code_size + nb * sizeof(int64_t) + nlist * d * sizeof(float);
+            auto capacity = nb * code_size + nb * sizeof(int64_t) + QuantizerSize();
             auto centroid_table = pq.M * pq.ksub * pq.dsub * sizeof(float);
             auto precomputed_table = nlist * pq.M * pq.ksub * sizeof(float);
-            return (capacity + centroid_table + precomputed_table);
+            return (capacity + centroid_table + precomputed_table + RefineSize() + DirectMapSize());
         }
         if constexpr (std::is_same<T, faiss::IndexIVFScalarQuantizer>::value) {
             auto nb = index_->invlists->compute_ntotal();
             auto code_size = index_->code_size;
-            auto nlist = index_->nlist;
-            return (nb * code_size + nb * sizeof(int64_t) + 2 * code_size + nlist * code_size);
+            // trained holds the per-dimension (or uniform) vmin/vdiff ranges, empty for fp16 and 8bit_direct
+            auto trained = index_->sq.trained.size() * sizeof(float);
+            return (nb * code_size + nb * sizeof(int64_t) + trained + QuantizerSize() + RefineSize() +
+                    DirectMapSize());
         }
         if constexpr (std::is_same<T, faiss::IndexBinaryIVF>::value) {
             auto nb = index_->invlists->compute_ntotal();
             auto nlist = index_->nlist;
             auto code_size = index_->code_size;
-            return (nb * code_size + nb * sizeof(int64_t) + nlist * code_size);
+            return (nb * code_size + nb * sizeof(int64_t) + nlist * code_size + DirectMapSize());
         }
     };
     int64_t
@@ -159,6 +189,9 @@ class IvfIndexNode : public IndexNode {
         if (!index_) {
             return 0;
         }
+        if constexpr (std::is_same<T, faiss::IndexIVFFlatCC>::value) {
+            return Snapshot()->ntotal;
+        }
         return index_->ntotal;
     };
     std::string
@@ -181,7 +214,127 @@ class IvfIndexNode : public IndexNode {
     };
 
  private:
+    // centroids and their covering radii, plus the graph links of a HNSW coarse quantizer
+    int64_t
+    QuantizerSize() const {
+        int64_t size = index_->nlist * index_->d * sizeof(float) + list_radius_.size() * sizeof(float);
+        if (auto hnsw_qzr = dynamic_cast<const faiss::IndexHNSW*>(index_->quantizer)) {
+            const auto& hnsw = hnsw_qzr->hnsw;
+            size += hnsw.neighbors.size() * sizeof(faiss::HNSW::storage_idx_t) + hnsw.offsets.size() * sizeof(size_t) +
+                    hnsw.levels.size() * sizeof(int);
+        }
+        return size;
+    }
+    int64_t
+    RefineSize() const {
+        if (!refine_index_) {
+            return 0;
+        }
+        return refine_index_->ntotal * refine_index_->sa_code_size();
+    }
+    // the lists as of the last completed Add of IVF_FLAT_CC, so that a request sees all of a concurrent batch or none
+    // of it; null for the other indexes, which are not searched while they grow
+    std::shared_ptr<const faiss::InvertedListsSnapshot>
+    Snapshot() const {
+        if constexpr (std::is_same<T, faiss::IndexIVFFlatCC>::value) {
+            return index_->snapshot();
+        } else {
+            return nullptr;
+        }
+    }
+    int64_t
+    DirectMapSize() const {
+        return direct_map_.size() * sizeof(faiss::idx_t);
+    }
+    // the direct map in memory, or the one of a mapped IVF_FLAT file
+    const faiss::idx_t*
+    DirectMapData() const {
+        return mapped_direct_map_ != nullptr ? mapped_direct_map_ : direct_map_.data();
+    }
+    int64_t
+    DirectMapCount() const {
+        return mapped_direct_map_ != nullptr ? index_->ntotal : direct_map_.size();
+    }
+    void
+    BuildDirectMap();
+    // Add, normalizing COSINE data first when normalize is set
+    Status
+    AddData(const DataSet& dataset, const Config& cfg, bool normalize);
+    // row-major centroids of a flat or HNSW coarse quantizer
+    const float*
+    Centroids() const {
+        auto flat = dynamic_cast<const faiss::IndexFlat*>(index_->quantizer);
+        if (auto hnsw_qzr = dynamic_cast<const faiss::IndexHNSW*>(index_->quantizer)) {
+            flat = dynamic_cast<const faiss::IndexFlat*>(hnsw_qzr->storage);
+        }
+        return flat != nullptr ? flat->get_xb() : nullptr;
+    }
+    // covering radii of the lists, computed by the first range search pruning by them and dropped when vectors are
+    // added; empty when the lists cannot be pruned
+    const std::vector<float>&
+    ListRadii() const;
+    void
+    ResetListRadii() {
+        list_radius_.clear();
+        list_radius_ready_ = false;
+    }
+    // drop the data of a trained index for the reuse_quantizer training mode
+    Status
+    ReuseQuantizer(int64_t dim, faiss::MetricType metric);
+    // whether other was trained with the same centroids and codebooks, so that its codes are valid here
+    bool
+    SameQuantizers(const IvfIndexNode& other) const;
+    // an empty index with copies of the quantizers of other
+    void
+    AdoptQuantizers(const IvfIndexNode& other);
+    // hand the coarse quantizer of a loaded index over to SharedQuantizers
+    void
+    ShareQuantizer();
+    // IVF_FLAT only, reads one of its binaries; in_place keeps the vectors, ids and direct map of the page-aligned
+    // layout in binary (e.g. a file mapping) instead of copying them, raw_data is needed by binaries of old versions
+    Status
+    LoadIvfFlat(const BinaryPtr& binary, const BinaryPtr& raw_data, bool in_place);
+    void
+    LoadIndex(faiss::Index* index) {
+        if (auto refine = dynamic_cast<faiss::IndexRefine*>(index)) {
+            index_.reset(static_cast<T*>(refine->base_index));
+            refine_index_.reset(refine->refine_index);
+            refine->own_fields = false;
+            refine->own_refine_index = false;
+            delete refine;
+        } else {
+            index_.reset(static_cast<T*>(index));
+            refine_index_.reset();
+        }
+        shared_quantizer_.reset();
+    }
+    void
+    RefineSearch(const float* query, int64_t k, int64_t k_base, float* base_dis, const int64_t* base_ids,
+                 float* distances, int64_t* ids) const;
+    void
+    BatchSearch(const float* xq, int64_t nq, int64_t k, int64_t nprobe, const BitsetView& bitset, float* distances,
+                int64_t* ids) const;
+    int64_t
+    AdaptiveSearch(const float* query, int64_t k, int64_t nprobe, float factor, const BitsetView& bitset,
+                   const faiss::InvertedListsSnapshot* snapshot, float* distances, int64_t* ids) const;
+    int64_t
+    PrunedRangeSearch(const float* query, float radius, const BitsetView& bitset, faiss::RangeSearchResult* res) const;
+
+    // the coarse quantizer of index_ when it is loaded with share_quantizer, index_ doesn't own it then
+    std::shared_ptr<faiss::Index> shared_quantizer_;
     std::unique_ptr<T> index_;
+    // id -> (list << 32 | offset), rebuilt whenever vectors are added or loaded and read-only in between; ids of
+    // these indexes are always 0..ntotal-1. IVF_FLAT_CC grows concurrently with reads and keeps the faiss direct map.
+    std::vector<faiss::idx_t> direct_map_;
+    // direct map stored in a mapped IVF_FLAT file, which the inverted lists keep alive; used instead of direct_map_
+    const faiss::idx_t* mapped_direct_map_ = nullptr;
+    // largest L2 distance from a vector of each list, as the index decodes it, to the list centroid; empty for
+    // IVF_FLAT_CC and binary IVF
+    mutable std::vector<float> list_radius_;
+    mutable bool list_radius_ready_ = false;
+    mutable std::mutex list_radius_mutex_;
+    // exact vectors used to re-rank IVF_PQ / IVF_SQ candidates, null when refine is off
+    std::unique_ptr<faiss::Index> refine_index_;
     std::shared_ptr<ThreadPool> pool_;
 };
 
@@ -221,6 +374,362 @@ MatchNbits(int64_t size, int64_t nbits) {
     return nbits;
 }
 
+expected<faiss::QuantizerType>
+Str2FaissQuantizerType(std::string sq_type) {
+    static const std::unordered_map<std::string, faiss::QuantizerType> sq_type_map = {
+        {"SQ8", faiss::QuantizerType::QT_8bit},
+        {"SQ8_UNIFORM", faiss::QuantizerType::QT_8bit_uniform},
+        {"SQ8_DIRECT", faiss::QuantizerType::QT_8bit_direct},
+        {"SQ6", faiss::QuantizerType::QT_6bit},
+        {"SQ4", faiss::QuantizerType::QT_4bit},
+        {"SQ4_UNIFORM", faiss::QuantizerType::QT_4bit_uniform},
+        {"FP16", faiss::QuantizerType::QT_fp16},
+    };
+
+    std::transform(sq_type.begin(), sq_type.end(), sq_type.begin(), toupper);
+    auto it = sq_type_map.find(sq_type);
+    if (it == sq_type_map.end()) {
+        return Status::invalid_args;
+    }
+    return it->second;
+}
+
+// marks the page-aligned IVF_FLAT layout, a file holding it is mapped and searched in place
+const uint32_t kMappedLayoutMagic = faiss::fourcc("IfMp");
+// sections of the mapped layout start at multiples of the page size
+constexpr uint64_t kMappedSectionAlign = 4096;
+
+// Offsets are counted from the start of the binary. The vectors, ids and direct map are ntotal entries each and the
+// list offsets nlist + 1 (a prefix sum of the list sizes), a direct map offset of 0 means none was stored.
+struct MappedLayoutHeader {
+    uint64_t nlist = 0;
+    uint64_t code_size = 0;
+    uint64_t ntotal = 0;
+    uint64_t codes_offset = 0;
+    uint64_t ids_offset = 0;
+    uint64_t list_offsets_offset = 0;
+    uint64_t direct_map_offset = 0;
+};
+
+uint64_t
+AlignSection(uint64_t offset) {
+    return (offset + kMappedSectionAlign - 1) / kMappedSectionAlign * kMappedSectionAlign;
+}
+
+// IVF_FLAT binary layout:
+//   NM index with empty lists | magic | MappedLayoutHeader | #radii | radii |
+//   pad | vectors | pad | ids | pad | list offsets | pad | direct map
+// vectors and ids are in list-major order, so a list is one contiguous range of each.
+void
+WriteMappedLayout(const faiss::IndexIVFFlat* index, const faiss::idx_t* direct_map, const std::vector<float>& radii,
+                  MemoryIOWriter& writer) {
+    // the ids get a section of their own, write_index_nm would inline them into the header
+    faiss::IndexIVFFlat shell(index->quantizer, index->d, index->nlist, index->metric_type);
+    shell.metric_arg = index->metric_arg;
+    shell.ntotal = index->ntotal;
+    shell.is_trained = index->is_trained;
+    shell.nprobe = index->nprobe;
+    faiss::write_index_nm(&shell, &writer);
+
+    auto invlists = index->invlists;
+    MappedLayoutHeader header;
+    header.nlist = invlists->nlist;
+    header.code_size = invlists->code_size;
+    header.ntotal = invlists->compute_ntotal();
+    uint64_t nradii = radii.size();
+    auto header_end = writer.rp + sizeof(kMappedLayoutMagic) + sizeof(header) + sizeof(nradii) + nradii * sizeof(float);
+    header.codes_offset = AlignSection(header_end);
+    header.ids_offset = AlignSection(header.codes_offset + header.ntotal * header.code_size);
+    header.list_offsets_offset = AlignSection(header.ids_offset + header.ntotal * sizeof(faiss::idx_t));
+    if (direct_map != nullptr) {
+        header.direct_map_offset = AlignSection(header.list_offsets_offset + (header.nlist + 1) * sizeof(uint64_t));
+    }
+    writer(&kMappedLayoutMagic, sizeof(kMappedLayoutMagic), 1);
+    writer(&header, sizeof(header), 1);
+    writer(&nradii, sizeof(nradii), 1);
+    writer(radii.data(), sizeof(float), nradii);
+
+    auto pad_to = [&writer](uint64_t offset) {
+        static const uint8_t zeros[kMappedSectionAlign] = {};
+        if (writer.rp < offset) {
+            writer(zeros, 1, offset - writer.rp);
+        }
+    };
+    pad_to(header.codes_offset);
+    writer(index->get_arranged_codes(), 1, header.ntotal * header.code_size);
+    pad_to(header.ids_offset);
+    std::vector<uint64_t> list_offsets(header.nlist + 1, 0);
+    for (size_t i = 0; i < header.nlist; i++) {
+        faiss::InvertedLists::ScopedIds ids(invlists, i);
+        auto list_size = invlists->list_size(i);
+        writer(ids.get(), sizeof(faiss::idx_t), list_size);
+        list_offsets[i + 1] = list_offsets[i] + list_size;
+    }
+    pad_to(header.list_offsets_offset);
+    writer(list_offsets.data(), sizeof(uint64_t), list_offsets.size());
+    if (direct_map != nullptr) {
+        pad_to(header.direct_map_offset);
+        writer(direct_map, sizeof(faiss::idx_t), header.ntotal);
+    }
+}
+
+// Maps a whole file read-only, its pages live in the page cache and are shared by every process mapping the file.
+BinaryPtr
+MapFile(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw KnowhereException("failed to open " + filename + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw KnowhereException("failed to stat " + filename + " or it is empty");
+    }
+    size_t size = st.st_size;
+    auto addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw KnowhereException("failed to mmap " + filename + ": " + strerror(errno));
+    }
+    auto binary = std::make_shared<Binary>();
+    binary->data = std::shared_ptr<uint8_t[]>(static_cast<uint8_t*>(addr), [size](uint8_t* p) { munmap(p, size); });
+    binary->size = size;
+    return binary;
+}
+
+// Gather raw vectors into list-major order (arranged_codes) so that every inverted list is scanned sequentially.
+// prefix_sum is a cheap scan over list sizes, the gather itself is parallelized across lists. raw_data holds the
+// vectors from first_id on, the ones before it are already arranged and lead their lists since ids only grow.
+void
+ArrangeCodes(faiss::IndexIVFFlat* index, const uint8_t* raw_data, faiss::idx_t first_id = 0) {
+    auto ails = dynamic_cast<faiss::ArrayInvertedLists*>(index->invlists);
+    auto nlist = ails->nlist;
+    auto code_size = ails->code_size;
+    std::vector<size_t> prefix_sum(nlist);
+    size_t nb = 0;
+    for (size_t i = 0; i < nlist; i++) {
+        prefix_sum[i] = nb;
+        nb += ails->ids[i].size();
+    }
+    std::vector<uint8_t> arranged_codes(nb * code_size);
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < (int64_t)nlist; i++) {
+        auto dst = arranged_codes.data() + prefix_sum[i] * code_size;
+        for (auto id : ails->ids[i]) {
+            if (id < first_id) {
+                continue;
+            }
+            memcpy(dst, raw_data + (id - first_id) * code_size, code_size);
+            dst += code_size;
+        }
+    }
+    if (first_id > 0) {
+#pragma omp parallel for schedule(dynamic)
+        for (int64_t i = 0; i < (int64_t)nlist; i++) {
+            auto& ids = ails->ids[i];
+            auto old_size = std::lower_bound(ids.begin(), ids.end(), first_id) - ids.begin();
+            // the new vectors of the list were gathered to its start, move them behind the old ones
+            auto dst = arranged_codes.data() + prefix_sum[i] * code_size;
+            std::memmove(dst + old_size * code_size, dst, (ids.size() - old_size) * code_size);
+            std::memcpy(dst, index->get_arranged_codes() + index->prefix_sum[i] * code_size, old_size * code_size);
+        }
+    }
+    index->arranged_codes.swap(arranged_codes);
+    index->prefix_sum.swap(prefix_sum);
+}
+
+// Coarse quantizers of the indexes loaded with share_quantizer. Segments created from one template load identical
+// quantizers, they keep a single copy of the centroids (and HNSW graph) that lives as long as one of them does.
+class SharedQuantizers {
+ public:
+    static SharedQuantizers&
+    Instance() {
+        static SharedQuantizers instance;
+        return instance;
+    }
+
+    // the registered quantizer equal to qzr, which is dropped then, or qzr itself registered
+    std::shared_ptr<faiss::Index>
+    Share(std::unique_ptr<faiss::Index> qzr) {
+        auto key = Fingerprint(qzr.get());
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = quantizers_.begin(); it != quantizers_.end();) {
+            auto shared = it->second.lock();
+            if (shared == nullptr) {
+                it = quantizers_.erase(it);
+                continue;
+            }
+            if (it->first == key && Equal(shared.get(), qzr.get())) {
+                return shared;
+            }
+            ++it;
+        }
+        std::shared_ptr<faiss::Index> shared(qzr.release());
+        quantizers_.emplace(key, shared);
+        return shared;
+    }
+
+ private:
+    // the centroids of a flat or HNSW quantizer, null for other types
+    static const faiss::IndexFlat*
+    Storage(const faiss::Index* qzr) {
+        if (auto hnsw_qzr = dynamic_cast<const faiss::IndexHNSW*>(qzr)) {
+            return dynamic_cast<const faiss::IndexFlat*>(hnsw_qzr->storage);
+        }
+        return dynamic_cast<const faiss::IndexFlat*>(qzr);
+    }
+
+    // hash of the shape and centroids, a single pass over nlist * d floats
+    static size_t
+    Fingerprint(const faiss::Index* qzr) {
+        size_t hash = std::hash<std::string_view>()(typeid(*qzr).name());
+        auto combine = [&hash](size_t h) { hash ^= h + 0x9e3779b9 + (hash << 6) + (hash >> 2); };
+        combine(qzr->d);
+        combine(qzr->ntotal);
+        combine(qzr->metric_type);
+        if (auto storage = Storage(qzr)) {
+            combine(std::hash<std::string_view>()(
+                std::string_view((const char*)storage->get_xb(), storage->ntotal * storage->d * sizeof(float))));
+        }
+        return hash;
+    }
+
+    // same type, centroids and graph, compared in place; other types by their serialization
+    static bool
+    Equal(const faiss::Index* a, const faiss::Index* b) {
+        if (typeid(*a) != typeid(*b) || a->d != b->d || a->ntotal != b->ntotal || a->metric_type != b->metric_type) {
+            return false;
+        }
+        auto storage_a = Storage(a);
+        auto storage_b = Storage(b);
+        if (storage_a == nullptr || storage_b == nullptr) {
+            return Bytes(a) == Bytes(b);
+        }
+        if (storage_a->codes != storage_b->codes) {
+            return false;
+        }
+        auto hnsw_a = dynamic_cast<const faiss::IndexHNSW*>(a);
+        auto hnsw_b = dynamic_cast<const faiss::IndexHNSW*>(b);
+        if (hnsw_a == nullptr) {
+            return true;
+        }
+        const auto& graph_a = hnsw_a->hnsw;
+        const auto& graph_b = hnsw_b->hnsw;
+        return graph_a.entry_point == graph_b.entry_point && graph_a.max_level == graph_b.max_level &&
+               graph_a.levels == graph_b.levels && graph_a.offsets == graph_b.offsets &&
+               graph_a.neighbors == graph_b.neighbors;
+    }
+
+    static std::vector<uint8_t>
+    Bytes(const faiss::Index* qzr) {
+        faiss::VectorIOWriter writer;
+        faiss::write_index(qzr, &writer);
+        return std::move(writer.data);
+    }
+
+    std::mutex mutex_;
+    std::unordered_multimap<size_t, std::weak_ptr<faiss::Index>> quantizers_;
+};
+
+// M of the HNSW coarse quantizer, centroids are few enough that a fixed graph degree is fine
+constexpr int kHnswQuantizerM = 32;
+
+faiss::Index*
+CreateCoarseQuantizer(int64_t dim, faiss::MetricType metric, bool use_hnsw, int64_t ef) {
+    if (!use_hnsw) {
+        return new (std::nothrow) faiss::IndexFlat(dim, metric);
+    }
+    auto qzr = new (std::nothrow) faiss::IndexHNSWFlat(dim, kHnswQuantizerM, metric);
+    if (qzr != nullptr) {
+        qzr->hnsw.efSearch = ef;
+    }
+    return qzr;
+}
+
+// faiss::Clustering gets no better with more than this many vectors per centroid and warns below the minimum
+constexpr int64_t kMaxPointsPerCentroid = 256;
+constexpr int64_t kMinPointsPerCentroid = 39;
+
+// k-means always assigns points with an exact flat index, only the trained centroids are added to a graph quantizer
+void
+RunFaissClustering(faiss::IndexIVF* index, int64_t rows, const float* data) {
+    if (dynamic_cast<faiss::IndexFlat*>(index->quantizer) != nullptr) {
+        index->train(rows, data);
+        return;
+    }
+    faiss::IndexFlat assigner(index->d, index->metric_type);
+    index->clustering_index = &assigner;
+    try {
+        index->train(rows, data);
+    } catch (...) {
+        index->clustering_index = nullptr;
+        throw;
+    }
+    index->clustering_index = nullptr;
+}
+
+// Trains on a random kmeans_trainset_fraction of the data. Full-batch k-means with random seeding stays on
+// faiss::Clustering; mini-batch k-means, k-means|| seeding and list balancing run in KMeans, and the finished
+// centroids are handed to the quantizer so that faiss only trains the residual codebooks.
+void
+TrainIvf(faiss::IndexIVF* index, int64_t rows, const float* data, const IvfConfig& cfg) {
+    auto dim = (int64_t)index->d;
+    auto nlist = (int64_t)index->nlist;
+    auto seed = (int64_t)index->cp.seed;
+    auto fraction = cfg.kmeans_trainset_fraction.value();
+    auto sample_rows = std::clamp(static_cast<int64_t>(rows * fraction), std::min(rows, nlist * kMinPointsPerCentroid),
+                                  rows);
+    std::vector<float> sample;
+    if (sample_rows < rows) {
+        sample.resize(sample_rows * dim);
+        SampleRows(data, rows, dim, sample_rows, seed, sample.data());
+        data = sample.data();
+        rows = sample_rows;
+    }
+
+    auto init = cfg.kmeans_init.value();
+    std::transform(init.begin(), init.end(), init.begin(), toupper);
+    KMeansParams params;
+    params.niter = cfg.kmeans_n_iters.value();
+    params.batch_size = cfg.kmeans_batch_size.value();
+    params.parallel_init = init == "KMEANS_PARALLEL";
+    params.max_list_ratio = cfg.kmeans_max_list_ratio.value();
+    params.seed = seed;
+    if (params.batch_size == 0 && !params.parallel_init && params.max_list_ratio == 0) {
+        index->cp.niter = params.niter;
+        RunFaissClustering(index, rows, data);
+        return;
+    }
+
+    // mini-batch draws its own batches, full-batch gets the same cap as faiss::Clustering
+    auto kmeans_rows = params.batch_size > 0 ? rows : std::min(rows, nlist * kMaxPointsPerCentroid);
+    std::vector<float> kmeans_sample;
+    const float* kmeans_data = data;
+    if (kmeans_rows < rows) {
+        kmeans_sample.resize(kmeans_rows * dim);
+        SampleRows(data, rows, dim, kmeans_rows, seed + 1, kmeans_sample.data());
+        kmeans_data = kmeans_sample.data();
+    }
+    std::vector<float> centroids(nlist * dim);
+    KMeans(kmeans_data, kmeans_rows, dim, nlist, index->metric_type, params, centroids.data());
+    index->quantizer->reset();
+    index->quantizer->add(nlist, centroids.data());
+    index->quantizer->is_trained = true;
+    index->train(rows, data);
+}
+
+faiss::Index*
+CreateRefineIndex(int64_t dim, faiss::MetricType metric, std::string refine_type) {
+    std::transform(refine_type.begin(), refine_type.end(), refine_type.begin(), toupper);
+    if (refine_type == "FP32") {
+        return new (std::nothrow) faiss::IndexFlat(dim, metric);
+    }
+    if (refine_type == "FP16") {
+        return new (std::nothrow) faiss::IndexScalarQuantizer(dim, faiss::QuantizerType::QT_fp16, metric);
+    }
+    return nullptr;
+}
+
 template <typename T>
 Status
 IvfIndexNode<T>::Train(const DataSet& dataset, const Config& cfg) {
@@ -246,40 +755,95 @@ IvfIndexNode<T>::Train(const DataSet& dataset, const Config& cfg) {
     auto dim = dataset.GetDim();
     auto data = dataset.GetTensor();
 
+    if (static_cast<const IvfConfig&>(cfg).reuse_quantizer.value()) {
+        return ReuseQuantizer(dim, metric.value());
+    }
+
+    std::unique_ptr<faiss::Index> refine_index;
+    if constexpr (std::is_same<faiss::IndexIVFPQ, T>::value || std::is_same<faiss::IndexIVFScalarQuantizer, T>::value) {
+        const auto& refine_cfg = static_cast<const typename std::conditional<std::is_same<faiss::IndexIVFPQ, T>::value,
+                                                                           IvfPqConfig, IvfSqConfig>::type&>(cfg);
+        if (refine_cfg.refine.value()) {
+            refine_index.reset(CreateRefineIndex(dim, metric.value(), refine_cfg.refine_type.value()));
+            if (refine_index == nullptr) {
+                LOG_KNOWHERE_ERROR_ << "Invalid refine type: " << refine_cfg.refine_type.value();
+                return Status::invalid_args;
+            }
+        }
+    }
+
+    const IvfConfig& ivf_cfg = static_cast<const IvfConfig&>(cfg);
+    auto quantizer_type = ivf_cfg.quantizer_type.value();
+    std::transform(quantizer_type.begin(), quantizer_type.end(), quantizer_type.begin(), toupper);
+    if (quantizer_type != "FLAT" && quantizer_type != "HNSW") {
+        LOG_KNOWHERE_ERROR_ << "Invalid quantizer type: " << ivf_cfg.quantizer_type.value();
+        return Status::invalid_args;
+    }
+    bool use_hnsw = quantizer_type == "HNSW";
+    if constexpr (std::is_same<faiss::IndexBinaryIVF, T>::value) {
+        if (use_hnsw) {
+            LOG_KNOWHERE_ERROR_ << "HNSW quantizer is not supported for binary IVF";
+            return Status::invalid_args;
+        }
+    }
+    auto quantizer_ef = ivf_cfg.quantizer_ef.value();
+    auto kmeans_init = ivf_cfg.kmeans_init.value();
+    std::transform(kmeans_init.begin(), kmeans_init.end(), kmeans_init.begin(), toupper);
+    if (kmeans_init != "RANDOM" && kmeans_init != "KMEANS_PARALLEL") {
+        LOG_KNOWHERE_ERROR_ << "Invalid kmeans init: " << ivf_cfg.kmeans_init.value();
+        return Status::invalid_args;
+    }
+    auto max_list_ratio = ivf_cfg.kmeans_max_list_ratio.value();
+    if (max_list_ratio > 0 && max_list_ratio < 1) {
+        LOG_KNOWHERE_ERROR_ << "kmeans_max_list_ratio must be 0 or at least 1, got " << max_list_ratio;
+        return Status::invalid_args;
+    }
+
     typename QuantizerT<T>::type* qzr = nullptr;
     std::unique_ptr<T> index;
     try {
         if constexpr (std::is_same<faiss::IndexIVFFlat, T>::value) {
             const IvfFlatConfig& ivf_flat_cfg = static_cast<const IvfFlatConfig&>(cfg);
             auto nlist = MatchNlist(rows, ivf_flat_cfg.nlist.value());
-            qzr = new (std::nothrow) typename QuantizerT<T>::type(dim, metric.value());
+            qzr = CreateCoarseQuantizer(dim, metric.value(), use_hnsw, quantizer_ef);
             index = std::make_unique<faiss::IndexIVFFlat>(qzr, dim, nlist, metric.value());
-            index->train(rows, (const float*)data);
+            TrainIvf(index.get(), rows, (const float*)data, ivf_cfg);
         }
         if constexpr (std::is_same<faiss::IndexIVFFlatCC, T>::value) {
             const IvfFlatCcConfig& ivf_flat_cc_cfg = static_cast<const IvfFlatCcConfig&>(cfg);
             auto nlist = MatchNlist(rows, ivf_flat_cc_cfg.nlist.value());
-            qzr = new (std::nothrow) typename QuantizerT<T>::type(dim, metric.value());
+            qzr = CreateCoarseQuantizer(dim, metric.value(), use_hnsw, quantizer_ef);
             bool is_cosine = base_cfg.metric_type.value() == metric::COSINE;
             index = std::make_unique<faiss::IndexIVFFlatCC>(qzr, dim, nlist, ivf_flat_cc_cfg.ssize.value(), is_cosine,
                                                             metric.value());
-            index->train(rows, (const float*)data);
+            TrainIvf(index.get(), rows, (const float*)data, ivf_cfg);
         }
         if constexpr (std::is_same<faiss::IndexIVFPQ, T>::value) {
             const IvfPqConfig& ivf_pq_cfg = static_cast<const IvfPqConfig&>(cfg);
             auto nlist = MatchNlist(rows, ivf_pq_cfg.nlist.value());
             auto nbits = MatchNbits(rows, ivf_pq_cfg.nbits.value());
-            qzr = new (std::nothrow) typename QuantizerT<T>::type(dim, metric.value());
+            qzr = CreateCoarseQuantizer(dim, metric.value(), use_hnsw, quantizer_ef);
             index = std::make_unique<faiss::IndexIVFPQ>(qzr, dim, nlist, ivf_pq_cfg.m.value(), nbits, metric.value());
-            index->train(rows, (const float*)data);
+            TrainIvf(index.get(), rows, (const float*)data, ivf_cfg);
         }
         if constexpr (std::is_same<faiss::IndexIVFScalarQuantizer, T>::value) {
             const IvfSqConfig& ivf_sq_cfg = static_cast<const IvfSqConfig&>(cfg);
+            auto qtype = Str2FaissQuantizerType(ivf_sq_cfg.sq_type.value());
+            if (!qtype.has_value()) {
+                LOG_KNOWHERE_ERROR_ << "Invalid sq type: " << ivf_sq_cfg.sq_type.value();
+                return Status::invalid_args;
+            }
+            // direct codes hold the components as bytes, which residuals and normalized vectors never are
+            bool direct = qtype.value() == faiss::QuantizerType::QT_8bit_direct;
+            if (direct && IsMetricType(ivf_cfg.metric_type.value(), knowhere::metric::COSINE)) {
+                LOG_KNOWHERE_ERROR_ << "sq type " << ivf_sq_cfg.sq_type.value() << " does not support COSINE";
+                return Status::invalid_args;
+            }
             auto nlist = MatchNlist(rows, ivf_sq_cfg.nlist.value());
-            qzr = new (std::nothrow) typename QuantizerT<T>::type(dim, metric.value());
-            index = std::make_unique<faiss::IndexIVFScalarQuantizer>(qzr, dim, nlist, faiss::QuantizerType::QT_8bit,
-                                                                     metric.value());
-            index->train(rows, (const float*)data);
+            qzr = CreateCoarseQuantizer(dim, metric.value(), use_hnsw, quantizer_ef);
+            index = std::make_unique<faiss::IndexIVFScalarQuantizer>(qzr, dim, nlist, qtype.value(), metric.value(),
+                                                                     !direct);
+            TrainIvf(index.get(), rows, (const float*)data, ivf_cfg);
         }
         if constexpr (std::is_same<faiss::IndexBinaryIVF, T>::value) {
             const IvfBinConfig& ivf_bin_cfg = static_cast<const IvfBinConfig&>(cfg);
@@ -289,6 +853,9 @@ IvfIndexNode<T>::Train(const DataSet& dataset, const Config& cfg) {
             index->train(rows, (const uint8_t*)data);
         }
         index->own_fields = true;
+        if (refine_index) {
+            refine_index->train(rows, (const float*)data);
+        }
     } catch (std::exception& e) {
         if (qzr) {
             delete qzr;
@@ -297,13 +864,18 @@ IvfIndexNode<T>::Train(const DataSet& dataset, const Config& cfg) {
         return Status::faiss_inner_error;
     }
     index_ = std::move(index);
+    refine_index_ = std::move(refine_index);
+    shared_quantizer_.reset();
+    direct_map_.clear();
+    mapped_direct_map_ = nullptr;
+    ResetListRadii();
 
     return Status::success;
 }
 
 template <typename T>
 Status
-IvfIndexNode<T>::Add(const DataSet& dataset, const Config& cfg) {
+IvfIndexNode<T>::AddData(const DataSet& dataset, const Config& cfg, bool normalize) {
     if (!this->index_) {
         LOG_KNOWHERE_ERROR_ << "Can not add data to empty IVF index.";
         return Status::empty_index;
@@ -315,33 +887,29 @@ IvfIndexNode<T>::Add(const DataSet& dataset, const Config& cfg) {
     if (base_cfg.num_build_thread.has_value()) {
         setter = std::make_unique<ThreadPool::ScopedOmpSetter>(base_cfg.num_build_thread.value());
     }
+    // an index loaded from a template only gets normalized vectors here
+    if (normalize && IsMetricType(base_cfg.metric_type.value(), knowhere::metric::COSINE)) {
+        if constexpr (!(std::is_same_v<faiss::IndexIVFFlatCC, T>)) {
+            Normalize(dataset);
+        }
+    }
     try {
+        auto first_id = index_->ntotal;
         if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
             index_->add_without_codes(rows, (const float*)data);
-            auto raw_data = dataset.GetTensor();
-            auto invlists = index_->invlists;
-            auto d = index_->d;
-            size_t nb = dataset.GetRows();
-            index_->prefix_sum.resize(invlists->nlist);
-            size_t curr_index = 0;
-
-            auto ails = dynamic_cast<faiss::ArrayInvertedLists*>(invlists);
-            index_->arranged_codes.resize(d * nb * sizeof(float));
-            for (size_t i = 0; i < invlists->nlist; i++) {
-                auto list_size = ails->ids[i].size();
-                for (size_t j = 0; j < list_size; j++) {
-                    memcpy(index_->arranged_codes.data() + d * (curr_index + j) * sizeof(float),
-                           (uint8_t*)raw_data + d * ails->ids[i][j] * sizeof(float), d * sizeof(float));
-                }
-                index_->prefix_sum[i] = curr_index;
-                curr_index += list_size;
-            }
+            ArrangeCodes(index_.get(), (const uint8_t*)data, first_id);
         } else if constexpr (std::is_same<faiss::IndexBinaryIVF, T>::value) {
             index_->add(rows, (const uint8_t*)data);
         } else {
             index_->add(rows, (const float*)data);
+            if (refine_index_) {
+                refine_index_->add(rows, (const float*)data);
+            }
+        }
+        if constexpr (!std::is_same<T, faiss::IndexIVFFlatCC>::value) {
+            BuildDirectMap();
+            ResetListRadii();
         }
-
     } catch (std::exception& e) {
         LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
         return Status::faiss_inner_error;
@@ -349,6 +917,281 @@ IvfIndexNode<T>::Add(const DataSet& dataset, const Config& cfg) {
     return Status::success;
 }
 
+template <typename T>
+Status
+IvfIndexNode<T>::ReuseQuantizer(int64_t dim, faiss::MetricType metric) {
+    if constexpr (std::is_same<T, faiss::IndexIVFFlatCC>::value || std::is_same<T, faiss::IndexBinaryIVF>::value) {
+        LOG_KNOWHERE_ERROR_ << Type() << " doesn't support reuse_quantizer.";
+        return Status::invalid_args;
+    } else {
+        if (!index_ || !index_->is_trained) {
+            LOG_KNOWHERE_ERROR_ << "reuse_quantizer needs a trained or loaded index.";
+            return Status::index_not_trained;
+        }
+        if (index_->d != dim || index_->metric_type != metric) {
+            LOG_KNOWHERE_ERROR_ << "reuse_quantizer needs the dim and metric of the trained index.";
+            return Status::invalid_args;
+        }
+        try {
+            // mapped lists are read-only and loaded IVF_FLAT lists have no code vectors, new data goes to fresh lists
+            if (index_->invlists->is_readonly() || std::is_same<T, faiss::IndexIVFFlat>::value) {
+                index_->replace_invlists(new faiss::ArrayInvertedLists(index_->nlist, index_->code_size), true);
+            }
+            index_->reset();
+            if (refine_index_) {
+                refine_index_->reset();
+            }
+        } catch (std::exception& e) {
+            LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
+            return Status::faiss_inner_error;
+        }
+        direct_map_.clear();
+        mapped_direct_map_ = nullptr;
+        ResetListRadii();
+        return Status::success;
+    }
+}
+
+template <typename T>
+bool
+IvfIndexNode<T>::SameQuantizers(const IvfIndexNode& other) const {
+    auto a = index_.get();
+    auto b = other.index_.get();
+    if (a->d != b->d || a->nlist != b->nlist || a->metric_type != b->metric_type || a->code_size != b->code_size) {
+        return false;
+    }
+    auto centroids = Centroids();
+    auto other_centroids = other.Centroids();
+    if (centroids == nullptr || other_centroids == nullptr ||
+        std::memcmp(centroids, other_centroids, a->nlist * a->d * sizeof(float)) != 0) {
+        return false;
+    }
+    if constexpr (std::is_same<T, faiss::IndexIVFScalarQuantizer>::value) {
+        if (a->sq.qtype != b->sq.qtype || a->sq.trained != b->sq.trained || a->by_residual != b->by_residual) {
+            return false;
+        }
+    }
+    if constexpr (std::is_same<T, faiss::IndexIVFPQ>::value) {
+        if (a->pq.M != b->pq.M || a->pq.nbits != b->pq.nbits || a->pq.centroids != b->pq.centroids ||
+            a->by_residual != b->by_residual) {
+            return false;
+        }
+    }
+    if ((refine_index_ == nullptr) != (other.refine_index_ == nullptr)) {
+        return false;
+    }
+    return refine_index_ == nullptr || (typeid(*refine_index_) == typeid(*other.refine_index_) &&
+                                        refine_index_->sa_code_size() == other.refine_index_->sa_code_size());
+}
+
+template <typename T>
+void
+IvfIndexNode<T>::AdoptQuantizers(const IvfIndexNode& other) {
+    static_assert(std::is_same<T, faiss::IndexIVFFlat>::value || std::is_same<T, faiss::IndexIVFPQ>::value ||
+                      std::is_same<T, faiss::IndexIVFScalarQuantizer>::value,
+                  "AdoptQuantizers supports IVF_FLAT, IVF_PQ and IVF_SQ");
+    auto src = other.index_.get();
+    // a round trip keeps the exact type of the coarse quantizer, which clone_index doesn't for HNSW
+    faiss::VectorIOWriter writer;
+    faiss::write_index(src->quantizer, &writer);
+    faiss::VectorIOReader reader;
+    reader.data = std::move(writer.data);
+    std::unique_ptr<faiss::Index> qzr(faiss::read_index(&reader));
+
+    std::unique_ptr<T> index;
+    if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
+        // nothing else is trained, and a copy would duplicate the vectors of other
+        index = std::make_unique<T>(qzr.get(), src->d, src->nlist, src->metric_type);
+        index->is_trained = true;
+    } else {
+        // the copy shares the quantizer and lists of other until both are replaced
+        index = std::make_unique<T>(*src);
+        index->quantizer = qzr.get();
+        index->invlists = new faiss::ArrayInvertedLists(src->nlist, src->code_size);
+        index->own_invlists = true;
+        index->reset();
+    }
+    index->own_fields = true;
+    qzr.release();
+
+    std::unique_ptr<faiss::Index> refine_index;
+    if (auto flat = dynamic_cast<const faiss::IndexFlat*>(other.refine_index_.get())) {
+        refine_index = std::make_unique<faiss::IndexFlat>(flat->d, flat->metric_type);
+    } else if (auto sq = dynamic_cast<const faiss::IndexScalarQuantizer*>(other.refine_index_.get())) {
+        auto sq_index = std::make_unique<faiss::IndexScalarQuantizer>(sq->d, sq->sq.qtype, sq->metric_type);
+        sq_index->sq = sq->sq;
+        sq_index->is_trained = sq->is_trained;
+        refine_index = std::move(sq_index);
+    }
+
+    index_ = std::move(index);
+    refine_index_ = std::move(refine_index);
+    shared_quantizer_.reset();
+    direct_map_.clear();
+    mapped_direct_map_ = nullptr;
+    ResetListRadii();
+}
+
+template <typename T>
+Status
+IvfIndexNode<T>::Merge(const std::vector<const IndexNode*>& sources, const Config& cfg,
+                       const std::vector<BitsetView>& deleted) {
+    if constexpr (std::is_same<T, faiss::IndexIVFFlatCC>::value || std::is_same<T, faiss::IndexBinaryIVF>::value) {
+        LOG_KNOWHERE_ERROR_ << Type() << " doesn't support Merge.";
+        return Status::not_implemented;
+    } else {
+        std::vector<const IvfIndexNode*> nodes;
+        for (auto source : sources) {
+            auto node = dynamic_cast<const IvfIndexNode*>(source);
+            if (node == nullptr || !node->index_ || !node->index_->is_trained) {
+                LOG_KNOWHERE_ERROR_ << "Merge sources must be trained " << Type() << " indexes.";
+                return Status::invalid_args;
+            }
+            nodes.push_back(node);
+        }
+        if (nodes.empty()) {
+            return Status::success;
+        }
+        const BaseConfig& base_cfg = static_cast<const IvfConfig&>(cfg);
+        std::unique_ptr<ThreadPool::ScopedOmpSetter> setter;
+        if (base_cfg.num_build_thread.has_value()) {
+            setter = std::make_unique<ThreadPool::ScopedOmpSetter>(base_cfg.num_build_thread.value());
+        }
+        // IVF_FLAT keeps its vectors list-major in arranged_codes, the lists only hold the ids
+        constexpr bool arranged = std::is_same<T, faiss::IndexIVFFlat>::value;
+        auto has_codes = [](const T* index) {
+            if constexpr (arranged) {
+                return index->arranged_codes_view != nullptr ||
+                       index->arranged_codes.size() >= index->ntotal * index->code_size;
+            }
+            return true;
+        };
+
+        try {
+            if (!index_) {
+                AdoptQuantizers(*nodes[0]);
+            }
+            auto ails = dynamic_cast<faiss::ArrayInvertedLists*>(index_->invlists);
+            if (ails == nullptr || !has_codes(index_.get())) {
+                LOG_KNOWHERE_ERROR_ << "Can not merge into a mapped index or one loaded without its vectors.";
+                return Status::invalid_args;
+            }
+            for (auto node : nodes) {
+                if (!SameQuantizers(*node) || !has_codes(node->index_.get())) {
+                    LOG_KNOWHERE_ERROR_ << "Merge sources must share the quantizers of the merged index.";
+                    return Status::invalid_args;
+                }
+            }
+
+            // old id -> merged id, or -1 for deleted rows
+            auto next_id = index_->ntotal;
+            std::vector<std::vector<faiss::idx_t>> id_maps(nodes.size());
+            for (size_t s = 0; s < nodes.size(); s++) {
+                auto ntotal = nodes[s]->index_->ntotal;
+                const BitsetView* bitset = deleted.empty() ? nullptr : &deleted[s];
+                id_maps[s].resize(ntotal);
+                for (faiss::idx_t id = 0; id < ntotal; id++) {
+                    bool is_deleted = bitset != nullptr && id < (faiss::idx_t)bitset->size() && bitset->test(id);
+                    id_maps[s][id] = is_deleted ? -1 : next_id++;
+                }
+            }
+
+            auto nlist = static_cast<int64_t>(index_->nlist);
+            auto code_size = index_->code_size;
+            std::vector<size_t> list_sizes(nlist);
+#pragma omp parallel for schedule(dynamic)
+            for (int64_t list_no = 0; list_no < nlist; list_no++) {
+                auto size = ails->ids[list_no].size();
+                for (size_t s = 0; s < nodes.size(); s++) {
+                    auto invlists = nodes[s]->index_->invlists;
+                    auto ids = invlists->get_ids(list_no);
+                    for (size_t j = 0; j < invlists->list_size(list_no); j++) {
+                        size += id_maps[s][ids[j]] >= 0;
+                    }
+                }
+                list_sizes[list_no] = size;
+            }
+            std::vector<uint8_t> arranged_codes;
+            std::vector<size_t> prefix_sum;
+            if constexpr (arranged) {
+                prefix_sum.resize(nlist);
+                size_t nb = 0;
+                for (int64_t list_no = 0; list_no < nlist; list_no++) {
+                    prefix_sum[list_no] = nb;
+                    nb += list_sizes[list_no];
+                }
+                arranged_codes.resize(nb * code_size);
+            }
+
+#pragma omp parallel for schedule(dynamic)
+            for (int64_t list_no = 0; list_no < nlist; list_no++) {
+                auto& ids = ails->ids[list_no];
+                auto old_size = ids.size();
+                ids.reserve(list_sizes[list_no]);
+                uint8_t* dst;
+                if constexpr (arranged) {
+                    dst = arranged_codes.data() + prefix_sum[list_no] * code_size;
+                    if (old_size > 0) {
+                        std::memcpy(dst, index_->get_arranged_codes() + index_->prefix_sum[list_no] * code_size,
+                                    old_size * code_size);
+                    }
+                } else {
+                    ails->codes[list_no].resize(list_sizes[list_no] * code_size);
+                    dst = ails->codes[list_no].data();
+                }
+                dst += old_size * code_size;
+                for (size_t s = 0; s < nodes.size(); s++) {
+                    auto src = nodes[s]->index_.get();
+                    auto src_ids = src->invlists->get_ids(list_no);
+                    const uint8_t* src_codes;
+                    if constexpr (arranged) {
+                        src_codes = src->get_arranged_codes() + src->prefix_sum[list_no] * code_size;
+                    } else {
+                        src_codes = src->invlists->get_codes(list_no);
+                    }
+                    for (size_t j = 0; j < src->invlists->list_size(list_no); j++) {
+                        auto id = id_maps[s][src_ids[j]];
+                        if (id < 0) {
+                            continue;
+                        }
+                        ids.push_back(id);
+                        std::memcpy(dst, src_codes + j * code_size, code_size);
+                        dst += code_size;
+                    }
+                }
+            }
+            if constexpr (arranged) {
+                index_->arranged_codes.swap(arranged_codes);
+                index_->prefix_sum.swap(prefix_sum);
+            }
+
+            // refine vectors are stored in id order
+            if (refine_index_) {
+                auto refine = dynamic_cast<faiss::IndexFlatCodes*>(refine_index_.get());
+                auto refine_code_size = refine->code_size;
+                refine->codes.reserve(next_id * refine_code_size);
+                for (size_t s = 0; s < nodes.size(); s++) {
+                    auto src = dynamic_cast<const faiss::IndexFlatCodes*>(nodes[s]->refine_index_.get());
+                    for (size_t id = 0; id < id_maps[s].size(); id++) {
+                        if (id_maps[s][id] >= 0) {
+                            auto code = src->codes.data() + id * refine_code_size;
+                            refine->codes.insert(refine->codes.end(), code, code + refine_code_size);
+                        }
+                    }
+                }
+                refine->ntotal = next_id;
+            }
+            index_->ntotal = next_id;
+            BuildDirectMap();
+            ResetListRadii();
+        } catch (std::exception& e) {
+            LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
+            return Status::faiss_inner_error;
+        }
+        return Status::success;
+    }
+}
+
 template <typename T>
 expected<DataSetPtr>
 IvfIndexNode<T>::Search(const DataSet& dataset, const Config& cfg, const BitsetView& bitset) const {
@@ -375,14 +1218,41 @@ IvfIndexNode<T>::Search(const DataSet& dataset, const Config& cfg, const BitsetV
     auto k = ivf_cfg.k.value();
     auto nprobe = ivf_cfg.nprobe.value();
 
+    int64_t k_base = k;
+    if constexpr (std::is_same<T, faiss::IndexIVFPQ>::value) {
+        k_base = k * static_cast<const IvfPqConfig&>(cfg).refine_factor.value();
+    }
+    if constexpr (std::is_same<T, faiss::IndexIVFScalarQuantizer>::value) {
+        k_base = k * static_cast<const IvfSqConfig&>(cfg).refine_factor.value();
+    }
+
     int parallel_mode = 0;
     if (nprobe > 1 && rows <= 4) {
         parallel_mode = 1;
     }
+    // adaptive probing needs an L2 or unit-sphere bound, plain inner product keeps scanning nprobe lists
+    auto adaptive_factor = ivf_cfg.adaptive_probe_factor.value();
+    bool adaptive = false;
+    if constexpr (!std::is_same<T, faiss::IndexBinaryIVF>::value) {
+        adaptive = adaptive_factor > 0 && (index_->metric_type == faiss::METRIC_L2 ||
+                                           IsMetricType(ivf_cfg.metric_type.value(), knowhere::metric::COSINE));
+    }
+    auto snapshot = Snapshot();
     int64_t* ids(new (std::nothrow) int64_t[rows * k]);
     float* distances(new (std::nothrow) float[rows * k]);
     int32_t* i_distances = reinterpret_cast<int32_t*>(distances);
+    // owned here until it is attached to the result, batch search scans nprobe lists and does not report it
+    std::unique_ptr<int64_t[]> lists_scanned;
     try {
+        if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
+            if (static_cast<const IvfFlatConfig&>(cfg).batch_search.value()) {
+                BatchSearch((const float*)data, rows, k, nprobe, bitset, distances, ids);
+                return GenResultDataSet(rows, k, ids, distances);
+            }
+        }
+        if (adaptive) {
+            lists_scanned.reset(new int64_t[rows]);
+        }
         size_t max_codes = 0;
         std::vector<std::future<void>> futs;
         futs.reserve(rows);
@@ -398,14 +1268,35 @@ IvfIndexNode<T>::Search(const DataSet& dataset, const Config& cfg, const BitsetV
                             distances[i + offset] = static_cast<float>(i_distances[i + offset]);
                         }
                     }
+                } else if (adaptive) {
+                    auto cur_data = (const float*)data + index * dim;
+                    if (refine_index_) {
+                        std::vector<int64_t> base_ids(k_base);
+                        std::vector<float> base_dis(k_base);
+                        lists_scanned[index] = AdaptiveSearch(cur_data, k_base, nprobe, adaptive_factor, bitset,
+                                                              snapshot.get(), base_dis.data(), base_ids.data());
+                        RefineSearch(cur_data, k, k_base, base_dis.data(), base_ids.data(), distances + offset,
+                                     ids + offset);
+                    } else {
+                        lists_scanned[index] = AdaptiveSearch(cur_data, k, nprobe, adaptive_factor, bitset,
+                                                              snapshot.get(), distances + offset, ids + offset);
+                    }
                 } else if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
                     auto cur_data = (const float*)data + index * dim;
                     index_->search_without_codes_thread_safe(1, cur_data, k, distances + offset, ids + offset, nprobe,
                                                              parallel_mode, max_codes, bitset);
+                } else if (refine_index_) {
+                    auto cur_data = (const float*)data + index * dim;
+                    std::vector<int64_t> base_ids(k_base);
+                    std::vector<float> base_dis(k_base);
+                    index_->search_thread_safe(1, cur_data, k_base, base_dis.data(), base_ids.data(), nprobe,
+                                               parallel_mode, max_codes, bitset);
+                    RefineSearch(cur_data, k, k_base, base_dis.data(), base_ids.data(), distances + offset,
+                                 ids + offset);
                 } else {
                     auto cur_data = (const float*)data + index * dim;
                     index_->search_thread_safe(1, cur_data, k, distances + offset, ids + offset, nprobe, parallel_mode,
-                                               max_codes, bitset);
+                                               max_codes, bitset, snapshot.get());
                 }
             }));
         }
@@ -420,6 +1311,9 @@ IvfIndexNode<T>::Search(const DataSet& dataset, const Config& cfg, const BitsetV
     }
 
     auto res = GenResultDataSet(rows, ivf_cfg.k.value(), ids, distances);
+    if (lists_scanned != nullptr) {
+        res->SetListsScanned(lists_scanned.release());
+    }
     return res;
 }
 
@@ -465,6 +1359,12 @@ IvfIndexNode<T>::RangeSearch(const DataSet& dataset, const Config& cfg, const Bi
     std::vector<std::vector<float>> result_dist_array(nq);
     std::vector<size_t> result_size(nq);
     std::vector<size_t> result_lims(nq + 1);
+    auto snapshot = Snapshot();
+    // covering radii bound L2 distances, and inner products only between unit vectors
+    bool prune = ivf_cfg.range_list_pruning.value() &&
+                 (index_->metric_type == faiss::METRIC_L2 ||
+                  IsMetricType(ivf_cfg.metric_type.value(), knowhere::metric::COSINE)) &&
+                 !ListRadii().empty();
 
     try {
         size_t max_codes = 0;
@@ -477,6 +1377,8 @@ IvfIndexNode<T>::RangeSearch(const DataSet& dataset, const Config& cfg, const Bi
                 if constexpr (std::is_same<T, faiss::IndexBinaryIVF>::value) {
                     auto cur_data = (const uint8_t*)xq + index * dim / 8;
                     index_->range_search_thread_safe(1, cur_data, radius, &res, nprobe, bitset);
+                } else if (prune) {
+                    PrunedRangeSearch((const float*)xq + index * dim, radius, bitset, &res);
                 } else if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
                     auto cur_data = (const float*)xq + index * dim;
                     index_->range_search_without_codes_thread_safe(1, cur_data, radius, &res, nprobe, parallel_mode,
@@ -484,7 +1386,7 @@ IvfIndexNode<T>::RangeSearch(const DataSet& dataset, const Config& cfg, const Bi
                 } else {
                     auto cur_data = (const float*)xq + index * dim;
                     index_->range_search_thread_safe(1, cur_data, radius, &res, nprobe, parallel_mode, max_codes,
-                                                     bitset);
+                                                     bitset, snapshot.get());
                 }
                 auto elem_cnt = res.lims[1];
                 result_dist_array[index].resize(elem_cnt);
@@ -494,6 +1396,25 @@ IvfIndexNode<T>::RangeSearch(const DataSet& dataset, const Config& cfg, const Bi
                     result_dist_array[index][j] = res.distances[j];
                     result_id_array[index][j] = res.labels[j];
                 }
+                if constexpr (!std::is_same<T, faiss::IndexBinaryIVF>::value) {
+                    if (refine_index_) {
+                        // report exact distances and drop candidates the quantizer wrongly kept in range
+                        std::unique_ptr<faiss::DistanceComputer> dc(refine_index_->get_distance_computer());
+                        dc->set_query((const float*)xq + index * dim);
+                        size_t cnt = 0;
+                        for (size_t j = 0; j < elem_cnt; j++) {
+                            float dist = (*dc)(result_id_array[index][j]);
+                            if (is_ip ? dist > radius : dist < radius) {
+                                result_dist_array[index][cnt] = dist;
+                                result_id_array[index][cnt] = result_id_array[index][j];
+                                cnt++;
+                            }
+                        }
+                        result_dist_array[index].resize(cnt);
+                        result_id_array[index].resize(cnt);
+                        result_size[index] = cnt;
+                    }
+                }
                 if (range_filter != defaultRangeFilter) {
                     FilterRangeSearchResultForOneNq(result_dist_array[index], result_id_array[index], is_ip, radius,
                                                     range_filter);
@@ -512,6 +1433,85 @@ IvfIndexNode<T>::RangeSearch(const DataSet& dataset, const Config& cfg, const Bi
     return GenResultDataSet(nq, ids, distances, lims);
 }
 
+template <typename T>
+void
+IvfIndexNode<T>::BuildDirectMap() {
+    auto invlists = index_->invlists;
+    auto nlist = static_cast<int64_t>(invlists->nlist);
+    auto ntotal = static_cast<int64_t>(index_->ntotal);
+    mapped_direct_map_ = nullptr;
+    direct_map_.assign(ntotal, -1);
+    std::atomic<bool> dense = true;
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t list_no = 0; list_no < nlist; list_no++) {
+        faiss::InvertedLists::ScopedIds list_ids(invlists, list_no);
+        auto list_size = invlists->list_size(list_no);
+        for (size_t offset = 0; offset < list_size; offset++) {
+            auto id = list_ids[offset];
+            if (id < 0 || id >= ntotal) {
+                dense = false;
+                continue;
+            }
+            direct_map_[id] = faiss::lo_build(list_no, offset);
+        }
+    }
+    if (!dense) {
+        direct_map_.clear();
+        throw KnowhereException("IVF ids are not in [0, ntotal)");
+    }
+}
+
+// Lookups below this many ids are gathered inline, larger batches are split across the search pool.
+constexpr int64_t kGatherChunk = 1024;
+
+// The radii of PQ / SQ lists are taken over decoded vectors, which are what their scanners compare against the range
+// radius. Computing them decodes every vector, so loads and adds leave it to the first search that prunes.
+template <typename T>
+const std::vector<float>&
+IvfIndexNode<T>::ListRadii() const {
+    std::lock_guard<std::mutex> lock(list_radius_mutex_);
+    if (list_radius_ready_) {
+        return list_radius_;
+    }
+    list_radius_ready_ = true;
+    if constexpr (std::is_same<T, faiss::IndexBinaryIVF>::value || std::is_same<T, faiss::IndexIVFFlatCC>::value) {
+        return list_radius_;
+    } else {
+        auto centroids = Centroids();
+        auto invlists = index_->invlists;
+        if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
+            // a file loaded through read_index has no list-major copy of the vectors
+            if (index_->arranged_codes_view == nullptr &&
+                index_->arranged_codes.size() < invlists->compute_ntotal() * invlists->code_size) {
+                centroids = nullptr;
+            }
+        }
+        if (centroids == nullptr) {
+            return list_radius_;
+        }
+        auto d = index_->d;
+        auto nlist = static_cast<int64_t>(invlists->nlist);
+        list_radius_.assign(nlist, 0.0f);
+#pragma omp parallel for schedule(dynamic)
+        for (int64_t list_no = 0; list_no < nlist; list_no++) {
+            auto list_size = invlists->list_size(list_no);
+            auto centroid = centroids + list_no * d;
+            std::vector<float> x(d);
+            float max_dis = 0.0f;
+            for (size_t offset = 0; offset < list_size; offset++) {
+                if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
+                    index_->reconstruct_from_offset_without_codes(list_no, offset, x.data());
+                } else {
+                    index_->reconstruct_from_offset(list_no, offset, x.data());
+                }
+                max_dis = std::max(max_dis, faiss::fvec_L2sqr(x.data(), centroid, d));
+            }
+            list_radius_[list_no] = std::sqrt(max_dis);
+        }
+        return list_radius_;
+    }
+}
+
 template <typename T>
 expected<DataSetPtr>
 IvfIndexNode<T>::GetVectorByIds(const DataSet& dataset) const {
@@ -521,68 +1521,349 @@ IvfIndexNode<T>::GetVectorByIds(const DataSet& dataset) const {
     if (!this->index_->is_trained) {
         return Status::index_not_trained;
     }
-    if constexpr (std::is_same<T, faiss::IndexBinaryIVF>::value) {
-        auto dim = Dim();
-        auto rows = dataset.GetRows();
-        auto ids = dataset.GetIds();
-
-        uint8_t* data = nullptr;
-        try {
-            data = new uint8_t[dim * rows / 8];
-            index_->make_direct_map(true);
-            for (int64_t i = 0; i < rows; i++) {
-                int64_t id = ids[i];
-                assert(id >= 0 && id < index_->ntotal);
-                index_->reconstruct(id, data + i * dim / 8);
-            }
-            return GenResultDataSet(rows, dim, data);
-        } catch (const std::exception& e) {
-            std::unique_ptr<uint8_t[]> auto_del(data);
-            LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
-            return Status::faiss_inner_error;
-        }
-    } else if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
-        auto dim = Dim();
-        auto rows = dataset.GetRows();
-        auto ids = dataset.GetIds();
-
+    auto dim = Dim();
+    auto rows = dataset.GetRows();
+    auto ids = dataset.GetIds();
+    if constexpr (std::is_same<T, faiss::IndexIVFFlatCC>::value) {
         float* data = nullptr;
         try {
             data = new float[dim * rows];
-            index_->make_direct_map(true);
-            for (int64_t i = 0; i < rows; i++) {
-                int64_t id = ids[i];
-                assert(id >= 0 && id < index_->ntotal);
-                index_->reconstruct_without_codes(id, data + i * dim);
-            }
+            index_->reconstruct_batch(rows, ids, data);
             return GenResultDataSet(rows, dim, data);
         } catch (const std::exception& e) {
             std::unique_ptr<float[]> auto_del(data);
             LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
             return Status::faiss_inner_error;
         }
-    } else if constexpr (std::is_same<T, faiss::IndexIVFFlatCC>::value) {
-        auto dim = Dim();
-        auto rows = dataset.GetRows();
-        auto ids = dataset.GetIds();
+    } else {
+        using ValueT = typename std::conditional<std::is_same<T, faiss::IndexBinaryIVF>::value, uint8_t, float>::type;
+        constexpr bool is_binary = std::is_same<T, faiss::IndexBinaryIVF>::value;
+        auto code_len = is_binary ? dim / 8 : dim;
+        auto direct_map = DirectMapData();
+        auto direct_map_count = DirectMapCount();
+        for (int64_t i = 0; i < rows; i++) {
+            if (ids[i] < 0 || ids[i] >= direct_map_count) {
+                LOG_KNOWHERE_ERROR_ << "id " << ids[i] << " out of range [0, " << direct_map_count << ")";
+                return Status::invalid_args;
+            }
+        }
 
-        float* data = nullptr;
+        // the exact refine vectors beat decoded PQ / SQ codes
+        auto gather = [&](int64_t begin, int64_t end, ValueT* data) {
+            for (int64_t i = begin; i < end; i++) {
+                auto out = data + i * code_len;
+                if constexpr (std::is_same<T, faiss::IndexIVFPQ>::value ||
+                              std::is_same<T, faiss::IndexIVFScalarQuantizer>::value) {
+                    if (refine_index_) {
+                        refine_index_->reconstruct(ids[i], out);
+                        continue;
+                    }
+                }
+                auto lo = direct_map[ids[i]];
+                if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
+                    index_->reconstruct_from_offset_without_codes(faiss::lo_listno(lo), faiss::lo_offset(lo), out);
+                } else {
+                    index_->reconstruct_from_offset(faiss::lo_listno(lo), faiss::lo_offset(lo), out);
+                }
+            }
+        };
+
+        ValueT* data = nullptr;
         try {
-            data = new float[dim * rows];
-            index_->make_direct_map(true);
-            for (int64_t i = 0; i < rows; i++) {
-                int64_t id = ids[i];
-                assert(id >= 0 && id < index_->ntotal);
-                index_->reconstruct(id, data + i * dim);
+            data = new ValueT[code_len * rows];
+            if (rows <= kGatherChunk) {
+                gather(0, rows, data);
+            } else {
+                std::vector<std::future<void>> futs;
+                futs.reserve((rows + kGatherChunk - 1) / kGatherChunk);
+                for (int64_t begin = 0; begin < rows; begin += kGatherChunk) {
+                    auto end = std::min(rows, begin + kGatherChunk);
+                    futs.push_back(pool_->push([&, begin, end] { gather(begin, end, data); }));
+                }
+                // data must outlive every task even when one of them throws
+                for (auto& fut : futs) {
+                    fut.wait();
+                }
+                for (auto& fut : futs) {
+                    fut.get();
+                }
             }
             return GenResultDataSet(rows, dim, data);
         } catch (const std::exception& e) {
-            std::unique_ptr<float[]> auto_del(data);
+            std::unique_ptr<ValueT[]> auto_del(data);
             LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
             return Status::faiss_inner_error;
         }
+    }
+}
+
+template <typename T>
+void
+IvfIndexNode<T>::RefineSearch(const float* query, int64_t k, int64_t k_base, float* base_dis, const int64_t* base_ids,
+                              float* distances, int64_t* ids) const {
+    std::unique_ptr<faiss::DistanceComputer> dc(refine_index_->get_distance_computer());
+    dc->set_query(query);
+    auto rerank = [&](auto heap_tag) {
+        using C = decltype(heap_tag);
+        faiss::heap_heapify<C>(k, distances, ids);
+        for (int64_t j = 0; j < k_base && base_ids[j] >= 0; j++) {
+            float dist = (*dc)(base_ids[j]);
+            if (C::cmp(distances[0], dist)) {
+                faiss::heap_replace_top<C>(k, distances, ids, dist, base_ids[j]);
+            }
+        }
+        faiss::heap_reorder<C>(k, distances, ids);
+    };
+    if (index_->metric_type == faiss::METRIC_INNER_PRODUCT) {
+        rerank(faiss::CMin<float, int64_t>());
     } else {
-        return Status::not_implemented;
+        rerank(faiss::CMax<float, int64_t>());
+    }
+}
+
+// Probes the nprobe nearest lists one at a time and skips a list once no vector in its cell can beat the current
+// k-th result. With the cells of c_0 (the nearest centroid) and c_j split by their bisector, a vector of list j is at
+// least (D_j - D_0) / (2 |c_j - c_0|) away from the query in L2. For inner product on unit vectors (COSINE) the same
+// half-space caps the similarity at sqrt(1 - a^2), a = (S_0 - S_j) / |c_j - c_0|, compared as a chord length. factor
+// scales the bound, larger values skip more. With factor 1 nothing is lost against a plain nprobe scan only when the
+// lists are the exact Voronoi cells of a flat quantizer and their distances are exact, i.e. IVF_FLAT and IVF_FLAT_CC;
+// the assignment of an HNSW quantizer and the decoded distances of SQ / PQ make the bound a heuristic there. Returns
+// the lists scanned.
+template <typename T>
+int64_t
+IvfIndexNode<T>::AdaptiveSearch(const float* query, int64_t k, int64_t nprobe, float factor, const BitsetView& bitset,
+                                const faiss::InvertedListsSnapshot* snapshot, float* distances, int64_t* ids) const {
+    auto d = index_->d;
+    nprobe = std::min(nprobe, static_cast<int64_t>(index_->nlist));
+    std::vector<int64_t> keys(nprobe);
+    std::vector<float> coarse_dis(nprobe);
+    index_->quantizer->search(1, query, nprobe, coarse_dis.data(), keys.data());
+
+    bool is_ip = index_->metric_type == faiss::METRIC_INNER_PRODUCT;
+    if (is_ip) {
+        faiss::heap_heapify<faiss::CMin<float, int64_t>>(k, distances, ids);
+    } else {
+        faiss::heap_heapify<faiss::CMax<float, int64_t>>(k, distances, ids);
+    }
+    // results stay a heap between the single-list scans
+    faiss::IVFSearchParameters params;
+    params.nprobe = 1;
+    params.parallel_mode = index_->PARALLEL_MODE_NO_HEAP_INIT;
+    params.snapshot = snapshot;
+
+    std::vector<float> nearest(d), centroid(d);
+    if (keys[0] >= 0) {
+        index_->quantizer->reconstruct(keys[0], nearest.data());
+    }
+    int64_t scanned = 0;
+    for (int64_t j = 0; j < nprobe && keys[j] >= 0; j++) {
+        // the heap is full once its top is a real result
+        if (j > 0 && ids[0] != -1) {
+            index_->quantizer->reconstruct(keys[j], centroid.data());
+            auto gap = std::sqrt(faiss::fvec_L2sqr(nearest.data(), centroid.data(), d));
+            if (gap > 0) {
+                float kth, bound;
+                if (is_ip) {
+                    auto a = (coarse_dis[0] - coarse_dis[j]) / gap;
+                    auto max_sim = std::sqrt(std::max(0.0f, 1.0f - a * a));
+                    kth = std::sqrt(std::max(0.0f, 2.0f - 2.0f * distances[0]));
+                    bound = std::sqrt(std::max(0.0f, 2.0f - 2.0f * max_sim));
+                } else {
+                    kth = std::sqrt(distances[0]);
+                    bound = (coarse_dis[j] - coarse_dis[0]) / (2 * gap);
+                }
+                if (kth <= factor * bound) {
+                    continue;
+                }
+            }
+        }
+        if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
+            index_->search_preassigned_without_codes(1, query, k, keys.data() + j, coarse_dis.data() + j, distances,
+                                                     ids, false, &params, nullptr, bitset);
+        } else {
+            index_->search_preassigned(1, query, k, keys.data() + j, coarse_dis.data() + j, distances, ids, false,
+                                       &params, nullptr, bitset);
+        }
+        scanned++;
+    }
+
+    if (is_ip) {
+        faiss::heap_reorder<faiss::CMin<float, int64_t>>(k, distances, ids);
+    } else {
+        faiss::heap_reorder<faiss::CMax<float, int64_t>>(k, distances, ids);
+    }
+    return scanned;
+}
+
+// Distances to centroids and covering radii come from different SIMD kernels, lists are kept when their bound exceeds
+// the reach by less than this relative margin
+constexpr float kRangePruneSlack = 1e-4f;
+
+// Range searches every list that may hold a vector within radius of the query, r_c being the covering radius of list
+// c. radius is the faiss one: a squared distance for L2, where no vector of the list is closer than |q - c| - r_c,
+// and a similarity for COSINE, where no vector scores above <q, c> + |q| * r_c. Neither bound assumes unit vectors,
+// so both hold for the decoded vectors of SQ / PQ lists. Returns the lists scanned.
+template <typename T>
+int64_t
+IvfIndexNode<T>::PrunedRangeSearch(const float* query, float radius, const BitsetView& bitset,
+                                   faiss::RangeSearchResult* res) const {
+    auto d = index_->d;
+    auto nlist = index_->nlist;
+    auto centroids = Centroids();
+    bool is_ip = index_->metric_type == faiss::METRIC_INNER_PRODUCT;
+    auto reach = std::sqrt(std::max(0.0f, radius)) * (1 + kRangePruneSlack);
+    auto query_norm = std::sqrt(faiss::fvec_norm_L2sqr(query, d)) * (1 + kRangePruneSlack);
+
+    std::vector<float> dis(nlist);
+    if (is_ip) {
+        faiss::fvec_inner_products_ny(dis.data(), query, centroids, d, nlist);
+    } else {
+        faiss::fvec_L2sqr_ny(dis.data(), query, centroids, d, nlist);
+    }
+    std::vector<int64_t> keys;
+    std::vector<float> coarse_dis;
+    for (size_t c = 0; c < nlist; c++) {
+        bool reachable = is_ip ? dis[c] + query_norm * list_radius_[c] + kRangePruneSlack >= radius
+                               : std::sqrt(dis[c]) - list_radius_[c] <= reach;
+        if (reachable) {
+            keys.push_back(c);
+            // scanners expect the quantizer's own measure
+            coarse_dis.push_back(dis[c]);
+        }
+    }
+    if (keys.empty()) {
+        return 0;
+    }
+    faiss::IVFSearchParameters params;
+    params.nprobe = keys.size();
+    if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
+        index_->range_search_preassigned_without_codes(1, query, radius, keys.data(), coarse_dis.data(), res, false,
+                                                       &params, nullptr, bitset);
+    } else {
+        index_->range_search_preassigned(1, query, radius, keys.data(), coarse_dis.data(), res, false, &params,
+                                         nullptr, bitset);
+    }
+    return keys.size();
+}
+
+// Vectors of one inverted list are scanned in blocks of this many bytes, so a block stays in cache while every
+// query probing the list is compared against it.
+constexpr size_t kBatchSearchBlockBytes = 256 * 1024;
+
+template <typename T>
+void
+IvfIndexNode<T>::BatchSearch(const float* xq, int64_t nq, int64_t k, int64_t nprobe, const BitsetView& bitset,
+                             float* distances, int64_t* ids) const {
+    auto d = index_->d;
+    auto nlist = static_cast<int64_t>(index_->nlist);
+    auto code_size = index_->code_size;
+    nprobe = std::min(nprobe, nlist);
+
+    // coarse assignment of the whole batch
+    std::vector<int64_t> coarse_ids(nq * nprobe);
+    std::vector<float> coarse_dis(nq * nprobe);
+    constexpr int64_t kAssignChunk = 64;
+    std::vector<std::future<void>> futs;
+    futs.reserve((nq + kAssignChunk - 1) / kAssignChunk);
+    for (int64_t begin = 0; begin < nq; begin += kAssignChunk) {
+        futs.push_back(pool_->push([&, begin] {
+            ThreadPool::ScopedOmpSetter setter(1);
+            auto n = std::min(kAssignChunk, nq - begin);
+            index_->quantizer->search(n, xq + begin * d, nprobe, coarse_dis.data() + begin * nprobe,
+                                      coarse_ids.data() + begin * nprobe);
+        }));
+    }
+    for (auto& fut : futs) {
+        fut.get();
+    }
+
+    // invert the assignment into list -> queries
+    std::vector<int64_t> list_offsets(nlist + 1, 0);
+    for (auto key : coarse_ids) {
+        if (key >= 0) {
+            list_offsets[key + 1]++;
+        }
+    }
+    for (int64_t i = 0; i < nlist; i++) {
+        list_offsets[i + 1] += list_offsets[i];
+    }
+    std::vector<int64_t> list_queries(list_offsets[nlist]);
+    std::vector<int64_t> list_fill(list_offsets.begin(), list_offsets.end() - 1);
+    for (int64_t i = 0; i < nq * nprobe; i++) {
+        auto key = coarse_ids[i];
+        if (key >= 0) {
+            list_queries[list_fill[key]++] = i / nprobe;
+        }
+    }
+
+    auto search = [&](auto heap_tag) {
+        using C = decltype(heap_tag);
+        for (int64_t i = 0; i < nq; i++) {
+            faiss::heap_heapify<C>(k, distances + i * k, ids + i * k);
+        }
+        std::vector<std::mutex> query_locks(nq);
+        auto block_size = std::max<size_t>(1, kBatchSearchBlockBytes / code_size);
+
+        futs.clear();
+        for (int64_t list_no = 0; list_no < nlist; list_no++) {
+            size_t list_size = index_->invlists->list_size(list_no);
+            auto q_begin = list_offsets[list_no];
+            auto nq_list = list_offsets[list_no + 1] - q_begin;
+            if (list_size == 0 || nq_list == 0) {
+                continue;
+            }
+            futs.push_back(pool_->push([&, list_no, list_size, q_begin, nq_list] {
+                auto codes = reinterpret_cast<const float*>(index_->get_arranged_codes() +
+                                                            index_->prefix_sum[list_no] * code_size);
+                faiss::InvertedLists::ScopedIds list_ids(index_->invlists, list_no);
+                std::vector<float> local_dis(nq_list * k);
+                std::vector<int64_t> local_ids(nq_list * k);
+                for (int64_t j = 0; j < nq_list; j++) {
+                    faiss::heap_heapify<C>(k, local_dis.data() + j * k, local_ids.data() + j * k);
+                }
+                // every block of the list is loaded once and compared against all queries probing the list
+                std::vector<float> block_dis(block_size);
+                for (size_t b = 0; b < list_size; b += block_size) {
+                    auto nb = std::min(block_size, list_size - b);
+                    for (int64_t j = 0; j < nq_list; j++) {
+                        auto query = xq + list_queries[q_begin + j] * d;
+                        if constexpr (C::is_max) {
+                            faiss::fvec_L2sqr_ny(block_dis.data(), query, codes + b * d, d, nb);
+                        } else {
+                            faiss::fvec_inner_products_ny(block_dis.data(), query, codes + b * d, d, nb);
+                        }
+                        auto heap_dis = local_dis.data() + j * k;
+                        auto heap_ids = local_ids.data() + j * k;
+                        for (size_t m = 0; m < nb; m++) {
+                            auto id = list_ids[b + m];
+                            if (!bitset.empty() && bitset.test(id)) {
+                                continue;
+                            }
+                            if (C::cmp(heap_dis[0], block_dis[m])) {
+                                faiss::heap_replace_top<C>(k, heap_dis, heap_ids, block_dis[m], id);
+                            }
+                        }
+                    }
+                }
+                for (int64_t j = 0; j < nq_list; j++) {
+                    auto q = list_queries[q_begin + j];
+                    std::lock_guard<std::mutex> lock(query_locks[q]);
+                    faiss::heap_addn<C>(k, distances + q * k, ids + q * k, local_dis.data() + j * k,
+                                        local_ids.data() + j * k, k);
+                }
+            }));
+        }
+        for (auto& fut : futs) {
+            fut.get();
+        }
+        for (int64_t i = 0; i < nq; i++) {
+            faiss::heap_reorder<C>(k, distances + i * k, ids + i * k);
+        }
+    };
+    if (index_->metric_type == faiss::METRIC_INNER_PRODUCT) {
+        search(faiss::CMin<float, int64_t>());
+    } else {
+        search(faiss::CMax<float, int64_t>());
     }
 }
 
@@ -595,7 +1876,7 @@ IvfIndexNode<faiss::IndexIVFFlat>::GetIndexMeta(const Config& config) const {
     }
 
     auto ivf_index = dynamic_cast<faiss::IndexIVF*>(index_.get());
-    auto ivf_quantizer = dynamic_cast<faiss::IndexFlat*>(ivf_index->quantizer);
+    auto ivf_quantizer = ivf_index->quantizer;
 
     int64_t dim = ivf_index->d;
     int64_t nlist = ivf_index->nlist;
@@ -603,6 +1884,7 @@ IvfIndexNode<faiss::IndexIVFFlat>::GetIndexMeta(const Config& config) const {
 
     feder::ivfflat::IVFFlatMeta meta(nlist, dim, ntotal);
     std::unordered_set<int64_t> id_set;
+    std::vector<float> centroid_vec(dim);
 
     for (int32_t i = 0; i < nlist; i++) {
         // copy from IndexIVF::search_preassigned_without_codes
@@ -613,10 +1895,10 @@ IvfIndexNode<faiss::IndexIVFFlat>::GetIndexMeta(const Config& config) const {
         auto node_num = index_->invlists->list_size(i);
         auto node_id_codes = sids->get();
 
-        // centroid vector
-        auto centroid_vec = ivf_quantizer->get_xb() + i * dim;
+        // centroid vector, reconstructed so that any coarse quantizer works
+        ivf_quantizer->reconstruct(i, centroid_vec.data());
 
-        meta.AddCluster(i, node_id_codes, node_num, centroid_vec, dim);
+        meta.AddCluster(i, node_id_codes, node_num, centroid_vec.data(), dim);
     }
 
     Json json_meta, json_id_set;
@@ -633,7 +1915,13 @@ IvfIndexNode<T>::Serialize(BinarySet& binset) const {
         if constexpr (std::is_same<T, faiss::IndexBinaryIVF>::value) {
             faiss::write_index_binary(index_.get(), &writer);
         } else if constexpr (std::is_same<T, faiss::IndexIVFFlat>::value) {
-            faiss::write_index_nm(index_.get(), &writer);
+            // loading needs neither RAW_DATA nor a reshuffle, and a file of it can be mapped as is
+            auto direct_map = DirectMapCount() == index_->ntotal ? DirectMapData() : nullptr;
+            WriteMappedLayout(index_.get(), direct_map, ListRadii(), writer);
+        } else if (refine_index_) {
+            // store base and refine index together so a single file can be loaded back
+            faiss::IndexRefine refine(index_.get(), refine_index_.get());
+            faiss::write_index(&refine, &writer);
         } else {
             faiss::write_index(index_.get(), &writer);
         }
@@ -646,6 +1934,41 @@ IvfIndexNode<T>::Serialize(BinarySet& binset) const {
     }
 }
 
+template <typename T>
+Status
+IvfIndexNode<T>::SerializeTemplate(BinarySet& binset) const {
+    if constexpr (std::is_same<T, faiss::IndexIVFFlatCC>::value || std::is_same<T, faiss::IndexBinaryIVF>::value) {
+        LOG_KNOWHERE_ERROR_ << Type() << " doesn't support SerializeTemplate.";
+        return Status::not_implemented;
+    } else {
+        if (!index_ || !index_->is_trained) {
+            LOG_KNOWHERE_ERROR_ << "Can not serialize the template of an untrained index.";
+            return Status::index_not_trained;
+        }
+        try {
+            // an empty index of the same quantizers is written in the layout of a regular one, so Deserialize reads it
+            IvfIndexNode empty(nullptr);
+            empty.AdoptQuantizers(*this);
+            return empty.Serialize(binset);
+        } catch (const std::exception& e) {
+            LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
+            return Status::faiss_inner_error;
+        }
+    }
+}
+
+template <typename T>
+void
+IvfIndexNode<T>::ShareQuantizer() {
+    if (!index_->own_fields) {
+        return;
+    }
+    std::unique_ptr<faiss::Index> qzr(index_->quantizer);
+    index_->own_fields = false;
+    shared_quantizer_ = SharedQuantizers::Instance().Share(std::move(qzr));
+    index_->quantizer = shared_quantizer_.get();
+}
+
 template <typename T>
 Status
 IvfIndexNode<T>::Deserialize(const BinarySet& binset, const Config& config) {
@@ -665,7 +1988,16 @@ IvfIndexNode<T>::Deserialize(const BinarySet& binset, const Config& config) {
         if constexpr (std::is_same<T, faiss::IndexBinaryIVF>::value) {
             index_.reset(static_cast<T*>(faiss::read_index_binary(&reader)));
         } else {
-            index_.reset(static_cast<T*>(faiss::read_index(&reader)));
+            LoadIndex(faiss::read_index(&reader));
+        }
+        if constexpr (!std::is_same<T, faiss::IndexIVFFlatCC>::value) {
+            BuildDirectMap();
+            ResetListRadii();
+        }
+        if constexpr (!std::is_same<T, faiss::IndexBinaryIVF>::value) {
+            if (static_cast<const IvfConfig&>(config).share_quantizer.value()) {
+                ShareQuantizer();
+            }
         }
     } catch (const std::exception& e) {
         LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
@@ -687,7 +2019,16 @@ IvfIndexNode<T>::DeserializeFromFile(const std::string& filename, const Config&
         if constexpr (std::is_same<T, faiss::IndexBinaryIVF>::value) {
             index_.reset(static_cast<T*>(faiss::read_index_binary(filename.data(), io_flags)));
         } else {
-            index_.reset(static_cast<T*>(faiss::read_index(filename.data(), io_flags)));
+            LoadIndex(faiss::read_index(filename.data(), io_flags));
+        }
+        if constexpr (!std::is_same<T, faiss::IndexIVFFlatCC>::value) {
+            BuildDirectMap();
+            ResetListRadii();
+        }
+        if constexpr (!std::is_same<T, faiss::IndexBinaryIVF>::value) {
+            if (static_cast<const IvfConfig&>(config).share_quantizer.value()) {
+                ShareQuantizer();
+            }
         }
     } catch (const std::exception& e) {
         LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
@@ -696,6 +2037,100 @@ IvfIndexNode<T>::DeserializeFromFile(const std::string& filename, const Config&
     return Status::success;
 }
 
+template <>
+Status
+IvfIndexNode<faiss::IndexIVFFlat>::LoadIvfFlat(const BinaryPtr& binary, const BinaryPtr& raw_data, bool in_place) {
+    MemoryIOReader reader;
+    reader.total = binary->size;
+    reader.data_ = binary->data.get();
+    index_.reset(static_cast<faiss::IndexIVFFlat*>(faiss::read_index_nm(&reader)));
+    refine_index_.reset();
+    shared_quantizer_.reset();
+
+    uint32_t magic = 0;
+    if (reader.total - reader.rp >= sizeof(magic) + sizeof(uint64_t)) {
+        reader.read(&magic, sizeof(magic));
+    }
+    auto invlists = index_->invlists;
+    if (magic == kMappedLayoutMagic) {
+        MappedLayoutHeader header;
+        uint64_t nradii = 0;
+        if (reader.read(&header, sizeof(header)) != 1 || reader.read(&nradii, sizeof(nradii)) != 1) {
+            LOG_KNOWHERE_ERROR_ << "Invalid binary set.";
+            return Status::invalid_binary_set;
+        }
+        std::vector<float> radii(std::min<uint64_t>(nradii, header.nlist));
+        if (radii.size() != nradii || reader(radii.data(), sizeof(float), nradii) != nradii) {
+            LOG_KNOWHERE_ERROR_ << "Invalid binary set.";
+            return Status::invalid_binary_set;
+        }
+        auto size = static_cast<uint64_t>(binary->size);
+        auto aligned = [](uint64_t offset) { return offset % kMappedSectionAlign == 0; };
+        auto fits = [size](uint64_t offset, uint64_t bytes) { return offset <= size && bytes <= size - offset; };
+        if (header.nlist != invlists->nlist || header.code_size != invlists->code_size ||
+            header.ntotal != static_cast<uint64_t>(index_->ntotal) || !aligned(header.codes_offset) ||
+            !aligned(header.ids_offset) || !aligned(header.list_offsets_offset) ||
+            !aligned(header.direct_map_offset) ||
+            !fits(header.codes_offset, header.ntotal * header.code_size) ||
+            !fits(header.ids_offset, header.ntotal * sizeof(faiss::idx_t)) ||
+            !fits(header.list_offsets_offset, (header.nlist + 1) * sizeof(uint64_t)) ||
+            !fits(header.direct_map_offset, header.direct_map_offset ? header.ntotal * sizeof(faiss::idx_t) : 0)) {
+            LOG_KNOWHERE_ERROR_ << "Invalid binary set.";
+            return Status::invalid_binary_set;
+        }
+        auto base = binary->data.get();
+        auto codes = base + header.codes_offset;
+        auto ids = reinterpret_cast<const faiss::idx_t*>(base + header.ids_offset);
+        auto list_offsets = reinterpret_cast<const size_t*>(base + header.list_offsets_offset);
+        for (size_t i = 0; i < header.nlist; i++) {
+            if (list_offsets[i] > list_offsets[i + 1]) {
+                LOG_KNOWHERE_ERROR_ << "Invalid binary set.";
+                return Status::invalid_binary_set;
+            }
+        }
+        if (list_offsets[0] != 0 || list_offsets[header.nlist] != header.ntotal) {
+            LOG_KNOWHERE_ERROR_ << "Invalid binary set.";
+            return Status::invalid_binary_set;
+        }
+        if (in_place) {
+            // nothing is read yet, pages are faulted in by the first searches and shared through the page cache
+            index_->replace_invlists(new faiss::MappedArrayInvertedLists(header.nlist, header.code_size, codes, ids,
+                                                                         list_offsets, binary->data),
+                                     true);
+            index_->arranged_codes_view = codes;
+        } else {
+            auto ails = dynamic_cast<faiss::ArrayInvertedLists*>(invlists);
+            for (size_t i = 0; i < header.nlist; i++) {
+                ails->ids[i].assign(ids + list_offsets[i], ids + list_offsets[i + 1]);
+            }
+            index_->arranged_codes.assign(codes, codes + header.ntotal * header.code_size);
+        }
+        index_->prefix_sum.assign(list_offsets, list_offsets + header.nlist);
+        if (in_place && header.direct_map_offset != 0) {
+            direct_map_.clear();
+            mapped_direct_map_ = reinterpret_cast<const faiss::idx_t*>(base + header.direct_map_offset);
+        } else {
+            BuildDirectMap();
+        }
+        ResetListRadii();
+        if (radii.size() == header.nlist) {
+            list_radius_ = std::move(radii);
+            list_radius_ready_ = true;
+        }
+        return Status::success;
+    }
+
+    // binaries written by older versions, construct arranged data from original data
+    if (raw_data == nullptr || raw_data->size < static_cast<int64_t>(index_->ntotal * index_->code_size)) {
+        LOG_KNOWHERE_ERROR_ << "Invalid binary set.";
+        return Status::invalid_binary_set;
+    }
+    ArrangeCodes(index_.get(), raw_data->data.get());
+    BuildDirectMap();
+    ResetListRadii();
+    return Status::success;
+}
+
 template <>
 Status
 IvfIndexNode<faiss::IndexIVFFlat>::Deserialize(const BinarySet& binset, const Config& config) {
@@ -706,41 +2141,36 @@ IvfIndexNode<faiss::IndexIVFFlat>::Deserialize(const BinarySet& binset, const Co
         LOG_KNOWHERE_ERROR_ << "Invalid binary set.";
         return Status::invalid_binary_set;
     }
-
-    MemoryIOReader reader;
-    reader.total = binary->size;
-    reader.data_ = binary->data.get();
     try {
-        index_.reset(static_cast<faiss::IndexIVFFlat*>(faiss::read_index_nm(&reader)));
-
-        // Construct arranged data from original data
-        auto binary = binset.GetByName("RAW_DATA");
-        if (binary == nullptr) {
-            LOG_KNOWHERE_ERROR_ << "Invalid binary set.";
-            return Status::invalid_binary_set;
+        auto status = LoadIvfFlat(binary, binset.GetByName("RAW_DATA"), false);
+        if (status == Status::success && static_cast<const IvfConfig&>(config).share_quantizer.value()) {
+            ShareQuantizer();
         }
-        auto invlists = index_->invlists;
-        auto d = index_->d;
-        size_t nb = binary->size / invlists->code_size;
-        index_->prefix_sum.resize(invlists->nlist);
-        size_t curr_index = 0;
+        return status;
+    } catch (const std::exception& e) {
+        LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
+        return Status::faiss_inner_error;
+    }
+}
 
-        auto ails = dynamic_cast<faiss::ArrayInvertedLists*>(invlists);
-        index_->arranged_codes.resize(d * nb * sizeof(float));
-        for (size_t i = 0; i < invlists->nlist; i++) {
-            auto list_size = ails->ids[i].size();
-            for (size_t j = 0; j < list_size; j++) {
-                memcpy(index_->arranged_codes.data() + d * (curr_index + j) * sizeof(float),
-                       binary->data.get() + d * ails->ids[i][j] * sizeof(float), d * sizeof(float));
-            }
-            index_->prefix_sum[i] = curr_index;
-            curr_index += list_size;
+template <>
+Status
+IvfIndexNode<faiss::IndexIVFFlat>::DeserializeFromFile(const std::string& filename, const Config& config) {
+    auto cfg = static_cast<const knowhere::BaseConfig&>(config);
+    try {
+        // without mmap the file is only mapped while it is copied into memory
+        auto status = LoadIvfFlat(MapFile(filename), nullptr, cfg.enable_mmap.value());
+        if (status == Status::success && cfg.enable_mmap.value() && index_->arranged_codes_view == nullptr) {
+            LOG_KNOWHERE_INFO_ << filename << " is not in the mapped IVF_FLAT layout, loaded it into memory";
+        }
+        if (status == Status::success && static_cast<const IvfConfig&>(config).share_quantizer.value()) {
+            ShareQuantizer();
         }
+        return status;
     } catch (const std::exception& e) {
         LOG_KNOWHERE_WARNING_ << "faiss inner error: " << e.what();
         return Status::faiss_inner_error;
     }
-    return Status::success;
 }
 
 KNOWHERE_REGISTER_GLOBAL(IVFBIN, [](const Object& object) {
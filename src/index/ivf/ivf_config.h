@@ -19,22 +19,94 @@ class IvfConfig : public BaseConfig {
  public:
     CFG_INT nlist;
     CFG_INT nprobe;
+    CFG_FLOAT adaptive_probe_factor;
+    CFG_BOOL range_list_pruning;
+    CFG_STRING quantizer_type;
+    CFG_INT quantizer_ef;
+    CFG_INT kmeans_n_iters;
+    CFG_FLOAT kmeans_trainset_fraction;
+    CFG_INT kmeans_batch_size;
+    CFG_STRING kmeans_init;
+    CFG_FLOAT kmeans_max_list_ratio;
+    CFG_BOOL reuse_quantizer;
+    CFG_BOOL share_quantizer;
     KNOHWERE_DECLARE_CONFIG(IvfConfig) {
         KNOWHERE_CONFIG_DECLARE_FIELD(nlist)
             .set_default(128)
             .description("number of inverted lists.")
             .for_train()
-            .set_range(1, 65536);
+            .set_range(1, 1048576);
         KNOWHERE_CONFIG_DECLARE_FIELD(nprobe)
             .set_default(8)
             .description("number of probes at query time.")
             .for_search()
             .set_range(1, 65536)
             .for_range_search();
+        KNOWHERE_CONFIG_DECLARE_FIELD(adaptive_probe_factor)
+            .description("skip probed lists that cannot beat the k-th result, scaled by this factor, 0 is off")
+            .set_default(0.0)
+            .set_range(0, 1024)
+            .for_search();
+        KNOWHERE_CONFIG_DECLARE_FIELD(range_list_pruning)
+            .description("range search every list whose radius reaches within the range radius instead of nprobe lists")
+            .set_default(false)
+            .for_range_search();
+        KNOWHERE_CONFIG_DECLARE_FIELD(quantizer_type)
+            .description("coarse quantizer type, one of FLAT, HNSW")
+            .set_default("FLAT")
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(quantizer_ef)
+            .description("search depth of the HNSW coarse quantizer, raised to nprobe when smaller")
+            .set_default(64)
+            .set_range(1, 65536)
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(kmeans_n_iters)
+            .description("iterations to search for kmeans centers")
+            .set_default(10)
+            .set_range(1, 1024)
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(kmeans_trainset_fraction)
+            .description("fraction of data to use in kmeans building, at least 39 vectors per list are kept")
+            .set_default(1.0)
+            .set_range(0, 1)
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(kmeans_batch_size)
+            .description("vectors per mini-batch kmeans iteration, 0 runs full-batch kmeans")
+            .set_default(0)
+            .set_range(0, std::numeric_limits<CFG_INT::value_type>::max())
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(kmeans_init)
+            .description("kmeans seeding, one of RANDOM, KMEANS_PARALLEL")
+            .set_default("RANDOM")
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(kmeans_max_list_ratio)
+            .description("split lists larger than this multiple of the mean list size, 0 disables balancing")
+            .set_default(0.0)
+            .set_range(0, std::numeric_limits<CFG_FLOAT::value_type>::max())
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(reuse_quantizer)
+            .description("keep the quantizers of a trained or loaded IVF_FLAT, IVF_SQ8 or IVF_PQ and only drop its data")
+            .set_default(false)
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(share_quantizer)
+            .description("reference one coarse quantizer in memory with the other loaded indexes that have the same one")
+            .set_default(false)
+            .for_deserialize()
+            .for_deserialize_from_file();
     }
 };
 
-class IvfFlatConfig : public IvfConfig {};
+class IvfFlatConfig : public IvfConfig {
+ public:
+    CFG_BOOL batch_search;
+    KNOHWERE_DECLARE_CONFIG(IvfFlatConfig) {
+        KNOWHERE_CONFIG_DECLARE_FIELD(batch_search)
+            .description("scan each inverted list once for all queries probing it, for high-nq requests, "
+                         "takes precedence over adaptive_probe_factor")
+            .set_default(false)
+            .for_search();
+    }
+};
 
 class IvfFlatCcConfig : public IvfFlatConfig {
  public:
@@ -52,13 +124,55 @@ class IvfPqConfig : public IvfConfig {
  public:
     CFG_INT m;
     CFG_INT nbits;
+    CFG_BOOL refine;
+    CFG_STRING refine_type;
+    CFG_INT refine_factor;
     KNOHWERE_DECLARE_CONFIG(IvfPqConfig) {
         KNOWHERE_CONFIG_DECLARE_FIELD(m).description("m").set_default(4).for_train().set_range(1, 65536);
         KNOWHERE_CONFIG_DECLARE_FIELD(nbits).description("nbits").set_default(8).for_train().set_range(1, 64);
+        KNOWHERE_CONFIG_DECLARE_FIELD(refine)
+            .description("whether to keep vectors for exact re-ranking")
+            .set_default(false)
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(refine_type)
+            .description("refine vectors storage type, one of FP32, FP16")
+            .set_default("FP32")
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(refine_factor)
+            .description("re-rank k * refine_factor candidates at query time")
+            .set_default(1)
+            .set_range(1, 1024)
+            .for_search();
     }
 };
 
-class IvfSqConfig : public IvfConfig {};
+class IvfSqConfig : public IvfConfig {
+ public:
+    CFG_STRING sq_type;
+    CFG_BOOL refine;
+    CFG_STRING refine_type;
+    CFG_INT refine_factor;
+    KNOHWERE_DECLARE_CONFIG(IvfSqConfig) {
+        KNOWHERE_CONFIG_DECLARE_FIELD(sq_type)
+            .description("scalar quantizer type, one of SQ8, SQ8_UNIFORM, SQ8_DIRECT, SQ6, SQ4, SQ4_UNIFORM, FP16, "
+                         "SQ8_DIRECT stores integer components in [0, 255] as they are")
+            .set_default("SQ8")
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(refine)
+            .description("whether to keep vectors for exact re-ranking")
+            .set_default(false)
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(refine_type)
+            .description("refine vectors storage type, one of FP32, FP16")
+            .set_default("FP32")
+            .for_train();
+        KNOWHERE_CONFIG_DECLARE_FIELD(refine_factor)
+            .description("re-rank k * refine_factor candidates at query time")
+            .set_default(1)
+            .set_range(1, 1024)
+            .for_search();
+    }
+};
 
 class IvfBinConfig : public IvfConfig {};
 
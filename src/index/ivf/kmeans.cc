@@ -0,0 +1,369 @@
+// Copyright (C) 2019-2023 Zilliz. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance
+// with the License. You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied. See the License for the specific language governing permissions and limitations under the License.
+
+#include "index/ivf/kmeans.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "faiss/IndexFlat.h"
+#include "knowhere/log.h"
+#include "simd/hook.h"
+
+namespace knowhere {
+
+namespace {
+
+constexpr int64_t kInitRounds = 5;
+constexpr int64_t kBalanceRounds = 32;
+constexpr int64_t kSplitIters = 8;
+
+// nearest centroid of every vector
+void
+Assign(const float* x, int64_t n, const float* centroids, int64_t k, int64_t d, faiss::MetricType metric,
+       int64_t* labels, float* distances) {
+    faiss::IndexFlat assigner(d, metric);
+    assigner.add(k, centroids);
+    assigner.search(n, x, 1, distances, labels);
+}
+
+// k-means|| (Bahmani et al.): every round samples each vector with probability proportional to its squared distance
+// to the candidates so far, so one round costs a single blocked assignment against the new candidates. The
+// candidates are then reduced to k by weighted sampling, weights being the number of vectors closest to each.
+void
+ParallelInit(const float* x, int64_t n, int64_t d, int64_t k, std::mt19937_64& rng, float* centroids) {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<float> candidates;
+    std::vector<int64_t> closest(n, 0);
+    std::vector<float> min_dis(n);
+
+    std::uniform_int_distribution<int64_t> first(0, n - 1);
+    auto seed_row = first(rng);
+    candidates.insert(candidates.end(), x + seed_row * d, x + (seed_row + 1) * d);
+    std::vector<int64_t> labels(n);
+    Assign(x, n, candidates.data(), 1, d, faiss::METRIC_L2, closest.data(), min_dis.data());
+
+    auto oversampling = std::max<int64_t>(1, 2 * k / kInitRounds);
+    for (int64_t round = 0; round < kInitRounds; round++) {
+        double phi = 0;
+#pragma omp parallel for reduction(+ : phi)
+        for (int64_t i = 0; i < n; i++) {
+            phi += min_dis[i];
+        }
+        if (phi <= 0) {
+            break;
+        }
+        std::vector<float> picked;
+        for (int64_t i = 0; i < n; i++) {
+            if (uniform(rng) * phi < oversampling * (double)min_dis[i]) {
+                picked.insert(picked.end(), x + i * d, x + (i + 1) * d);
+            }
+        }
+        auto npicked = static_cast<int64_t>(picked.size()) / d;
+        if (npicked == 0) {
+            continue;
+        }
+        std::vector<float> dis(n);
+        Assign(x, n, picked.data(), npicked, d, faiss::METRIC_L2, labels.data(), dis.data());
+        auto offset = static_cast<int64_t>(candidates.size()) / d;
+#pragma omp parallel for
+        for (int64_t i = 0; i < n; i++) {
+            if (dis[i] < min_dis[i]) {
+                min_dis[i] = dis[i];
+                closest[i] = offset + labels[i];
+            }
+        }
+        candidates.insert(candidates.end(), picked.begin(), picked.end());
+    }
+
+    auto ncandidates = static_cast<int64_t>(candidates.size()) / d;
+    if (ncandidates <= k) {
+        memcpy(centroids, candidates.data(), candidates.size() * sizeof(float));
+        // too few distinct vectors were drawn, fill up with random ones
+        std::uniform_int_distribution<int64_t> pick(0, n - 1);
+        for (int64_t i = ncandidates; i < k; i++) {
+            memcpy(centroids + i * d, x + pick(rng) * d, d * sizeof(float));
+        }
+        return;
+    }
+
+    std::vector<int64_t> weights(ncandidates, 0);
+    for (int64_t i = 0; i < n; i++) {
+        weights[closest[i]]++;
+    }
+    // weighted sampling without replacement (Efraimidis-Spirakis): keep the k largest log(u) / w
+    std::vector<std::pair<double, int64_t>> keys(ncandidates);
+    for (int64_t i = 0; i < ncandidates; i++) {
+        auto key = weights[i] > 0 ? std::log(uniform(rng)) / weights[i] : -HUGE_VAL;
+        keys[i] = {key, i};
+    }
+    std::nth_element(keys.begin(), keys.begin() + k, keys.end(), std::greater<>());
+    for (int64_t i = 0; i < k; i++) {
+        memcpy(centroids + i * d, candidates.data() + keys[i].second * d, d * sizeof(float));
+    }
+}
+
+// each thread owns a contiguous range of centroids and accumulates the vectors assigned to it
+void
+UpdateCentroids(const float* x, int64_t n, int64_t d, int64_t k, const int64_t* labels, float* centroids,
+                std::vector<int64_t>& sizes) {
+    std::vector<float> sums(k * d, 0.0f);
+    std::fill(sizes.begin(), sizes.end(), 0);
+#pragma omp parallel
+    {
+        int64_t nt = omp_get_num_threads();
+        int64_t rank = omp_get_thread_num();
+        int64_t c0 = k * rank / nt;
+        int64_t c1 = k * (rank + 1) / nt;
+        for (int64_t i = 0; i < n; i++) {
+            auto c = labels[i];
+            if (c < c0 || c >= c1) {
+                continue;
+            }
+            sizes[c]++;
+            auto sum = sums.data() + c * d;
+            auto xi = x + i * d;
+            for (int64_t j = 0; j < d; j++) {
+                sum[j] += xi[j];
+            }
+        }
+    }
+#pragma omp parallel for
+    for (int64_t c = 0; c < k; c++) {
+        if (sizes[c] == 0) {
+            continue;
+        }
+        float norm = 1.0f / sizes[c];
+        for (int64_t j = 0; j < d; j++) {
+            centroids[c * d + j] = sums[c * d + j] * norm;
+        }
+    }
+}
+
+// an empty centroid takes over a random vector of the currently largest cluster so that all k lists stay in use
+void
+SplitEmptyClusters(const float* x, int64_t n, int64_t d, int64_t k, int64_t* labels, float* centroids,
+                   std::vector<int64_t>& sizes, std::mt19937_64& rng) {
+    std::priority_queue<std::pair<int64_t, int64_t>> largest;
+    int64_t nempty = 0;
+    for (int64_t c = 0; c < k; c++) {
+        if (sizes[c] > 1) {
+            largest.emplace(sizes[c], c);
+        }
+        nempty += sizes[c] == 0;
+    }
+    if (nempty == 0) {
+        return;
+    }
+    std::uniform_int_distribution<int64_t> pick(0, n - 1);
+    for (int64_t c = 0; c < k && !largest.empty(); c++) {
+        if (sizes[c] != 0) {
+            continue;
+        }
+        auto [size, from] = largest.top();
+        largest.pop();
+        int64_t i = pick(rng);
+        while (labels[i] != from) {
+            i = pick(rng);
+        }
+        memcpy(centroids + c * d, x + i * d, d * sizeof(float));
+        labels[i] = c;
+        sizes[c] = 1;
+        sizes[from] = size - 1;
+        if (sizes[from] > 1) {
+            largest.emplace(sizes[from], from);
+        }
+    }
+}
+
+void
+Lloyd(const float* x, int64_t n, int64_t d, int64_t k, faiss::MetricType metric, int64_t niter, std::mt19937_64& rng,
+      float* centroids) {
+    std::vector<int64_t> labels(n);
+    std::vector<float> dis(n);
+    std::vector<int64_t> sizes(k);
+    for (int64_t iter = 0; iter < niter; iter++) {
+        Assign(x, n, centroids, k, d, metric, labels.data(), dis.data());
+        UpdateCentroids(x, n, d, k, labels.data(), centroids, sizes);
+        SplitEmptyClusters(x, n, d, k, labels.data(), centroids, sizes, rng);
+    }
+}
+
+// mini-batch k-means (Sculley 2010), every centroid moves towards its assigned batch vectors with learning rate
+// 1 / (number of vectors it has absorbed so far)
+void
+MiniBatch(const float* x, int64_t n, int64_t d, int64_t k, faiss::MetricType metric, int64_t niter,
+          int64_t batch_size, std::mt19937_64& rng, float* centroids) {
+    batch_size = std::min(batch_size, n);
+    std::uniform_int_distribution<int64_t> pick(0, n - 1);
+    std::vector<float> batch(batch_size * d);
+    std::vector<int64_t> labels(batch_size);
+    std::vector<float> dis(batch_size);
+    std::vector<int64_t> counts(k, 0);
+    std::vector<int64_t> offsets(k + 1);
+    std::vector<int64_t> order(batch_size);
+    for (int64_t iter = 0; iter < niter; iter++) {
+        for (int64_t i = 0; i < batch_size; i++) {
+            memcpy(batch.data() + i * d, x + pick(rng) * d, d * sizeof(float));
+        }
+        Assign(batch.data(), batch_size, centroids, k, d, metric, labels.data(), dis.data());
+
+        // group the batch by centroid so that centroids are updated in parallel
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (int64_t i = 0; i < batch_size; i++) {
+            offsets[labels[i] + 1]++;
+        }
+        for (int64_t c = 0; c < k; c++) {
+            offsets[c + 1] += offsets[c];
+        }
+        std::vector<int64_t> fill(offsets.begin(), offsets.end() - 1);
+        for (int64_t i = 0; i < batch_size; i++) {
+            order[fill[labels[i]]++] = i;
+        }
+#pragma omp parallel for schedule(dynamic)
+        for (int64_t c = 0; c < k; c++) {
+            auto centroid = centroids + c * d;
+            for (int64_t j = offsets[c]; j < offsets[c + 1]; j++) {
+                auto xi = batch.data() + order[j] * d;
+                float eta = 1.0f / ++counts[c];
+                for (int64_t m = 0; m < d; m++) {
+                    centroid[m] += eta * (xi[m] - centroid[m]);
+                }
+            }
+        }
+    }
+}
+
+// Splits every list above max_list_ratio * n / k in two with a 2-means over its vectors. The second half takes the
+// centroid of one of the smallest lists, whose vectors fall back to their neighbours at the next assignment, so k
+// stays fixed and no list ends up much larger than the bound.
+void
+BalanceClusters(const float* x, int64_t n, int64_t d, int64_t k, faiss::MetricType metric, float max_list_ratio,
+                std::mt19937_64& rng, float* centroids) {
+    auto bound = std::max<int64_t>(1, std::ceil(max_list_ratio * n / k));
+    std::vector<int64_t> labels(n);
+    std::vector<float> dis(n);
+    std::vector<int64_t> sizes(k);
+    for (int64_t round = 0; round < kBalanceRounds; round++) {
+        Assign(x, n, centroids, k, d, metric, labels.data(), dis.data());
+        std::fill(sizes.begin(), sizes.end(), 0);
+        for (int64_t i = 0; i < n; i++) {
+            sizes[labels[i]]++;
+        }
+        std::vector<int64_t> order(k);
+        for (int64_t c = 0; c < k; c++) {
+            order[c] = c;
+        }
+        std::sort(order.begin(), order.end(), [&sizes](int64_t a, int64_t b) { return sizes[a] > sizes[b]; });
+        // oversized lists sit at the front of order, the donors of their second centroid at the back
+        int64_t nsplit = 0;
+        while (nsplit < k / 2 && sizes[order[nsplit]] > bound && sizes[order[k - 1 - nsplit]] <= bound / 2) {
+            nsplit++;
+        }
+        if (nsplit == 0) {
+            break;
+        }
+
+        std::vector<std::vector<int64_t>> members(nsplit);
+        std::vector<int64_t> slot(k, -1);
+        for (int64_t j = 0; j < nsplit; j++) {
+            slot[order[j]] = j;
+        }
+        for (int64_t i = 0; i < n; i++) {
+            if (slot[labels[i]] >= 0) {
+                members[slot[labels[i]]].push_back(i);
+            }
+        }
+        for (int64_t j = 0; j < nsplit; j++) {
+            auto& ids = members[j];
+            auto m = static_cast<int64_t>(ids.size());
+            std::vector<float> sub(m * d);
+            for (int64_t i = 0; i < m; i++) {
+                memcpy(sub.data() + i * d, x + ids[i] * d, d * sizeof(float));
+            }
+            // seed with a random member and the member farthest from it
+            std::vector<float> halves(2 * d);
+            std::uniform_int_distribution<int64_t> pick(0, m - 1);
+            memcpy(halves.data(), sub.data() + pick(rng) * d, d * sizeof(float));
+            std::vector<int64_t> nearest(m);
+            std::vector<float> sub_dis(m);
+            Assign(sub.data(), m, halves.data(), 1, d, faiss::METRIC_L2, nearest.data(), sub_dis.data());
+            auto farthest = std::max_element(sub_dis.begin(), sub_dis.end()) - sub_dis.begin();
+            memcpy(halves.data() + d, sub.data() + farthest * d, d * sizeof(float));
+            Lloyd(sub.data(), m, d, 2, faiss::METRIC_L2, kSplitIters, rng, halves.data());
+            if (metric == faiss::METRIC_INNER_PRODUCT) {
+                // inner product favours the longer centroid, give both halves the norm of the one they replace
+                auto norm = std::sqrt(faiss::fvec_norm_L2sqr(centroids + order[j] * d, d));
+                for (int64_t h = 0; h < 2; h++) {
+                    auto half = halves.data() + h * d;
+                    auto scale = norm / std::max(std::sqrt(faiss::fvec_norm_L2sqr(half, d)), 1e-12f);
+                    for (int64_t t = 0; t < d; t++) {
+                        half[t] *= scale;
+                    }
+                }
+            }
+            memcpy(centroids + order[j] * d, halves.data(), d * sizeof(float));
+            memcpy(centroids + order[k - 1 - j] * d, halves.data() + d, d * sizeof(float));
+        }
+    }
+}
+
+}  // namespace
+
+void
+SampleRows(const float* x, int64_t n, int64_t d, int64_t m, int64_t seed, float* out) {
+    std::mt19937_64 rng(seed);
+    std::vector<int64_t> perm(n);
+    for (int64_t i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+    // partial Fisher-Yates, only the first m picks are needed
+    for (int64_t i = 0; i < m; i++) {
+        std::uniform_int_distribution<int64_t> pick(i, n - 1);
+        std::swap(perm[i], perm[pick(rng)]);
+    }
+    // copy in row order to keep the reads of x sequential
+    std::sort(perm.begin(), perm.begin() + m);
+#pragma omp parallel for
+    for (int64_t i = 0; i < m; i++) {
+        memcpy(out + i * d, x + perm[i] * d, d * sizeof(float));
+    }
+}
+
+void
+KMeans(const float* x, int64_t n, int64_t d, int64_t k, faiss::MetricType metric, const KMeansParams& params,
+       float* centroids) {
+    if (n < k) {
+        throw KnowhereException("kmeans needs at least as many vectors as centroids");
+    }
+    std::mt19937_64 rng(params.seed);
+    if (params.parallel_init) {
+        ParallelInit(x, n, d, k, rng, centroids);
+    } else {
+        SampleRows(x, n, d, k, rng(), centroids);
+    }
+    if (params.batch_size > 0) {
+        MiniBatch(x, n, d, k, metric, params.niter, params.batch_size, rng, centroids);
+    } else {
+        Lloyd(x, n, d, k, metric, params.niter, rng, centroids);
+    }
+    if (params.max_list_ratio > 0) {
+        BalanceClusters(x, n, d, k, metric, params.max_list_ratio, rng, centroids);
+    }
+}
+
+}  // namespace knowhere
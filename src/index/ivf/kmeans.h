@@ -0,0 +1,44 @@
+// Copyright (C) 2019-2023 Zilliz. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance
+// with the License. You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied. See the License for the specific language governing permissions and limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+
+#include "faiss/MetricType.h"
+
+namespace knowhere {
+
+struct KMeansParams {
+    int64_t niter = 25;
+    // 0 runs full-batch Lloyd iterations, otherwise each iteration moves the centroids towards this many sampled
+    // vectors with per-centroid learning rates (mini-batch k-means)
+    int64_t batch_size = 0;
+    // k-means|| seeding: a few rounds of D^2 oversampling instead of k uniformly random vectors
+    bool parallel_init = false;
+    // > 0 splits lists larger than this multiple of the mean list size after clustering, giving up a little
+    // quantization error for bounded scan cost per probe
+    float max_list_ratio = 0;
+    int64_t seed = 1234;
+};
+
+// Copies m distinct rows of x, picked uniformly at random, to out (m * d floats, m <= n).
+void
+SampleRows(const float* x, int64_t n, int64_t d, int64_t m, int64_t seed, float* out);
+
+// Clusters n row-major vectors of x into k centroids (k * d floats, n >= k). Assignment goes through
+// faiss::IndexFlat, which computes distances block by block with BLAS and spreads them over the current omp threads,
+// as do the centroid updates.
+void
+KMeans(const float* x, int64_t n, int64_t d, int64_t k, faiss::MetricType metric, const KMeansParams& params,
+       float* centroids);
+
+}  // namespace knowhere
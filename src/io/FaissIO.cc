@@ -49,6 +49,10 @@ MemoryIOWriter::operator()(const void* ptr, size_t size, size_t nitems) {
 
 size_t
 MemoryIOReader::operator()(void* ptr, size_t size, size_t nitems) {
+    // e.g. the vectors of an empty index
+    if (size == 0) {
+        return nitems;
+    }
     if (rp >= total) {
         return 0;
     }
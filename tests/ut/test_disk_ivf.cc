@@ -0,0 +1,144 @@
+// Copyright (C) 2019-2023 Zilliz. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance
+// with the License. You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied. See the License for the specific language governing permissions and limitations under the License.
+
+#include <string>
+
+#include "catch2/catch_approx.hpp"
+#include "catch2/catch_test_macros.hpp"
+#include "catch2/generators/catch_generators.hpp"
+#include "knowhere/comp/brute_force.h"
+#include "knowhere/comp/local_file_manager.h"
+#include "knowhere/expected.h"
+#include "knowhere/factory.h"
+#include "utils.h"
+#if __has_include(<filesystem>)
+#include <filesystem>
+namespace fs = std::filesystem;
+#elif __has_include(<experimental/filesystem>)
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+#else
+error "Missing the <filesystem> header."
+#endif
+#include <fstream>
+
+namespace {
+std::string kDir = fs::current_path().string() + "/disk_ivf_test";
+std::string kRawDataPath = kDir + "/raw_data";
+std::string kIndexPrefix = kDir + "/disk_ivf";
+
+constexpr uint32_t kNumRows = 2000;
+constexpr uint32_t kNumQueries = 100;
+constexpr uint32_t kDim = 128;
+constexpr uint32_t kK = 10;
+constexpr uint32_t kNlist = 16;
+constexpr float kKnnRecall = 0.9;
+
+void
+WriteRawDataToDisk(const std::string data_path, const float* raw_data, const uint32_t num, const uint32_t dim) {
+    std::ofstream writer(data_path.c_str(), std::ios::binary);
+    writer.write((char*)&num, sizeof(uint32_t));
+    writer.write((char*)&dim, sizeof(uint32_t));
+    writer.write((char*)raw_data, sizeof(float) * num * dim);
+    writer.close();
+}
+
+}  // namespace
+
+TEST_CASE("Test DiskIvfIndexNode.", "[disk_ivf]") {
+    fs::remove_all(kDir);
+    REQUIRE_NOTHROW(fs::create_directory(kDir));
+
+    auto metric_str = GENERATE(as<std::string>{}, knowhere::metric::L2, knowhere::metric::IP);
+
+    auto base_gen = [&metric_str]() {
+        knowhere::Json json;
+        json["dim"] = kDim;
+        json["metric_type"] = metric_str;
+        json["k"] = kK;
+        json["index_prefix"] = kIndexPrefix;
+        return json;
+    };
+
+    auto base_ds = GenDataSet(kNumRows, kDim, 30);
+    auto query_ds = GenDataSet(kNumQueries, kDim, 42);
+    WriteRawDataToDisk(kRawDataPath, static_cast<const float*>(base_ds->GetTensor()), kNumRows, kDim);
+    auto knn_gt = knowhere::BruteForce::Search(base_ds, query_ds, base_gen(), nullptr);
+    REQUIRE(knn_gt.has_value());
+
+    std::shared_ptr<knowhere::FileManager> file_manager = std::make_shared<knowhere::LocalFileManager>();
+    auto disk_ivf_pack = knowhere::Pack(file_manager);
+    {
+        knowhere::DataSet* ds_ptr = nullptr;
+        auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_DISK_IVF, disk_ivf_pack);
+        auto json = base_gen();
+        json["data_path"] = kRawDataPath;
+        json["nlist"] = kNlist;
+        REQUIRE(idx.Build(*ds_ptr, json) == knowhere::Status::success);
+        // the prefix is taken now
+        REQUIRE(idx.Build(*ds_ptr, json) == knowhere::Status::diskann_file_error);
+    }
+
+    // a budget of 0 reads every probed list from disk, a large one pins all of them
+    auto budget = GENERATE(0.0, 1.0);
+    CAPTURE(metric_str, budget);
+    auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_DISK_IVF, disk_ivf_pack);
+    auto deserialize_json = base_gen();
+    deserialize_json["search_cache_budget_gb"] = budget;
+    REQUIRE(idx.Deserialize(knowhere::BinarySet(), deserialize_json) == knowhere::Status::success);
+    REQUIRE(idx.Count() == kNumRows);
+
+    SECTION("Test knn search") {
+        auto json = base_gen();
+        json["nprobe"] = kNlist;
+        // one list per batch keeps a read in flight behind every scanned list
+        json["beamwidth"] = GENERATE(1, 8);
+        auto res = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(res.has_value());
+        REQUIRE(GetKNNRecall(*knn_gt.value(), *res.value()) > kKnnRecall);
+
+        // filtered ids never come back
+        auto bitset_data = GenerateBitsetWithFirstTbitsSet(kNumRows, kNumRows / 2);
+        knowhere::BitsetView bitset(bitset_data.data(), kNumRows);
+        auto filtered = idx.Search(*query_ds, json, bitset);
+        REQUIRE(filtered.has_value());
+        auto ids = filtered.value()->GetIds();
+        for (uint32_t i = 0; i < kNumQueries * kK; ++i) {
+            REQUIRE((ids[i] == -1 || ids[i] >= kNumRows / 2));
+        }
+    }
+
+    SECTION("Test range search") {
+        auto json = base_gen();
+        json["nprobe"] = kNlist;
+        auto res = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(res.has_value());
+        // a radius just past the k-th distance of each query's approximate result keeps most of it in range
+        auto dists = res.value()->GetDistance();
+        float radius = dists[kK - 1];
+        for (uint32_t i = 0; i < kNumQueries; ++i) {
+            radius = metric_str == knowhere::metric::L2 ? std::max(radius, dists[i * kK + kK - 1])
+                                                       : std::min(radius, dists[i * kK + kK - 1]);
+        }
+        json["radius"] = metric_str == knowhere::metric::L2 ? radius * 1.01f : radius * 0.99f;
+        auto range_res = idx.RangeSearch(*query_ds, json, nullptr);
+        REQUIRE(range_res.has_value());
+        auto lims = range_res.value()->GetLims();
+        auto range_dists = range_res.value()->GetDistance();
+        REQUIRE(lims[kNumQueries] >= kNumQueries * kK);
+        for (size_t i = 0; i < lims[kNumQueries]; ++i) {
+            REQUIRE((metric_str == knowhere::metric::L2 ? range_dists[i] < json["radius"].get<float>()
+                                                        : range_dists[i] > json["radius"].get<float>()));
+        }
+    }
+
+    fs::remove_all(kDir);
+}
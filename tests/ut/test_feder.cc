@@ -128,6 +128,13 @@ CheckIvfFlatMeta(const knowhere::DataSetPtr result, int64_t nb, const knowhere::
     }
     REQUIRE(all_id_set.size() == (size_t)nb);
 
+    // every list falls into exactly one histogram bucket
+    int64_t histogram_lists = 0;
+    for (auto count : meta.GetListSizeHistogram()) {
+        histogram_lists += count;
+    }
+    REQUIRE(histogram_lists == meta.GetNlist());
+
     // check IDSet validation
     std::unordered_set<int64_t> id_set;
     knowhere::Json j2 = nlohmann::json::parse(json_id_set);
@@ -193,4 +193,44 @@ TEST_CASE("Test Float Get Vector By Ids", "[Float GetVectorByIds]") {
             }
         }
     }
+
+    SECTION("Test decoded IVF_SQ8 and IVF_PQ vectors") {
+        using std::make_tuple;
+        auto [name, max_error] = GENERATE(table<std::string, float>({
+            make_tuple(knowhere::IndexEnum::INDEX_FAISS_IVFSQ8, 0.01f),
+            make_tuple(knowhere::IndexEnum::INDEX_FAISS_IVFPQ, 0.5f),
+        }));
+        CAPTURE(name);
+        auto idx = knowhere::IndexFactory::Instance().Create(name);
+        knowhere::Json json = ivfflat_gen();
+        json[knowhere::indexparam::M] = 32;
+        json[knowhere::indexparam::NBITS] = 8;
+        auto train_ds = GenDataSet(nb, dim);
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        // more ids than one gather chunk, with repeats
+        std::vector<int64_t> ids(3 * nb);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            ids[i] = (i * 7919) % nb;
+        }
+        auto ids_ds = GenIdsDataSet(ids.size(), ids);
+        auto results = idx.GetVectorByIds(*ids_ds);
+        REQUIRE(results.has_value());
+        REQUIRE(results.value()->GetRows() == (int64_t)ids.size());
+        // Build normalizes train_ds in place for COSINE, so it holds exactly what was encoded
+        auto xb = (const float*)train_ds->GetTensor();
+        auto res_data = (const float*)results.value()->GetTensor();
+        for (size_t i = 0; i < ids.size(); ++i) {
+            float err = 0, norm = 0;
+            for (int j = 0; j < dim; ++j) {
+                auto x = xb[ids[i] * dim + j];
+                err += (res_data[i * dim + j] - x) * (res_data[i * dim + j] - x);
+                norm += x * x;
+            }
+            REQUIRE(err <= max_error * norm);
+        }
+
+        std::vector<int64_t> bad_ids = {0, nb};
+        auto bad_ids_ds = GenIdsDataSet(bad_ids.size(), bad_ids);
+        REQUIRE(idx.GetVectorByIds(*bad_ids_ds).error() == knowhere::Status::invalid_args);
+    }
 }
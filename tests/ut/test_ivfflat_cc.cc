@@ -305,4 +305,54 @@ TEST_CASE("Test Build Search Concurrency", "[Concurrency]") {
             }
         }
     }
+
+    SECTION("Test Snapshot Isolation") {
+        knowhere::Json json = knowhere::Json::parse(ivfflatcc_gen().dump());
+        auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFFLAT_CC);
+        auto train_ds = GenDataSet(nb, dim, seed);
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        auto query_ds = GenDataSet(nq, dim, seed);
+
+        // two writers each add the whole base as one batch several times, so every query of a request must see the
+        // same number of copies of itself
+        std::vector<std::future<knowhere::Status>> add_task_list;
+        for (int j = 0; j < 2; j++) {
+            add_task_list.push_back(std::async(std::launch::async, [&] {
+                for (int i = 0; i < times; i++) {
+                    auto status = idx.Add(*train_ds, json);
+                    if (status != knowhere::Status::success) {
+                        return status;
+                    }
+                }
+                return knowhere::Status::success;
+            }));
+        }
+        std::vector<std::future<knowhere::expected<knowhere::DataSetPtr>>> search_task_list;
+        for (int j = 0; j < search_task_num; j++) {
+            search_task_list.push_back(
+                std::async(std::launch::async, [&] { return idx.Search(*query_ds, json, nullptr); }));
+        }
+        for (auto& task : add_task_list) {
+            REQUIRE(task.get() == knowhere::Status::success);
+        }
+        for (auto& task : search_task_list) {
+            auto results = task.get();
+            REQUIRE(results.has_value());
+            auto ids = results.value()->GetIds();
+            auto copies = [&](int64_t q) {
+                int64_t cnt = 0;
+                for (int64_t k = 0; k < top_k; k++) {
+                    cnt += ids[q * top_k + k] % nb == q;
+                }
+                return cnt;
+            };
+            auto expected_copies = copies(0);
+            CHECK(expected_copies >= 1);
+            CHECK(expected_copies <= 2 * times + 1);
+            for (int64_t q = 1; q < nq; q++) {
+                CHECK(copies(q) == expected_copies);
+            }
+        }
+        REQUIRE(idx.Count() == (2 * times + 1) * nb);
+    }
 }
@@ -9,6 +9,8 @@
 // is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
 // or implied. See the License for the specific language governing permissions and limitations under the License.
 
+#include <fstream>
+
 #include "catch2/catch_approx.hpp"
 #include "catch2/catch_test_macros.hpp"
 #include "catch2/generators/catch_generators.hpp"
@@ -19,12 +21,15 @@
 #include "knowhere/comp/index_param.h"
 #include "knowhere/comp/knowhere_config.h"
 #include "knowhere/factory.h"
+#include "knowhere/feder/IVFFlat.h"
 #include "knowhere/log.h"
 #include "utils.h"
 
 namespace {
 constexpr float kKnnRecallThreshold = 0.6f;
 constexpr float kBruteForceRecallThreshold = 0.99f;
+// 4-bit SQ codes are coarse on uniform random data
+constexpr float kSq4KnnRecallThreshold = 0.15f;
 }  // namespace
 
 TEST_CASE("Test Mem Index With Float Vector", "[float metrics]") {
@@ -70,6 +75,20 @@ TEST_CASE("Test Mem Index With Float Vector", "[float metrics]") {
         return json;
     };
 
+    // config of a float IVF index by name, for the sections that pick the IVF indexes they run on
+    auto ivf_gen = [&](const std::string& name) {
+        if (name == knowhere::IndexEnum::INDEX_FAISS_IVFFLAT_CC) {
+            return ivfflatcc_gen();
+        }
+        if (name == knowhere::IndexEnum::INDEX_FAISS_IVFSQ8) {
+            return ivfsq_gen();
+        }
+        if (name == knowhere::IndexEnum::INDEX_FAISS_IVFPQ) {
+            return ivfpq_gen();
+        }
+        return ivfflat_gen();
+    };
+
     auto hnsw_gen = [&base_gen]() {
         knowhere::Json json = base_gen();
         json[knowhere::indexparam::HNSW_M] = 128;
@@ -220,6 +239,815 @@ TEST_CASE("Test Mem Index With Float Vector", "[float metrics]") {
         REQUIRE(results.has_value());
     }
 
+    SECTION("Test IVFSQ with sq_type") {
+        auto sq_type = GENERATE(as<std::string>{}, "SQ8", "SQ8_UNIFORM", "SQ8_DIRECT", "SQ6", "SQ4", "SQ4_UNIFORM",
+                                "FP16");
+        auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFSQ8);
+        knowhere::Json json = ivfsq_gen();
+        json[knowhere::indexparam::SQ_TYPE] = sq_type;
+        CAPTURE(sq_type);
+        if (sq_type == "SQ8_DIRECT" && metric == knowhere::metric::COSINE) {
+            // direct codes hold integer components as they are, which normalized vectors are not
+            REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::invalid_args);
+        } else {
+            REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+            REQUIRE(idx.Size() > 0);
+            REQUIRE(idx.Count() == nb);
+            auto results = idx.Search(*query_ds, json, nullptr);
+            REQUIRE(results.has_value());
+            float recall = GetKNNRecall(*gt.value(), *results.value());
+            if (sq_type == "SQ4" || sq_type == "SQ4_UNIFORM") {
+                REQUIRE(recall > kSq4KnnRecallThreshold);
+            } else {
+                REQUIRE(recall > kKnnRecallThreshold);
+            }
+        }
+
+        json[knowhere::indexparam::SQ_TYPE] = "SQ3";
+        auto idx_invalid = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFSQ8);
+        REQUIRE(idx_invalid.Build(*train_ds, json) == knowhere::Status::invalid_args);
+    }
+
+    SECTION("Test IVFPQ/IVFSQ with refine") {
+        using std::make_tuple;
+        auto [name, gen] = GENERATE_REF(table<std::string, std::function<knowhere::Json()>>({
+            make_tuple(knowhere::IndexEnum::INDEX_FAISS_IVFSQ8, ivfsq_gen),
+            make_tuple(knowhere::IndexEnum::INDEX_FAISS_IVFPQ, ivfpq_gen),
+        }));
+        auto refine_type = GENERATE(as<std::string>{}, "FP32", "FP16");
+        auto idx = knowhere::IndexFactory::Instance().Create(name);
+        knowhere::Json json = gen();
+        json[knowhere::indexparam::REFINE] = true;
+        json[knowhere::indexparam::REFINE_TYPE] = refine_type;
+        json[knowhere::indexparam::REFINE_FACTOR] = 16;
+        CAPTURE(name, refine_type);
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        REQUIRE(idx.Size() > 0);
+        REQUIRE(idx.Count() == nb);
+        REQUIRE(idx.HasRawData(metric) == (refine_type == "FP32" && metric != knowhere::metric::COSINE));
+
+        knowhere::BinarySet bs;
+        REQUIRE(idx.Serialize(bs) == knowhere::Status::success);
+        auto idx_ = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(idx_.Deserialize(bs) == knowhere::Status::success);
+        auto results = idx_.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        float recall = GetKNNRecall(*gt.value(), *results.value());
+        REQUIRE(recall > kKnnRecallThreshold);
+
+        auto ids_ds = GenIdsDataSet(nq);
+        auto vectors = idx_.GetVectorByIds(*ids_ds);
+        REQUIRE(vectors.has_value());
+        if (idx_.HasRawData(metric)) {
+            auto xb = (const float*)train_ds->GetTensor();
+            auto ids = ids_ds->GetIds();
+            auto res = (const float*)vectors.value()->GetTensor();
+            for (int64_t i = 0; i < nq; ++i) {
+                for (int64_t j = 0; j < dim; ++j) {
+                    REQUIRE(res[i * dim + j] == xb[ids[i] * dim + j]);
+                }
+            }
+        }
+
+        json[knowhere::indexparam::REFINE_TYPE] = "BF8";
+        auto idx_invalid = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(idx_invalid.Build(*train_ds, json) == knowhere::Status::invalid_args);
+    }
+
+    SECTION("Test HNSW build threads") {
+        knowhere::Json json = hnsw_gen();
+        json[knowhere::meta::NUM_BUILD_THREAD] = 1;
+        // levels are drawn up front and one thread inserts in a fixed order, so the graph is the same every time
+        knowhere::BinarySet bs[2];
+        for (auto& b : bs) {
+            auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+            REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+            REQUIRE(idx.Count() == nb);
+            REQUIRE(idx.Serialize(b) == knowhere::Status::success);
+        }
+        auto first = bs[0].GetByName(knowhere::IndexEnum::INDEX_HNSW);
+        auto second = bs[1].GetByName(knowhere::IndexEnum::INDEX_HNSW);
+        REQUIRE(first->size == second->size);
+        REQUIRE(std::memcmp(first->data.get(), second->data.get(), first->size) == 0);
+
+        // points added to a quantized graph are refused with the graph left as it was
+        auto quantized = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW_SQ8);
+        REQUIRE(quantized.Build(*train_ds, json) == knowhere::Status::success);
+        auto expected = quantized.Search(*query_ds, json, nullptr);
+        REQUIRE(expected.has_value());
+        REQUIRE(quantized.Add(*train_ds, json) == knowhere::Status::not_implemented);
+        REQUIRE(quantized.Count() == nb);
+        auto results = quantized.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            REQUIRE(results.value()->GetIds()[i] == expected.value()->GetIds()[i]);
+        }
+    }
+
+    SECTION("Test HNSW reorder") {
+        auto method = GENERATE(as<std::string>{}, "BFS", "RCM");
+        CAPTURE(method);
+        auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        knowhere::Json json = hnsw_gen();
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        knowhere::BinarySet bs;
+        REQUIRE(idx.Serialize(bs) == knowhere::Status::success);
+
+        // the same graph under other ids finds the same neighbors
+        knowhere::Json load_json;
+        load_json[knowhere::indexparam::REORDER] = method;
+        auto reordered = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        REQUIRE(reordered.Deserialize(bs, load_json) == knowhere::Status::success);
+        auto bitset_data = GenerateBitsetWithRandomTbitsSet(nb, nb / 2);
+        knowhere::BitsetView bitset(bitset_data.data(), nb);
+        for (auto view : {knowhere::BitsetView(), bitset}) {
+            auto expected = idx.Search(*query_ds, json, view);
+            auto results = reordered.Search(*query_ds, json, view);
+            REQUIRE(results.has_value());
+            for (int64_t i = 0; i < nq * topk; ++i) {
+                REQUIRE(results.value()->GetIds()[i] == expected.value()->GetIds()[i]);
+            }
+        }
+        auto range_results = reordered.RangeSearch(*query_ds, json, nullptr);
+        REQUIRE(range_results.has_value());
+        for (int i = 0; i < nq; ++i) {
+            CHECK(range_results.value()->GetIds()[range_results.value()->GetLims()[i]] == i);
+        }
+
+        // and keeps the labels through serialization
+        knowhere::BinarySet reordered_bs;
+        REQUIRE(reordered.Serialize(reordered_bs) == knowhere::Status::success);
+        auto loaded = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        REQUIRE(loaded.Deserialize(reordered_bs) == knowhere::Status::success);
+        auto ids_ds = GenIdsDataSet(nq);
+        auto vectors = loaded.GetVectorByIds(*ids_ds);
+        REQUIRE(vectors.has_value());
+        auto xb = (const float*)train_ds->GetTensor();
+        auto ids = ids_ds->GetIds();
+        auto res = (const float*)vectors.value()->GetTensor();
+        for (int64_t i = 0; i < nq; ++i) {
+            for (int64_t j = 0; j < dim; ++j) {
+                REQUIRE(res[i * dim + j] == xb[ids[i] * dim + j]);
+            }
+        }
+        auto results = loaded.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        REQUIRE(GetKNNRecall(*gt.value(), *results.value()) > kKnnRecallThreshold);
+
+        json[knowhere::indexparam::REORDER] = method;
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        results = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        REQUIRE(GetKNNRecall(*gt.value(), *results.value()) > kKnnRecallThreshold);
+
+        // an empty index has nothing to renumber
+        auto empty = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        REQUIRE(empty.Build(*GenDataSet(0, dim), json) == knowhere::Status::success);
+        REQUIRE(empty.Count() == 0);
+        knowhere::BinarySet empty_bs;
+        REQUIRE(empty.Serialize(empty_bs) == knowhere::Status::success);
+        auto empty_loaded = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        REQUIRE(empty_loaded.Deserialize(empty_bs, load_json) == knowhere::Status::success);
+        REQUIRE(empty_loaded.Count() == 0);
+    }
+
+    SECTION("Test HNSW DeserializeFromFile") {
+        auto name = GENERATE(as<std::string>{}, knowhere::IndexEnum::INDEX_HNSW, knowhere::IndexEnum::INDEX_HNSW_SQ8);
+        auto idx = knowhere::IndexFactory::Instance().Create(name);
+        knowhere::Json json = hnsw_gen();
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        knowhere::BinarySet bs;
+        REQUIRE(idx.Serialize(bs) == knowhere::Status::success);
+        auto binary = bs.GetByName(idx.Type());
+        auto expected = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(expected.has_value());
+        auto ids_ds = GenIdsDataSet(nq);
+        auto expected_vectors = idx.GetVectorByIds(*ids_ds);
+        REQUIRE(expected_vectors.has_value());
+
+        auto enable_mmap = GENERATE(true, false);
+        CAPTURE(name, enable_mmap);
+        // the file is gone once loaded
+        const std::string path = "/tmp/knowhere_hnsw_" + metric + ".idx";
+        {
+            std::ofstream writer(path, std::ios::binary);
+            writer.write((const char*)binary->data.get(), binary->size);
+        }
+        auto idx_ = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(idx_.DeserializeFromFile(path, {{knowhere::meta::ENABLE_MMAP, enable_mmap}}) ==
+                knowhere::Status::success);
+        REQUIRE(idx_.Count() == nb);
+        auto results = idx_.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            REQUIRE(results.value()->GetIds()[i] == expected.value()->GetIds()[i]);
+        }
+        auto range_results = idx_.RangeSearch(*query_ds, json, nullptr);
+        REQUIRE(range_results.has_value());
+        auto vectors = idx_.GetVectorByIds(*ids_ds);
+        REQUIRE(vectors.has_value());
+        auto expected_data = (const float*)expected_vectors.value()->GetTensor();
+        auto data = (const float*)vectors.value()->GetTensor();
+        REQUIRE(std::equal(data, data + nq * dim, expected_data));
+
+        // the loaded index writes back the very same binary
+        knowhere::BinarySet bs_;
+        REQUIRE(idx_.Serialize(bs_) == knowhere::Status::success);
+        auto binary_ = bs_.GetByName(idx_.Type());
+        REQUIRE(binary_->size == binary->size);
+        REQUIRE(std::equal(binary_->data.get(), binary_->data.get() + binary_->size, binary->data.get()));
+        // a mapped index is read-only
+        if (enable_mmap) {
+            REQUIRE(idx_.Add(*train_ds, json) != knowhere::Status::success);
+        }
+    }
+
+    SECTION("Test HNSW Add after Deserialize and MarkDeleted") {
+        auto method = GENERATE(as<std::string>{}, "NONE", "BFS");
+        CAPTURE(method);
+        auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        knowhere::Json json = hnsw_gen();
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        knowhere::BinarySet bs;
+        REQUIRE(idx.Serialize(bs) == knowhere::Status::success);
+        knowhere::Json load_json;
+        load_json[knowhere::indexparam::REORDER] = method;
+        auto idx_ = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        REQUIRE(idx_.Deserialize(bs, load_json) == knowhere::Status::success);
+
+        // a second batch takes the ids after the first one
+        auto more_ds = GenDataSet(nb, dim, 7);
+        REQUIRE(idx_.Add(*more_ds, json) == knowhere::Status::success);
+        REQUIRE(idx_.Count() == 2 * nb);
+        auto more_query_ds = CopyDataSet(more_ds, nq);
+        auto results = idx_.Search(*more_query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        for (int64_t i = 0; i < nq; ++i) {
+            REQUIRE(results.value()->GetIds()[i * topk] == nb + i);
+        }
+
+        // deleted rows leave the results, and the graph gets repaired as they pile up
+        auto bitset_data = GenerateBitsetWithRandomTbitsSet(2 * nb, nb / 2);
+        knowhere::BitsetView bitset(bitset_data.data(), 2 * nb);
+        std::vector<int64_t> deleted;
+        for (int64_t i = 0; i < 2 * nb; ++i) {
+            if (bitset.test(i)) {
+                deleted.push_back(i);
+            }
+        }
+        REQUIRE(idx_.MarkDeleted(*GenIdsDataSet(deleted.size(), deleted)) == knowhere::Status::success);
+
+        std::vector<float> xb(2 * nb * dim);
+        std::copy_n((const float*)train_ds->GetTensor(), nb * dim, xb.begin());
+        std::copy_n((const float*)more_ds->GetTensor(), nb * dim, xb.begin() + nb * dim);
+        auto all_ds = knowhere::GenDataSet(2 * nb, dim, xb.data());
+        auto deleted_gt = knowhere::BruteForce::Search(all_ds, query_ds, conf, bitset);
+        results = idx_.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            REQUIRE(!bitset.test(results.value()->GetIds()[i]));
+        }
+        REQUIRE(GetKNNRecall(*deleted_gt.value(), *results.value()) > kKnnRecallThreshold);
+
+        // a batch ending in an invalid id deletes nothing, not even the live top hits before it
+        std::vector<int64_t> partly_invalid;
+        for (int64_t i = 0; i < nq; ++i) {
+            partly_invalid.push_back(results.value()->GetIds()[i * topk]);
+        }
+        partly_invalid.push_back(2 * nb);
+        REQUIRE(idx_.MarkDeleted(*GenIdsDataSet(partly_invalid.size(), partly_invalid)) ==
+                knowhere::Status::invalid_args);
+        REQUIRE(idx_.Count() == 2 * nb);
+        auto unchanged = idx_.Search(*query_ds, json, nullptr);
+        REQUIRE(unchanged.has_value());
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            REQUIRE(unchanged.value()->GetIds()[i] == results.value()->GetIds()[i]);
+        }
+
+        // deletions are kept through serialization
+        knowhere::BinarySet deleted_bs;
+        REQUIRE(idx_.Serialize(deleted_bs) == knowhere::Status::success);
+        auto loaded = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        REQUIRE(loaded.Deserialize(deleted_bs) == knowhere::Status::success);
+        auto loaded_results = loaded.Search(*query_ds, json, nullptr);
+        REQUIRE(loaded_results.has_value());
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            REQUIRE(loaded_results.value()->GetIds()[i] == results.value()->GetIds()[i]);
+        }
+
+        // deletions also passed in the bitset are left out once, with half the rows still live
+        std::vector<int64_t> evens;
+        for (int64_t i = 0; i < 2 * nb; i += 2) {
+            evens.push_back(i);
+            bitset_data[i >> 3] |= 1 << (i & 7);
+        }
+        REQUIRE(idx_.MarkDeleted(*GenIdsDataSet(evens.size(), evens)) == knowhere::Status::success);
+        REQUIRE(bitset.count() >= (size_t)nb);
+        results = idx_.Search(*query_ds, json, nullptr);
+        auto filtered_results = idx_.Search(*query_ds, json, bitset);
+        REQUIRE(results.has_value());
+        REQUIRE(filtered_results.has_value());
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            auto id = filtered_results.value()->GetIds()[i];
+            REQUIRE(id == results.value()->GetIds()[i]);
+            REQUIRE(id >= 0);
+            REQUIRE(!bitset.test(id));
+        }
+    }
+
+    SECTION("Test HNSW entry points") {
+        auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        knowhere::Json json = hnsw_gen();
+        json[knowhere::indexparam::ENTRY_POINTS] = 16;
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        auto results = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        REQUIRE(GetKNNRecall(*gt.value(), *results.value()) > kKnnRecallThreshold);
+
+        // the entry points are kept through serialization and reordering
+        knowhere::BinarySet bs;
+        REQUIRE(idx.Serialize(bs) == knowhere::Status::success);
+        auto method = GENERATE(as<std::string>{}, "NONE", "BFS");
+        CAPTURE(method);
+        knowhere::Json load_json;
+        load_json[knowhere::indexparam::REORDER] = method;
+        auto idx_ = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        REQUIRE(idx_.Deserialize(bs, load_json) == knowhere::Status::success);
+        auto loaded_results = idx_.Search(*query_ds, json, nullptr);
+        REQUIRE(loaded_results.has_value());
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            REQUIRE(loaded_results.value()->GetIds()[i] == results.value()->GetIds()[i]);
+        }
+        auto range_results = idx_.RangeSearch(*query_ds, json, nullptr);
+        REQUIRE(range_results.has_value());
+        for (int i = 0; i < nq; ++i) {
+            CHECK(range_results.value()->GetIds()[range_results.value()->GetLims()[i]] == i);
+        }
+    }
+
+    SECTION("Test HNSW NN-Descent build") {
+        const int64_t rows = 4 * nb;
+        auto many_ds = GenDataSet(rows, dim, 7);
+        auto many_query_ds = CopyDataSet(many_ds, nq);
+        auto many_gt = knowhere::BruteForce::Search(many_ds, many_query_ds, conf, nullptr);
+        knowhere::Json json = hnsw_gen();
+        json[knowhere::indexparam::HNSW_M] = 16;
+        json[knowhere::indexparam::BUILD_METHOD] = "NNDESCENT";
+        auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        REQUIRE(idx.Build(*many_ds, json) == knowhere::Status::success);
+        REQUIRE(idx.Count() == rows);
+        auto results = idx.Search(*many_query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        REQUIRE(GetKNNRecall(*many_gt.value(), *results.value()) > kKnnRecallThreshold);
+
+        // points added to the built index are inserted
+        REQUIRE(idx.Add(*train_ds, json) == knowhere::Status::success);
+        REQUIRE(idx.Count() == rows + nb);
+        auto more_results = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(more_results.has_value());
+        for (int i = 0; i < nq; ++i) {
+            CHECK(more_results.value()->GetIds()[i * topk] == rows + i);
+        }
+
+        // too few points to sample a kNN graph from are inserted too
+        auto small = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+        REQUIRE(small.Build(*train_ds, json) == knowhere::Status::success);
+        auto small_results = small.Search(*query_ds, json, nullptr);
+        REQUIRE(small_results.has_value());
+        REQUIRE(GetKNNRecall(*gt.value(), *small_results.value()) > kKnnRecallThreshold);
+
+        json[knowhere::indexparam::BUILD_METHOD] = "KNN";
+        REQUIRE(small.Build(*train_ds, json) == knowhere::Status::invalid_args);
+    }
+
+    SECTION("Test quantized HNSW") {
+        auto name = GENERATE(as<std::string>{}, knowhere::IndexEnum::INDEX_HNSW_SQ8,
+                             knowhere::IndexEnum::INDEX_HNSW_FP16, knowhere::IndexEnum::INDEX_HNSW_PQ);
+        auto refine = GENERATE(false, true);
+        auto idx = knowhere::IndexFactory::Instance().Create(name);
+        knowhere::Json json = hnsw_gen();
+        if (name == knowhere::IndexEnum::INDEX_HNSW_PQ) {
+            json[knowhere::indexparam::M] = 32;
+        }
+        json[knowhere::indexparam::REFINE] = refine;
+        CAPTURE(name, refine);
+        REQUIRE(idx.Type() == name);
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        REQUIRE(idx.Count() == nb);
+        REQUIRE(idx.HasRawData(metric) == refine);
+        // codes take the place of the vectors
+        if (!refine) {
+            auto hnsw = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+            REQUIRE(hnsw.Build(*train_ds, hnsw_gen()) == knowhere::Status::success);
+            REQUIRE(idx.Size() < hnsw.Size());
+        }
+
+        knowhere::BinarySet bs;
+        REQUIRE(idx.Serialize(bs) == knowhere::Status::success);
+        auto idx_ = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(idx_.Deserialize(bs) == knowhere::Status::success);
+        REQUIRE(idx_.HasRawData(metric) == refine);
+        auto results = idx_.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        float recall = GetKNNRecall(*gt.value(), *results.value());
+        REQUIRE(recall > kKnnRecallThreshold);
+
+        auto range_results = idx_.RangeSearch(*query_ds, json, nullptr);
+        REQUIRE(range_results.has_value());
+        if (refine) {
+            auto ids = range_results.value()->GetIds();
+            auto lims = range_results.value()->GetLims();
+            for (int i = 0; i < nq; ++i) {
+                CHECK(ids[lims[i]] == i);
+            }
+        }
+
+        auto ids_ds = GenIdsDataSet(nq);
+        auto vectors = idx_.GetVectorByIds(*ids_ds);
+        REQUIRE(vectors.has_value());
+        if (refine) {
+            auto xb = (const float*)train_ds->GetTensor();
+            auto ids = ids_ds->GetIds();
+            auto res = (const float*)vectors.value()->GetTensor();
+            for (int64_t i = 0; i < nq; ++i) {
+                for (int64_t j = 0; j < dim; ++j) {
+                    REQUIRE(res[i * dim + j] == xb[ids[i] * dim + j]);
+                }
+            }
+        }
+
+        REQUIRE(idx_.Add(*train_ds, json) == knowhere::Status::not_implemented);
+    }
+
+    SECTION("Test IVFFLAT Deserialize without RAW_DATA") {
+        auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFFLAT);
+        knowhere::Json json = ivfflat_gen();
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        knowhere::BinarySet bs;
+        REQUIRE(idx.Serialize(bs) == knowhere::Status::success);
+
+        auto idx_ = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFFLAT);
+        REQUIRE(idx_.Deserialize(bs) == knowhere::Status::success);
+        auto results = idx_.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        float recall = GetKNNRecall(*gt.value(), *results.value());
+        REQUIRE(recall > kKnnRecallThreshold);
+    }
+
+    SECTION("Test IVFFLAT DeserializeFromFile") {
+        auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFFLAT);
+        knowhere::Json json = ivfflat_gen();
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        knowhere::BinarySet bs;
+        REQUIRE(idx.Serialize(bs) == knowhere::Status::success);
+        auto binary = bs.GetByName(idx.Type());
+        const std::string path = "/tmp/knowhere_ivf_flat_" + metric + ".idx";
+        {
+            std::ofstream writer(path, std::ios::binary);
+            writer.write((const char*)binary->data.get(), binary->size);
+        }
+        auto expected = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(expected.has_value());
+        std::vector<int64_t> ids = {0, nb / 2, nb - 1};
+        auto ids_ds = GenIdsDataSet(ids.size(), ids);
+        auto expected_vectors = idx.GetVectorByIds(*ids_ds);
+        REQUIRE(expected_vectors.has_value());
+
+        auto enable_mmap = GENERATE(true, false);
+        CAPTURE(enable_mmap);
+        auto idx_ = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFFLAT);
+        REQUIRE(idx_.DeserializeFromFile(path, {{knowhere::meta::ENABLE_MMAP, enable_mmap}}) ==
+                knowhere::Status::success);
+        std::remove(path.c_str());
+        REQUIRE(idx_.Count() == nb);
+        auto results = idx_.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            REQUIRE(results.value()->GetIds()[i] == expected.value()->GetIds()[i]);
+        }
+        auto vectors = idx_.GetVectorByIds(*ids_ds);
+        REQUIRE(vectors.has_value());
+        auto expected_data = (const float*)expected_vectors.value()->GetTensor();
+        auto data = (const float*)vectors.value()->GetTensor();
+        REQUIRE(std::equal(data, data + ids.size() * dim, expected_data));
+
+        // the loaded index writes back the very same binary
+        knowhere::BinarySet bs_;
+        REQUIRE(idx_.Serialize(bs_) == knowhere::Status::success);
+        auto binary_ = bs_.GetByName(idx_.Type());
+        REQUIRE(binary_->size == binary->size);
+        REQUIRE(std::equal(binary_->data.get(), binary_->data.get() + binary_->size, binary->data.get()));
+        // a mapped index is read-only
+        REQUIRE((idx_.Add(*train_ds, json) == knowhere::Status::success) != enable_mmap);
+    }
+
+    SECTION("Test IVF with HNSW quantizer") {
+        auto name = GENERATE(as<std::string>{}, knowhere::IndexEnum::INDEX_FAISS_IVFFLAT,
+                             knowhere::IndexEnum::INDEX_FAISS_IVFFLAT_CC, knowhere::IndexEnum::INDEX_FAISS_IVFSQ8);
+        auto idx = knowhere::IndexFactory::Instance().Create(name);
+        knowhere::Json json = ivf_gen(name);
+        json[knowhere::indexparam::QUANTIZER_TYPE] = "HNSW";
+        json[knowhere::indexparam::QUANTIZER_EF] = 16;
+        CAPTURE(name);
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        REQUIRE(idx.Size() > 0);
+        REQUIRE(idx.Count() == nb);
+
+        knowhere::BinarySet bs;
+        REQUIRE(idx.Serialize(bs) == knowhere::Status::success);
+        auto idx_ = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(idx_.Deserialize(bs) == knowhere::Status::success);
+        auto results = idx_.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        float recall = GetKNNRecall(*gt.value(), *results.value());
+        REQUIRE(recall > kKnnRecallThreshold);
+
+        json[knowhere::indexparam::QUANTIZER_TYPE] = "LSH";
+        auto idx_invalid = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(idx_invalid.Build(*train_ds, json) == knowhere::Status::invalid_args);
+    }
+
+    SECTION("Test IVFFLAT batch search") {
+        auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFFLAT);
+        knowhere::Json json = ivfflat_gen();
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        json[knowhere::indexparam::BATCH_SEARCH] = true;
+        auto results = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        float recall = GetKNNRecall(*gt.value(), *results.value());
+        REQUIRE(recall > kKnnRecallThreshold);
+
+        auto bitset_data = GenerateBitsetWithRandomTbitsSet(nb, nb / 2);
+        knowhere::BitsetView bitset(bitset_data.data(), nb);
+        auto filtered = idx.Search(*query_ds, json, bitset);
+        REQUIRE(filtered.has_value());
+        auto ids = filtered.value()->GetIds();
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            REQUIRE((ids[i] == -1 || !bitset.test(ids[i])));
+        }
+
+        // batch search takes precedence and reports no per-query list counts
+        json[knowhere::indexparam::ADAPTIVE_PROBE_FACTOR] = 1.0;
+        auto adaptive = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(adaptive.has_value());
+        REQUIRE(adaptive.value()->GetListsScanned() == nullptr);
+        auto batch_ids = results.value()->GetIds();
+        auto adaptive_ids = adaptive.value()->GetIds();
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            REQUIRE(adaptive_ids[i] == batch_ids[i]);
+        }
+    }
+
+    SECTION("Test IVF kmeans training options") {
+        using std::make_tuple;
+        auto name = GENERATE(as<std::string>{}, knowhere::IndexEnum::INDEX_FAISS_IVFFLAT,
+                             knowhere::IndexEnum::INDEX_FAISS_IVFFLAT_CC, knowhere::IndexEnum::INDEX_FAISS_IVFSQ8);
+        auto [batch_size, init] = GENERATE(table<int64_t, std::string>({
+            make_tuple(0, "RANDOM"),
+            make_tuple(0, "KMEANS_PARALLEL"),
+            make_tuple(256, "RANDOM"),
+            make_tuple(256, "KMEANS_PARALLEL"),
+        }));
+        auto idx = knowhere::IndexFactory::Instance().Create(name);
+        knowhere::Json json = ivf_gen(name);
+        json[knowhere::indexparam::KMEANS_TRAINSET_FRACTION] = 0.5;
+        json[knowhere::indexparam::KMEANS_N_ITERS] = 10;
+        json[knowhere::indexparam::KMEANS_BATCH_SIZE] = batch_size;
+        json[knowhere::indexparam::KMEANS_INIT] = init;
+        CAPTURE(name, batch_size, init);
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        REQUIRE(idx.Count() == nb);
+        auto results = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        float recall = GetKNNRecall(*gt.value(), *results.value());
+        REQUIRE(recall > kKnnRecallThreshold);
+
+        json[knowhere::indexparam::KMEANS_INIT] = "KMEANS_PLUS_PLUS";
+        auto idx_invalid = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(idx_invalid.Build(*train_ds, json) == knowhere::Status::invalid_args);
+    }
+
+    SECTION("Test IVFFLAT balanced kmeans") {
+        // most rows crowd around one point, plain k-means leaves them in a few oversized lists
+        auto skewed_ds = GenDataSet(nb, dim);
+        auto xb = (float*)skewed_ds->GetTensor();
+        for (int64_t i = 1; i < nb * 6 / 10; ++i) {
+            for (int64_t j = 0; j < dim; ++j) {
+                xb[i * dim + j] = xb[j] + 0.01f * xb[i * dim + j];
+            }
+        }
+        auto max_list_size = [&](float ratio) {
+            auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFFLAT);
+            knowhere::Json json = ivfflat_gen();
+            json[knowhere::indexparam::KMEANS_MAX_LIST_RATIO] = ratio;
+            REQUIRE(idx.Build(*skewed_ds, json) == knowhere::Status::success);
+            auto meta = idx.GetIndexMeta(json);
+            REQUIRE(meta.has_value());
+            knowhere::feder::ivfflat::IVFFlatMeta ivf_meta;
+            nlohmann::from_json(knowhere::Json::parse(meta.value()->GetJsonInfo()), ivf_meta);
+            int64_t lists = 0;
+            for (auto count : ivf_meta.GetListSizeHistogram()) {
+                lists += count;
+            }
+            REQUIRE(lists == ivf_meta.GetNlist());
+            size_t max_size = 0;
+            for (auto& cluster : ivf_meta.GetClusters()) {
+                max_size = std::max(max_size, cluster.node_ids_.size());
+            }
+            return (int64_t)max_size;
+        };
+        auto bound = 2 * nb / 16;
+        REQUIRE(max_list_size(0.0f) > bound);
+        REQUIRE(max_list_size(2.0f) <= bound);
+
+        knowhere::Json json = ivfflat_gen();
+        json[knowhere::indexparam::KMEANS_MAX_LIST_RATIO] = 0.5;
+        auto idx_invalid = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFFLAT);
+        REQUIRE(idx_invalid.Build(*train_ds, json) == knowhere::Status::invalid_args);
+    }
+
+    SECTION("Test IVF adaptive nprobe") {
+        auto name = GENERATE(as<std::string>{}, knowhere::IndexEnum::INDEX_FAISS_IVFFLAT,
+                             knowhere::IndexEnum::INDEX_FAISS_IVFFLAT_CC, knowhere::IndexEnum::INDEX_FAISS_IVFSQ8);
+        auto idx = knowhere::IndexFactory::Instance().Create(name);
+        knowhere::Json json = ivf_gen(name);
+        CAPTURE(name);
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+        auto fixed = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(fixed.has_value());
+        REQUIRE(fixed.value()->GetListsScanned() == nullptr);
+
+        // factor 1 only skips lists that cannot hold a better result when the distances are exact, SQ codes rank by
+        // decoded distances where the bound is a heuristic
+        json[knowhere::indexparam::ADAPTIVE_PROBE_FACTOR] = 1.0;
+        auto results = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        if (name == knowhere::IndexEnum::INDEX_FAISS_IVFSQ8) {
+            REQUIRE(GetKNNRecall(*gt.value(), *results.value()) > kKnnRecallThreshold);
+        } else {
+            REQUIRE(GetKNNRecall(*fixed.value(), *results.value()) >= kBruteForceRecallThreshold);
+        }
+        auto lists_scanned = results.value()->GetListsScanned();
+        REQUIRE(lists_scanned != nullptr);
+        for (int64_t i = 0; i < nq; ++i) {
+            REQUIRE(lists_scanned[i] >= 1);
+            REQUIRE(lists_scanned[i] <= json[knowhere::indexparam::NPROBE].get<int64_t>());
+        }
+
+        json[knowhere::indexparam::ADAPTIVE_PROBE_FACTOR] = 4.0;
+        results = idx.Search(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        REQUIRE(results.value()->GetListsScanned() != nullptr);
+    }
+
+    SECTION("Test IVF range search list pruning") {
+        auto name = GENERATE(as<std::string>{}, knowhere::IndexEnum::INDEX_FAISS_IVFFLAT,
+                             knowhere::IndexEnum::INDEX_FAISS_IVFSQ8);
+        auto idx = knowhere::IndexFactory::Instance().Create(name);
+        knowhere::Json json = ivf_gen(name);
+        CAPTURE(name);
+        // wide enough for at least 20 neighbours of every query
+        const int64_t range_k = 20;
+        knowhere::Json knn_conf = conf;
+        knn_conf[knowhere::meta::TOPK] = range_k;
+        auto knn_gt = knowhere::BruteForce::Search(train_ds, query_ds, knn_conf, nullptr);
+        REQUIRE(knn_gt.has_value());
+        bool is_l2 = knowhere::IsMetricType(metric, knowhere::metric::L2);
+        float radius = knn_gt.value()->GetDistance()[range_k - 1];
+        for (int64_t i = 0; i < nq; ++i) {
+            auto kth = knn_gt.value()->GetDistance()[i * range_k + range_k - 1];
+            radius = is_l2 ? std::max(radius, kth) : std::min(radius, kth);
+        }
+        json[knowhere::meta::RADIUS] = is_l2 ? radius * 1.01f : radius * 0.99f;
+        REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+
+        // all lists scanned is exact for the vectors as the index stores them, decoded ones included
+        json[knowhere::indexparam::NPROBE] = json[knowhere::indexparam::NLIST];
+        auto exhaustive = idx.RangeSearch(*query_ds, json, nullptr);
+        REQUIRE(exhaustive.has_value());
+        REQUIRE(exhaustive.value()->GetLims()[nq] >= nq * range_k / 2);
+
+        json[knowhere::indexparam::NPROBE] = 1;
+        json[knowhere::indexparam::RANGE_LIST_PRUNING] = true;
+        auto results = idx.RangeSearch(*query_ds, json, nullptr);
+        REQUIRE(results.has_value());
+        REQUIRE(GetRangeSearchRecall(*exhaustive.value(), *results.value()) == 1.0f);
+
+        // a loaded index computes the radii again on its first pruned search
+        knowhere::BinarySet bs;
+        REQUIRE(idx.Serialize(bs) == knowhere::Status::success);
+        auto loaded = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(loaded.Deserialize(bs) == knowhere::Status::success);
+        auto loaded_results = loaded.RangeSearch(*query_ds, json, nullptr);
+        REQUIRE(loaded_results.has_value());
+        REQUIRE(GetRangeSearchRecall(*exhaustive.value(), *loaded_results.value()) == 1.0f);
+
+        if (name == knowhere::IndexEnum::INDEX_FAISS_IVFFLAT) {
+            auto range_gt = knowhere::BruteForce::RangeSearch(train_ds, query_ds, json, nullptr);
+            REQUIRE(range_gt.has_value());
+            REQUIRE(GetRangeSearchRecall(*range_gt.value(), *results.value()) >= kBruteForceRecallThreshold);
+        }
+    }
+
+    SECTION("Test IVF merge") {
+        auto name = GENERATE(as<std::string>{}, knowhere::IndexEnum::INDEX_FAISS_IVFFLAT,
+                             knowhere::IndexEnum::INDEX_FAISS_IVFSQ8, knowhere::IndexEnum::INDEX_FAISS_IVFPQ);
+        CAPTURE(name);
+        knowhere::Json json = ivf_gen(name);
+        auto tmpl = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(tmpl.Build(*train_ds, json) == knowhere::Status::success);
+        knowhere::BinarySet bs;
+        REQUIRE(tmpl.Serialize(bs) == knowhere::Status::success);
+
+        // two segments built on the quantizers of the template
+        const int64_t split = 600, deleted = 100;
+        auto data = static_cast<const float*>(train_ds->GetTensor());
+        knowhere::Json reuse_json = json;
+        reuse_json[knowhere::indexparam::REUSE_QUANTIZER] = true;
+        auto a = knowhere::IndexFactory::Instance().Create(name);
+        auto b = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(a.Deserialize(bs) == knowhere::Status::success);
+        REQUIRE(b.Deserialize(bs) == knowhere::Status::success);
+        REQUIRE(a.Build(*knowhere::GenDataSet(split, dim, data), reuse_json) == knowhere::Status::success);
+        REQUIRE(b.Build(*knowhere::GenDataSet(nb - split, dim, data + split * dim), reuse_json) ==
+                knowhere::Status::success);
+        REQUIRE(a.Count() == split);
+
+        auto a_bitset_data = GenerateBitsetWithFirstTbitsSet(split, deleted);
+        knowhere::BitsetView a_bitset(a_bitset_data.data(), split);
+        auto merged = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(merged.Merge({a, b}, json, {a_bitset, nullptr}) == knowhere::Status::success);
+        REQUIRE(merged.Count() == nb - deleted);
+
+        // the same lists in the same order as the template with the deleted rows filtered
+        auto bitset_data = GenerateBitsetWithFirstTbitsSet(nb, deleted);
+        knowhere::BitsetView bitset(bitset_data.data(), nb);
+        auto expected = tmpl.Search(*query_ds, json, bitset);
+        auto results = merged.Search(*query_ds, json, nullptr);
+        REQUIRE(expected.has_value());
+        REQUIRE(results.has_value());
+        for (int64_t i = 0; i < nq * topk; ++i) {
+            REQUIRE(results.value()->GetIds()[i] == expected.value()->GetIds()[i] - deleted);
+            REQUIRE(results.value()->GetDistance()[i] == expected.value()->GetDistance()[i]);
+        }
+
+        if (name == knowhere::IndexEnum::INDEX_FAISS_IVFFLAT) {
+            std::vector<int64_t> ids = {0, split - deleted, nb - deleted - 1};
+            auto vectors = merged.GetVectorByIds(*GenIdsDataSet(ids.size(), ids));
+            REQUIRE(vectors.has_value());
+            auto tensor = static_cast<const float*>(vectors.value()->GetTensor());
+            for (size_t i = 0; i < ids.size(); ++i) {
+                REQUIRE(std::memcmp(tensor + i * dim, data + (ids[i] + deleted) * dim, dim * sizeof(float)) == 0);
+            }
+        }
+
+        // an index trained on its own has other centroids
+        auto other = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(other.Build(*GenDataSet(nb, dim, 7), json) == knowhere::Status::success);
+        REQUIRE(merged.Merge({other}, json) == knowhere::Status::invalid_args);
+        REQUIRE(merged.Count() == nb - deleted);
+    }
+
+    SECTION("Test IVF template") {
+        auto name = GENERATE(as<std::string>{}, knowhere::IndexEnum::INDEX_FAISS_IVFFLAT,
+                             knowhere::IndexEnum::INDEX_FAISS_IVFSQ8, knowhere::IndexEnum::INDEX_FAISS_IVFPQ);
+        CAPTURE(name);
+        knowhere::Json json = ivf_gen(name);
+        auto tmpl = knowhere::IndexFactory::Instance().Create(name);
+        REQUIRE(tmpl.Build(*train_ds, json) == knowhere::Status::success);
+        knowhere::BinarySet bs, full_bs;
+        REQUIRE(tmpl.SerializeTemplate(bs) == knowhere::Status::success);
+        REQUIRE(tmpl.Serialize(full_bs) == knowhere::Status::success);
+        REQUIRE(bs.GetByName(name)->size < full_bs.GetByName(name)->size);
+
+        // segments loaded from the template share its coarse quantizer and are filled by Add alone
+        knowhere::Json load_json = json;
+        load_json[knowhere::indexparam::SHARE_QUANTIZER] = true;
+        auto data = static_cast<const float*>(train_ds->GetTensor());
+        const int64_t split = 600;
+        auto expected = tmpl.Search(*query_ds, json, nullptr);
+        REQUIRE(expected.has_value());
+        for (int i = 0; i < 2; ++i) {
+            auto seg = knowhere::IndexFactory::Instance().Create(name);
+            REQUIRE(seg.Deserialize(bs, load_json) == knowhere::Status::success);
+            REQUIRE(seg.Count() == 0);
+            REQUIRE(seg.Add(*knowhere::GenDataSet(split, dim, data), json) == knowhere::Status::success);
+            REQUIRE(seg.Add(*knowhere::GenDataSet(nb - split, dim, data + split * dim), json) ==
+                    knowhere::Status::success);
+            REQUIRE(seg.Count() == nb);
+            auto results = seg.Search(*query_ds, json, nullptr);
+            REQUIRE(results.has_value());
+            for (int64_t j = 0; j < nq * topk; ++j) {
+                REQUIRE(results.value()->GetIds()[j] == expected.value()->GetIds()[j]);
+                REQUIRE(std::abs(results.value()->GetDistance()[j] - expected.value()->GetDistance()[j]) < 1e-4f);
+            }
+        }
+
+        auto cc = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFFLAT_CC);
+        REQUIRE(cc.Build(*train_ds, ivfflatcc_gen()) == knowhere::Status::success);
+        REQUIRE(cc.SerializeTemplate(bs) == knowhere::Status::not_implemented);
+    }
+
     SECTION("Test IVFPQ with invalid params") {
         auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_FAISS_IVFPQ);
         uint32_t nb = 1000;
@@ -239,6 +1067,42 @@ TEST_CASE("Test Mem Index With Float Vector", "[float metrics]") {
     }
 }
 
+TEST_CASE("Test HNSW Search with Medium Selectivity Bitset", "[float metrics]") {
+    // large enough for the traversals to beat brute force on the filtered fractions below
+    const int64_t nb = 20000, nq = 20;
+    const int64_t dim = 16;
+    const int64_t topk = 10;
+
+    auto metric = GENERATE(as<std::string>{}, knowhere::metric::L2, knowhere::metric::COSINE);
+    knowhere::Json json;
+    json[knowhere::meta::DIM] = dim;
+    json[knowhere::meta::METRIC_TYPE] = metric;
+    json[knowhere::meta::TOPK] = topk;
+    json[knowhere::indexparam::HNSW_M] = 8;
+    json[knowhere::indexparam::EFCONSTRUCTION] = 64;
+    json[knowhere::indexparam::EF] = 32;
+
+    const auto train_ds = GenDataSet(nb, dim);
+    const auto query_ds = GenDataSet(nq, dim, 42);
+    auto idx = knowhere::IndexFactory::Instance().Create(knowhere::IndexEnum::INDEX_HNSW);
+    REQUIRE(idx.Build(*train_ds, json) == knowhere::Status::success);
+
+    // the plain traversal covers 0.5, the filter-aware one 0.7 and 0.85
+    auto percentage = GENERATE(0.5f, 0.7f, 0.85f);
+    CAPTURE(metric, percentage);
+    auto bitset_data = GenerateBitsetWithRandomTbitsSet(nb, percentage * nb);
+    knowhere::BitsetView bitset(bitset_data.data(), nb);
+    auto results = idx.Search(*query_ds, json, bitset);
+    REQUIRE(results.has_value());
+    auto gt = knowhere::BruteForce::Search(train_ds, query_ds, json, bitset);
+    auto ids = results.value()->GetIds();
+    for (int64_t i = 0; i < nq * topk; ++i) {
+        REQUIRE((ids[i] == -1 || !bitset.test(ids[i])));
+    }
+    float recall = GetKNNRecall(*gt.value(), *results.value());
+    REQUIRE(recall > 0.9f);
+}
+
 TEST_CASE("Test Mem Index With Binary Vector", "[float metrics]") {
     using Catch::Approx;
 
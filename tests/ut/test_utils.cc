@@ -13,6 +13,7 @@
 
 #include "catch2/catch_approx.hpp"
 #include "catch2/catch_test_macros.hpp"
+#include "hnswlib/visited_list_pool.h"
 #include "knowhere/comp/time_recorder.h"
 #include "knowhere/heap.h"
 #include "knowhere/utils.h"
@@ -108,3 +109,26 @@ TEST_CASE("Test Time Recorder") {
     auto span = tr.ElapseFromBegin("done");
     REQUIRE(span > 0);
 }
+
+TEST_CASE("Test Visited List Pool", "[hnsw]") {
+    const size_t n = 16;
+    hnswlib::VisitedListPool pool(n);
+    // past the 16-bit epoch wraparound, marks of an earlier search never leak into a later one
+    for (size_t i = 0; i < 70000; i++) {
+        auto visited = pool.getFreeVisitedList();
+        for (size_t id = 0; id < n; id++) {
+            REQUIRE(!visited->get(id));
+        }
+        visited->set(i % n);
+        REQUIRE(visited->get(i % n));
+    }
+    {
+        // concurrent searches hold lists of their own
+        auto a = pool.getFreeVisitedList();
+        auto b = pool.getFreeVisitedList();
+        REQUIRE(a.get() != b.get());
+        a->set(3);
+        REQUIRE(!b->get(3));
+    }
+    REQUIRE(pool.size() > 0);
+}
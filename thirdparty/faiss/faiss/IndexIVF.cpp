@@ -557,7 +557,12 @@ void IndexIVF::search_preassigned(
                     key,
                     nlist);
 
+            // read the size once: entries appended meanwhile are left for
+            // the next search, so the scan sees a consistent prefix
             size_t list_size = invlists->list_size(key);
+            if (params && params->snapshot) {
+                list_size = std::min(list_size, params->snapshot->list_size(key));
+            }
 
             // don't waste time on empty lists
             if (list_size == 0) {
@@ -571,8 +576,12 @@ void IndexIVF::search_preassigned(
             size_t scan_cnt = 0;
             try {
                 size_t segment_num = invlists->get_segment_num(key);
-                for (size_t segment_idx = 0; segment_idx < segment_num; segment_idx++) {
-                    size_t segment_size = invlists->get_segment_size(key, segment_idx);
+                for (size_t segment_idx = 0;
+                     segment_idx < segment_num && scan_cnt < list_size;
+                     segment_idx++) {
+                    size_t segment_size = std::min(
+                            invlists->get_segment_size(key, segment_idx),
+                            list_size - scan_cnt);
                     size_t segment_offset = invlists->get_segment_offset(key, segment_idx);
                     InvertedLists::ScopedCodes scodes(invlists, key, segment_offset);
                     std::unique_ptr<InvertedLists::ScopedIds> sids;
@@ -831,15 +840,23 @@ void IndexIVF::range_search_preassigned(
                     key,
                     ik,
                     nlist);
-            const size_t list_size = invlists->list_size(key);
+            size_t list_size = invlists->list_size(key);
+            if (params && params->snapshot) {
+                list_size = std::min(list_size, params->snapshot->list_size(key));
+            }
 
             if (list_size == 0)
                 return;
 
             try {
+                size_t scan_cnt = 0;
                 size_t segment_num = invlists->get_segment_num(key);
-                for (size_t segment_idx = 0; segment_idx < segment_num; segment_idx++) {
-                    size_t segment_size = invlists->get_segment_size(key, segment_idx);
+                for (size_t segment_idx = 0;
+                     segment_idx < segment_num && scan_cnt < list_size;
+                     segment_idx++) {
+                    size_t segment_size = std::min(
+                            invlists->get_segment_size(key, segment_idx),
+                            list_size - scan_cnt);
                     size_t segment_offset = invlists->get_segment_offset(key, segment_idx);
 
                     InvertedLists::ScopedCodes scodes(invlists, key, segment_offset);
@@ -857,6 +874,7 @@ void IndexIVF::range_search_preassigned(
                             radius,
                             qres,
                             bitset);
+                    scan_cnt += segment_size;
                 }
             } catch (const std::exception& e) {
                 std::lock_guard<std::mutex> lock(exception_mutex);
@@ -1051,6 +1069,7 @@ void IndexIVF::reset() {
     direct_map.clear();
     invlists->reset();
     arranged_codes.clear();
+    arranged_codes_view = nullptr;
     prefix_sum.clear();
     ntotal = 0;
 }
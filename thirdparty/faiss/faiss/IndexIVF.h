@@ -71,7 +71,10 @@ struct IVFSearchParameters {
     size_t max_codes;  ///< max nb of codes to visit to do a query
     int parallel_mode; // default value if -1, and we will use
                        // this->parallel_mode in this case
-    IVFSearchParameters() : nprobe(1), max_codes(0), parallel_mode(-1) {}
+    /// scan only the list prefixes captured here, null scans whole lists
+    const InvertedListsSnapshot* snapshot;
+    IVFSearchParameters()
+            : nprobe(1), max_codes(0), parallel_mode(-1), snapshot(nullptr) {}
     virtual ~IVFSearchParameters() {}
 };
 
@@ -122,6 +125,15 @@ struct IndexIVF : Index, Level1Quantizer {
     std::vector<uint8_t> arranged_codes;
     std::vector<size_t> prefix_sum;
 
+    /// arranged codes kept outside of arranged_codes, e.g. in a file mapping
+    /// owned by the inverted lists; used instead of arranged_codes when set
+    const uint8_t* arranged_codes_view = nullptr;
+
+    const uint8_t* get_arranged_codes() const {
+        return arranged_codes_view ? arranged_codes_view
+                                   : arranged_codes.data();
+    }
+
     /** Parallel mode determines how queries are parallelized with OpenMP
      *
      * 0 (default): split over queries
@@ -273,7 +285,8 @@ struct IndexIVF : Index, Level1Quantizer {
             const size_t nprobe,
             const int parallel_mode,
             const size_t max_codes,
-            const BitsetView bitset = nullptr) const;
+            const BitsetView bitset = nullptr,
+            const InvertedListsSnapshot* snapshot = nullptr) const;
 
     /** Similar to search, but does not store codes **/
     void search_without_codes_thread_safe(
@@ -302,7 +315,8 @@ struct IndexIVF : Index, Level1Quantizer {
             const size_t nprobe,
             const int parallel_mode,
             const size_t max_codes,
-            const BitsetView bitset = nullptr) const;
+            const BitsetView bitset = nullptr,
+            const InvertedListsSnapshot* snapshot = nullptr) const;
 
     void range_search_without_codes_thread_safe(
             idx_t n,
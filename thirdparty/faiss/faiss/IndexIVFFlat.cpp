@@ -272,7 +272,7 @@ void IndexIVFFlat::reconstruct_from_offset_without_codes(
             reinterpret_cast<uint8_t*>(rol->pin_readonly_codes->data);
     memcpy(recons, arranged_data + idx * code_size, code_size);
 #else
-    memcpy(recons, arranged_codes.data() + idx * code_size, code_size);
+    memcpy(recons, get_arranged_codes() + idx * code_size, code_size);
 #endif
 }
 
@@ -314,6 +314,7 @@ void IndexIVFFlatCC::train(idx_t n, const float* x) {
 }
 
 void IndexIVFFlatCC::add_with_ids(idx_t n, const float* x, const idx_t* xids) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
     std::unique_ptr<idx_t[]> coarse_idx(new idx_t[n]);
     if (is_cosine_) {
         auto norm_data = std::make_unique<float[]>(n * d);
@@ -327,6 +328,31 @@ void IndexIVFFlatCC::add_with_ids(idx_t n, const float* x, const idx_t* xids) {
         quantizer->assign(n, x, coarse_idx.get());
         add_core(n, x, nullptr, xids, coarse_idx.get());
     }
+    std::atomic_store(
+            &snapshot_,
+            std::shared_ptr<const InvertedListsSnapshot>(
+                    std::make_shared<InvertedListsSnapshot>(invlists)));
+}
+
+std::shared_ptr<const InvertedListsSnapshot> IndexIVFFlatCC::snapshot() const {
+    auto snapshot = std::atomic_load(&snapshot_);
+    if (snapshot == nullptr) {
+        snapshot = std::make_shared<InvertedListsSnapshot>(invlists);
+    }
+    return snapshot;
+}
+
+void IndexIVFFlatCC::reconstruct_batch(
+        idx_t n,
+        const idx_t* keys,
+        float* recons) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    make_direct_map(true);
+    for (idx_t i = 0; i < n; i++) {
+        FAISS_THROW_IF_NOT_MSG(
+                keys[i] >= 0 && keys[i] < ntotal, "invalid key");
+        reconstruct(keys[i], recons + i * d);
+    }
 }
 
 /*****************************************
@@ -11,6 +11,8 @@
 #define FAISS_INDEX_IVF_FLAT_H
 
 #include <stdint.h>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 
 #include <faiss/IndexIVF.h>
@@ -83,12 +85,27 @@ struct IndexIVFFlatCC : IndexIVFFlat {
 
     void train(idx_t n, const float* x) override;
 
+    /// writers are serialized, readers searching meanwhile never wait:
+    /// each completed batch publishes a new snapshot
     void add_with_ids(idx_t n, const float* x, const idx_t* xids) override;
 
+    /// list sizes as of the last completed add, so that a search does not
+    /// see part of a batch still being added. Readers keep the returned
+    /// snapshot alive for as long as they use it.
+    std::shared_ptr<const InvertedListsSnapshot> snapshot() const;
+
+    /// copies the vectors of n ids, waiting for a running add; the direct
+    /// map is built on first use and kept up to date by add from then on
+    void reconstruct_batch(idx_t n, const idx_t* keys, float* recons);
+
     IndexIVFFlatCC() {}
 
    private:
-    bool is_cosine_;
+    bool is_cosine_ = false;
+    std::mutex writer_mutex_;
+    // null until the first add, snapshot() then captures the lists as
+    // they are (an index that was just loaded)
+    std::shared_ptr<const InvertedListsSnapshot> snapshot_;
 };
 
 struct IndexIVFFlatDedup : IndexIVFFlat {
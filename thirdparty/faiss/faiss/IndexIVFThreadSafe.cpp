@@ -44,12 +44,14 @@ void IndexIVF::search_thread_safe(
         const size_t nprobe,
         const int parallel_mode,
         const size_t max_codes,
-        const BitsetView bitset) const {
+        const BitsetView bitset,
+        const InvertedListsSnapshot* snapshot) const {
     FAISS_THROW_IF_NOT(k > 0);
     const size_t final_nprobe = std::min(nlist, nprobe);
     FAISS_THROW_IF_NOT(final_nprobe > 0);
     IVFSearchParameters params =
             gen_search_param(final_nprobe, parallel_mode, max_codes);
+    params.snapshot = snapshot;
 
     // search function for a subset of queries
     auto sub_search_func = [this, k, final_nprobe, bitset, &params](
@@ -342,7 +344,7 @@ void IndexIVF::search_preassigned_without_codes(
                 InvertedLists::ScopedCodes scodes(invlists, key, arranged_data);
 #else
                 InvertedLists::ScopedCodes scodes(
-                        invlists, key, arranged_codes.data());
+                        invlists, key, get_arranged_codes());
 #endif
 
                 std::unique_ptr<InvertedLists::ScopedIds> sids;
@@ -517,7 +519,8 @@ void IndexIVF::range_search_thread_safe(
         const size_t nprobe,
         const int parallel_mode,
         const size_t max_codes,
-        const BitsetView bitset) const {
+        const BitsetView bitset,
+        const InvertedListsSnapshot* snapshot) const {
     const size_t final_nprobe = std::min(nlist, nprobe);
     std::unique_ptr<idx_t[]> keys(new idx_t[nx * final_nprobe]);
     std::unique_ptr<float[]> coarse_dis(new float[nx * final_nprobe]);
@@ -531,6 +534,7 @@ void IndexIVF::range_search_thread_safe(
 
     IVFSearchParameters params =
             gen_search_param(final_nprobe, parallel_mode, max_codes);
+    params.snapshot = snapshot;
 
     range_search_preassigned(
             nx,
@@ -660,7 +664,7 @@ void IndexIVF::range_search_preassigned_without_codes(
                 InvertedLists::ScopedCodes scodes(invlists, key, arranged_data);
 #else
                 InvertedLists::ScopedCodes scodes(
-                        invlists, key, arranged_codes.data());
+                        invlists, key, get_arranged_codes());
 #endif
                 InvertedLists::ScopedIds ids(invlists, key);
 
@@ -9,6 +9,7 @@
 
 #include <faiss/invlists/InvertedLists.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <numeric>
 
@@ -313,6 +314,61 @@ InvertedLists* ArrayInvertedLists::to_readonly() {
 
 ArrayInvertedLists::~ArrayInvertedLists() {}
 
+/*****************************************************************
+ * ConcurrentArrayInvertedLists implementations
+ *****************************************************************/
+
+InvertedListsSnapshot::InvertedListsSnapshot(const InvertedLists* il)
+        : list_sizes(il->nlist) {
+    for (size_t i = 0; i < il->nlist; i++) {
+        list_sizes[i] = il->list_size(i);
+        ntotal += list_sizes[i];
+    }
+}
+
+template <typename T>
+ConcurrentArrayInvertedLists::SegmentList<T>::SegmentList(SegmentList&& other) noexcept
+        : table_(other.table_.load()),
+          size_(other.size_.load()),
+          capacity_(other.capacity_),
+          tables_(std::move(other.tables_)),
+          segments_(std::move(other.segments_)) {
+    other.table_.store(nullptr);
+    other.size_.store(0);
+    other.capacity_ = 0;
+}
+
+template <typename T>
+void ConcurrentArrayInvertedLists::SegmentList<T>::emplace_back(Segment<T>&& segment) {
+    size_t n = size_.load(std::memory_order_relaxed);
+    if (n == capacity_) {
+        size_t new_capacity = std::max(capacity_ * 2, size_t(4));
+        std::unique_ptr<Segment<T>*[]> table(new Segment<T>*[new_capacity]);
+        if (n > 0) {
+            std::copy(tables_.back().get(), tables_.back().get() + n, table.get());
+        }
+        table_.store(table.get(), std::memory_order_release);
+        tables_.push_back(std::move(table));
+        capacity_ = new_capacity;
+    }
+    // a segment retired by pop_back is taken back as is, the readers still scanning it keep valid memory
+    if (segments_.size() == n) {
+        segments_.push_back(std::make_unique<Segment<T>>(std::move(segment)));
+    }
+    tables_.back()[n] = segments_[n].get();
+    size_.store(n + 1, std::memory_order_release);
+}
+
+template <typename T>
+void ConcurrentArrayInvertedLists::SegmentList<T>::pop_back() {
+    // the segment is retired, not freed, a reader that loaded the old size may still be scanning it
+    size_.store(size_.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+}
+
+template struct ConcurrentArrayInvertedLists::SegmentList<uint8_t>;
+template struct ConcurrentArrayInvertedLists::SegmentList<InvertedLists::idx_t>;
+template struct ConcurrentArrayInvertedLists::SegmentList<float>;
+
 ConcurrentArrayInvertedLists::ConcurrentArrayInvertedLists(
         size_t nlist,
         size_t code_size,
@@ -874,6 +930,43 @@ void ReadOnlyInvertedLists::resize(size_t, size_t) {
     FAISS_THROW_MSG("not implemented");
 }
 
+/*****************************************
+ * MappedArrayInvertedLists implementation
+ ******************************************/
+
+MappedArrayInvertedLists::MappedArrayInvertedLists(
+        size_t nlist,
+        size_t code_size,
+        const uint8_t* codes,
+        const idx_t* ids,
+        const size_t* offsets,
+        std::shared_ptr<const void> storage)
+        : ReadOnlyInvertedLists(nlist, code_size),
+          codes(codes),
+          ids(ids),
+          offsets(offsets),
+          storage(std::move(storage)) {}
+
+size_t MappedArrayInvertedLists::list_size(size_t list_no) const {
+    assert(list_no < nlist);
+    return offsets[list_no + 1] - offsets[list_no];
+}
+
+const uint8_t* MappedArrayInvertedLists::get_codes(size_t list_no) const {
+    assert(list_no < nlist);
+    return codes + offsets[list_no] * code_size;
+}
+
+const InvertedLists::idx_t* MappedArrayInvertedLists::get_ids(
+        size_t list_no) const {
+    assert(list_no < nlist);
+    return ids + offsets[list_no];
+}
+
+bool MappedArrayInvertedLists::is_readonly() const {
+    return true;
+}
+
 /*****************************************
  * HStackInvertedLists implementation
  ******************************************/
@@ -336,7 +336,26 @@ struct ArrayInvertedLists : InvertedLists {
     ~ArrayInvertedLists() override;
 };
 
-// A Concurrent implementation for inverted lists
+/** Sizes of all lists captured at one point in time. A search given a
+ * snapshot scans only these prefixes, so entries appended afterwards stay
+ * invisible to it while writers keep adding.
+ */
+struct InvertedListsSnapshot {
+    std::vector<size_t> list_sizes;
+    size_t ntotal = 0;
+
+    InvertedListsSnapshot() = default;
+    explicit InvertedListsSnapshot(const InvertedLists* il);
+
+    size_t list_size(size_t list_no) const {
+        return list_sizes[list_no];
+    }
+};
+
+// A Concurrent implementation for inverted lists. A single writer may add
+// entries while any number of readers scan: data is published by the
+// list_cur increment that follows its copy, and readers only look below
+// the list_cur value they loaded.
 struct ConcurrentArrayInvertedLists : InvertedLists {
     template <typename T>
     struct Segment {
@@ -356,6 +375,43 @@ struct ConcurrentArrayInvertedLists : InvertedLists {
         std::vector<T> data_;
     };
 
+    /** Segments of one list, indexed by readers without locks while a
+     * single writer appends. A segment never moves once added, and the
+     * table of segment pointers is replaced by a copy twice as large when
+     * full. Replaced tables are retired rather than freed, so a reader
+     * still holding one keeps valid pointers; together they are never
+     * larger than the current table. Popped segments are retired the same
+     * way and reused by the next emplace_back, so a list holds at most its
+     * largest segment count until it is destroyed.
+     */
+    template <typename T>
+    struct SegmentList {
+        SegmentList() = default;
+        // only valid before the list is shared with readers
+        SegmentList(SegmentList&& other) noexcept;
+
+        Segment<T>& operator[](size_t segment_no) {
+            return *table_.load(std::memory_order_acquire)[segment_no];
+        }
+        const Segment<T>& operator[](size_t segment_no) const {
+            return *table_.load(std::memory_order_acquire)[segment_no];
+        }
+        size_t size() const {
+            return size_.load(std::memory_order_acquire);
+        }
+        void emplace_back(Segment<T>&& segment);
+        void pop_back();
+
+       private:
+        std::atomic<Segment<T>**> table_{nullptr};
+        std::atomic<size_t> size_{0};
+        size_t capacity_ = 0;
+        // the current table is the last one
+        std::vector<std::unique_ptr<Segment<T>*[]>> tables_;
+        // the live segments, then the retired ones past size_
+        std::vector<std::unique_ptr<Segment<T>>> segments_;
+    };
+
     ConcurrentArrayInvertedLists(size_t nlist, size_t code_size, size_t segment_size, bool save_normal);
 
     size_t cal_segment_num(size_t capacity) const;
@@ -410,9 +466,9 @@ struct ConcurrentArrayInvertedLists : InvertedLists {
     const size_t segment_size;
     const bool save_norm;
     std::vector<std::atomic<size_t>> list_cur;
-    std::vector<std::deque<Segment<uint8_t>>> codes;
-    std::vector<std::deque<Segment<idx_t>>> ids;
-    std::vector<std::deque<Segment<float>>> code_norms;
+    std::vector<SegmentList<uint8_t>> codes;
+    std::vector<SegmentList<idx_t>> ids;
+    std::vector<SegmentList<float>> code_norms;
 };
 
 struct ReadOnlyArrayInvertedLists: InvertedLists {
@@ -509,6 +565,31 @@ struct ReadOnlyInvertedLists : InvertedLists {
     void resize(size_t list_no, size_t new_size) override;
 };
 
+/// read-only lists over list-major codes and ids held in external memory,
+/// e.g. a file mapping whose pages are shared with other processes
+struct MappedArrayInvertedLists : ReadOnlyInvertedLists {
+    const uint8_t* codes;
+    const idx_t* ids;
+    /// nlist + 1 entries, list i holds entries [offsets[i], offsets[i + 1])
+    const size_t* offsets;
+    /// keeps the memory behind codes, ids and offsets alive
+    std::shared_ptr<const void> storage;
+
+    MappedArrayInvertedLists(
+            size_t nlist,
+            size_t code_size,
+            const uint8_t* codes,
+            const idx_t* ids,
+            const size_t* offsets,
+            std::shared_ptr<const void> storage);
+
+    size_t list_size(size_t list_no) const override;
+    const uint8_t* get_codes(size_t list_no) const override;
+    const idx_t* get_ids(size_t list_no) const override;
+
+    bool is_readonly() const override;
+};
+
 /// Horizontal stack of inverted lists
 struct HStackInvertedLists : ReadOnlyInvertedLists {
     std::vector<const InvertedLists*> ils;
@@ -17,12 +17,18 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <omp.h>
 
 #include <atomic>
 #include <list>
+#include <numeric>
 #include <random>
 #include <unordered_set>
 
+#include "faiss/Clustering.h"
+#include "faiss/impl/ProductQuantizer.h"
+#include "faiss/impl/ScalarQuantizer.h"
+#include "faiss/utils/distances.h"
 #include "hnswlib.h"
 #include "io/FaissIO.h"
 #include "knowhere/config.h"
@@ -40,6 +46,32 @@ typedef unsigned int tableint;
 typedef unsigned int linklistsizeint;
 constexpr float kHnswSearchKnnBFThreshold = 0.93f;
 constexpr float kHnswSearchRangeBFThreshold = 0.97f;
+// in place of the first upper link list size, which can't take this value, marks the read-only layout of the links
+constexpr unsigned int kHnswUpperLinksCsr = 0xFFFFFFFF;
+// upper link lists are carved out of blocks of at least this size
+constexpr size_t kHnswLinkBlockSize = 1 << 20;
+// share of the live elements marked deleted since the last repair above which the graph gets repaired
+constexpr float kHnswRepairDeletedRatio = 0.1f;
+// entry point centroids are trained on at most this many elements per centroid
+constexpr size_t kHnswEntryPointSamples = 256;
+// a search with entry points starts from those of this many centroids closest to the query
+constexpr size_t kHnswEntryPointSeeds = 4;
+// an NN-Descent build takes at least this many points, the kNN graph needs room to be sampled from
+constexpr size_t kHnswNNDescentMinRows = 1024;
+// an NN-Descent round joins this many of the new and as many of the old neighbors of each element
+constexpr size_t kHnswNNDescentSamples = 8;
+constexpr int kHnswNNDescentMaxRounds = 12;
+// NN-Descent joins this many elements between applying the updates they found
+constexpr size_t kHnswNNDescentJoinBlock = 1 << 14;
+// NN-Descent stops once a round updates fewer than this share of the kNN graph
+constexpr float kHnswNNDescentMinUpdates = 0.01f;
+
+// how a filtered search runs, see chooseSearchStrategy
+enum class SearchStrategy {
+    GRAPH = 0,
+    FILTERED_GRAPH = 1,
+    BRUTE_FORCE = 2,
+};
 
 enum Metric {
     L2 = 0,
@@ -50,6 +82,14 @@ enum Metric {
     UNKNOWN = 100,
 };
 
+// storage of the level 0 vectors, NONE keeps them as they were added
+enum class QuantType : int32_t {
+    NONE = 0,
+    SQ8 = 1,
+    FP16 = 2,
+    PQ = 3,
+};
+
 template <typename dist_t>
 class HierarchicalNSW : public AlgorithmInterface<dist_t> {
  public:
@@ -84,7 +124,6 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         max_elements_ = max_elements;
 
-        num_deleted_ = 0;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
         dist_func_param_ = s->get_dist_func_param();
@@ -137,13 +176,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     };
 
     ~HierarchicalNSW() {
-        free(data_level0_memory_);
-        if (metric_type_ == Metric::COSINE) {
-            free(data_norm_l2_);
-        }
-        for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
-                free(linkLists_[i]);
+        if (mmap_base_ != nullptr) {
+            munmap(mmap_base_, mmap_size_);
+        } else {
+            free(data_level0_memory_);
+            if (metric_type_ == Metric::COSINE) {
+                free(data_norm_l2_);
+            }
         }
         free(linkLists_);
         delete visited_list_pool_;
@@ -152,14 +191,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     // used for free resource
-    SpaceInterface<dist_t>* space_;
+    SpaceInterface<dist_t>* space_ = nullptr;
     size_t metric_type_;  // 0:L2, 1:IP, 2:COSINE
 
     size_t max_elements_;
     size_t cur_element_count;
     size_t size_data_per_element_;
     size_t size_links_per_element_;
-    size_t num_deleted_;
 
     size_t M_;
     size_t maxM_;
@@ -169,7 +207,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     double mult_, revSize_;
     int maxlevel_;
 
-    VisitedListPool* visited_list_pool_;
+    VisitedListPool* visited_list_pool_ = nullptr;
     std::mutex cur_element_count_guard_;
 
     std::vector<std::mutex> link_list_locks_;
@@ -183,11 +221,27 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     size_t size_links_level0_;
     size_t offsetData_, offsetLevel0_;
 
-    char* data_level0_memory_;
-    float* data_norm_l2_;  // vector's l2 norm
-    char** linkLists_;
+    char* data_level0_memory_ = nullptr;
+    float* data_norm_l2_ = nullptr;  // vector's l2 norm
+    char** linkLists_ = nullptr;
     std::vector<int> element_levels_;
 
+    // Arena of the upper link lists pointed to by linkLists_: lists are bump allocated from the last block, so there
+    // is a handful of allocations instead of one per element with a level above 0.
+    std::vector<std::unique_ptr<char[]>> link_blocks_;
+    size_t link_block_size_ = 0;
+    size_t link_block_used_ = 0;
+    size_t link_blocks_bytes_ = 0;
+    std::mutex link_blocks_lock_;
+
+    // Upper links in the read-only layout of a mapped index, in place of linkLists_ and element_levels_: the lists of
+    // element i follow each other from upper_links_ + upper_offsets_[i] up to the next element's offset.
+    const uint64_t* upper_offsets_ = nullptr;
+    const char* upper_links_ = nullptr;
+    // the whole index file of an index loaded with mmap, level 0, the norms and the upper links point into it
+    char* mmap_base_ = nullptr;
+    size_t mmap_size_ = 0;
+
     size_t data_size_;
 
     size_t label_offset_;
@@ -197,8 +251,100 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     std::default_random_engine level_generator_;
     std::default_random_engine update_probability_generator_;
 
+    // a quantized index keeps codes of code_size_ bytes in place of the vectors in level 0, and the vectors
+    // themselves, in id order, in refine_data_ when they are kept for re-ranking
+    QuantType quant_type_ = QuantType::NONE;
+    size_t code_size_ = 0;
+    std::unique_ptr<faiss::ScalarQuantizer> sq_;
+    std::unique_ptr<faiss::ProductQuantizer> pq_;
+    std::vector<float> refine_data_;
+
+    // labels of the internal ids and the other way around, both empty while the ids are the labels, i.e. until the
+    // graph is reordered
+    std::vector<labeltype> internal_to_label_;
+    std::vector<tableint> label_to_internal_;
+
+    // Elements marked deleted, by internal id, empty until the first one. Searches pass through them but never return
+    // them, and repairDeleted unlinks them from the live elements.
+    std::vector<bool> deleted_;
+    size_t num_deleted_ = 0;
+    size_t num_unrepaired_ = 0;
+
+    // Centroids of the data in entry_centroids_, entry_points_ holding the element closest to each. When there are
+    // some, a search starts level 0 from the elements of the centroids closest to the query, in place of descending
+    // the upper layers from enterpoint_node_.
+    std::vector<float> entry_centroids_;
+    std::vector<tableint> entry_points_;
+
     mutable knowhere::lru_cache<uint64_t, tableint> lru_cache;
 
+    inline bool
+    isMarkedDeleted(tableint internal_id) const {
+        return num_deleted_ > 0 && deleted_[internal_id];
+    }
+
+    // whether a search leaves the element out of its results
+    inline bool
+    isFiltered(tableint internal_id, const knowhere::BitsetView& bitset) const {
+        return (!bitset.empty() && bitset.test((int64_t)getExternalLabel(internal_id))) || isMarkedDeleted(internal_id);
+    }
+
+    inline bool
+    hasFilter(const knowhere::BitsetView& bitset) const {
+        return !bitset.empty() || num_deleted_ > 0;
+    }
+
+    // number of elements a search leaves out, the ones both filtered and deleted counted once
+    size_t
+    filteredCount(const knowhere::BitsetView& bitset) const {
+        if (bitset.empty()) {
+            return num_deleted_;
+        }
+        size_t count = bitset.count();
+        for (tableint i = 0, seen = 0; i < cur_element_count && seen < num_deleted_; ++i) {
+            if (deleted_[i]) {
+                ++seen;
+                count += !bitset.test((int64_t)getExternalLabel(i));
+            }
+        }
+        return std::min<size_t>(cur_element_count, count);
+    }
+
+    // whether the graph can still change, i.e. takes points, deletions repairs and updates
+    bool
+    isMutable() const {
+        return mmap_base_ == nullptr && quant_type_ == QuantType::NONE;
+    }
+
+    inline labeltype
+    getExternalLabel(tableint internal_id) const {
+        return internal_to_label_.empty() ? internal_id : internal_to_label_[internal_id];
+    }
+
+    inline tableint
+    getInternalId(labeltype label) const {
+        return label_to_internal_.empty() ? label : label_to_internal_[label];
+    }
+
+    // the elements to come in a reordered index keep their label as internal id
+    void
+    extendReorderMaps() {
+        for (auto i = internal_to_label_.size(); i < max_elements_; ++i) {
+            internal_to_label_.push_back(i);
+            label_to_internal_.push_back(i);
+        }
+    }
+
+    std::vector<std::pair<dist_t, labeltype>>
+    mapToLabels(std::vector<std::pair<dist_t, labeltype>> result) const {
+        if (!internal_to_label_.empty()) {
+            for (auto& [dist, id] : result) {
+                id = internal_to_label_[id];
+            }
+        }
+        return result;
+    }
+
     inline char*
     getDataByInternalId(tableint internal_id) const {
         return (data_level0_memory_ + internal_id * size_data_per_element_ + offsetData_);
@@ -229,9 +375,768 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         return dist;
     }
 
+    // distance of the stored vectors to one query, from the codes of a quantized index: an SQ distance computer
+    // or a PQ lookup table built once per query. Smaller is closer, as with calcDistance. An exact one reads the
+    // vectors kept for re-ranking instead.
+    class QueryDistance {
+     public:
+        QueryDistance(const HierarchicalNSW* index, const void* query, bool exact = false)
+            : index_(index), query_(query), exact_(exact) {
+            auto metric = index->metric_type_ == Metric::L2 ? faiss::METRIC_L2 : faiss::METRIC_INNER_PRODUCT;
+            if (exact) {
+                return;
+            } else if (index->sq_) {
+                sq_dc_.reset(index->sq_->get_distance_computer(metric));
+                sq_dc_->set_query((const float*)query);
+            } else if (index->pq_) {
+                pq_table_.resize(index->pq_->M * index->pq_->ksub);
+                if (metric == faiss::METRIC_L2) {
+                    index->pq_->compute_distance_table((const float*)query, pq_table_.data());
+                } else {
+                    index->pq_->compute_inner_prod_table((const float*)query, pq_table_.data());
+                }
+            }
+        }
+
+        dist_t
+        operator()(tableint id) const {
+            if (index_->quant_type_ == QuantType::NONE) {
+                return index_->calcDistance(query_, id);
+            } else if (exact_) {
+                return index_->calcRefineDistance(query_, id);
+            }
+            auto code = (const uint8_t*)index_->getDataByInternalId(id);
+            dist_t dist = 0;
+            if (sq_dc_) {
+                dist = sq_dc_->query_to_code(code);
+            } else {
+                auto ksub = index_->pq_->ksub;
+                for (size_t m = 0; m < index_->pq_->M; ++m) {
+                    dist += pq_table_[m * ksub + code[m]];
+                }
+            }
+            // codes of COSINE are of normalized vectors
+            return index_->metric_type_ == Metric::L2 ? dist : -dist;
+        }
+
+     private:
+        const HierarchicalNSW* index_;
+        const void* query_;
+        bool exact_;
+        std::unique_ptr<faiss::SQDistanceComputer> sq_dc_;
+        std::vector<float> pq_table_;
+    };
+
+    bool
+    hasRefineData() const {
+        return !refine_data_.empty();
+    }
+
+    // exact distance of a quantized index, from the vectors kept for re-ranking
+    inline dist_t
+    calcRefineDistance(const void* vec, const tableint id) const {
+        auto dim = *(size_t*)dist_func_param_;
+        dist_t dist = fstdistfunc_(vec, refine_data_.data() + id * dim, dist_func_param_);
+        if (metric_type_ == Metric::COSINE) {
+            dist /= data_norm_l2_[id];
+        }
+        return dist;
+    }
+
+    // the k closest of the candidates of a quantized search by their exact distances
+    std::vector<std::pair<dist_t, labeltype>>
+    rerank(const void* query_data, std::vector<std::pair<dist_t, labeltype>>& candidates, size_t k) const {
+        for (auto& [dist, id] : candidates) {
+            dist = calcRefineDistance(query_data, id);
+        }
+        auto len = std::min(k, candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + len, candidates.end());
+        candidates.resize(len);
+        return std::move(candidates);
+    }
+
+    // the vector of internal_id as it was added, decoded from its code when the index is quantized and keeps no
+    // vectors for re-ranking
+    void
+    copyDataByInternalId(tableint internal_id, char* dst) const {
+        if (quant_type_ == QuantType::NONE) {
+            memcpy(dst, getDataByInternalId(internal_id), data_size_);
+            return;
+        }
+        auto dim = *(size_t*)dist_func_param_;
+        if (hasRefineData()) {
+            memcpy(dst, refine_data_.data() + internal_id * dim, data_size_);
+            return;
+        }
+        auto code = (const uint8_t*)getDataByInternalId(internal_id);
+        if (sq_) {
+            sq_->decode(code, (float*)dst, 1);
+        } else {
+            pq_->decode(code, (float*)dst);
+        }
+        if (metric_type_ == Metric::COSINE) {
+            for (size_t i = 0; i < dim; ++i) {
+                ((float*)dst)[i] *= data_norm_l2_[internal_id];
+            }
+        }
+    }
+
+    // Replaces the vectors of the built graph by codes of `type`, searches compute asymmetric distances to the codes
+    // from then on. The vectors are kept aside for re-ranking the candidates when `refine` is set. A quantized index
+    // takes no more points.
+    void
+    quantize(QuantType type, size_t pq_m, bool refine) {
+        if (quant_type_ != QuantType::NONE || type == QuantType::NONE) {
+            throw std::runtime_error("HNSW index is already quantized");
+        }
+        if (metric_type_ != Metric::L2 && metric_type_ != Metric::INNER_PRODUCT && metric_type_ != Metric::COSINE) {
+            throw std::runtime_error("Quantized HNSW supports float metrics only");
+        }
+        auto dim = *(size_t*)dist_func_param_;
+        auto n = cur_element_count;
+        std::vector<float> xb(n * dim);
+        for (size_t i = 0; i < n; ++i) {
+            memcpy(xb.data() + i * dim, getDataByInternalId(i), data_size_);
+        }
+        if (refine) {
+            refine_data_ = xb;
+        }
+        if (metric_type_ == Metric::COSINE) {
+            for (size_t i = 0; i < n; ++i) {
+                knowhere::NormalizeVec(xb.data() + i * dim, dim);
+            }
+        }
+
+        if (type == QuantType::PQ) {
+            pq_ = std::make_unique<faiss::ProductQuantizer>(dim, pq_m, 8);
+            pq_->train(n, xb.data());
+            code_size_ = pq_->code_size;
+        } else {
+            sq_ = std::make_unique<faiss::ScalarQuantizer>(
+                dim, type == QuantType::SQ8 ? faiss::QuantizerType::QT_8bit : faiss::QuantizerType::QT_fp16);
+            sq_->train(n, xb.data());
+            code_size_ = sq_->code_size;
+        }
+        std::vector<uint8_t> codes(n * code_size_);
+        if (pq_) {
+            pq_->compute_codes(xb.data(), codes.data(), n);
+        } else {
+            sq_->compute_codes(xb.data(), codes.data(), n);
+        }
+
+        // links stay in front of each element, the code takes the place of the vector behind them
+        size_t size_data_per_element = size_links_level0_ + code_size_;
+        auto data_level0_memory = (char*)malloc(max_elements_ * size_data_per_element);  // NOLINT
+        if (data_level0_memory == nullptr) {
+            throw std::runtime_error("Not enough memory: quantize failed to allocate level0");
+        }
+        for (size_t i = 0; i < n; ++i) {
+            memcpy(data_level0_memory + i * size_data_per_element, get_linklist0(i), size_links_level0_);
+            memcpy(data_level0_memory + i * size_data_per_element + offsetData_, codes.data() + i * code_size_,
+                   code_size_);
+        }
+        free(data_level0_memory_);
+        data_level0_memory_ = data_level0_memory;
+        size_data_per_element_ = size_data_per_element;
+        quant_type_ = type;
+    }
+
+    // Level 0 elements in BFS order from the entry point, each component after the one before in id order. With rcm,
+    // the reverse Cuthill-McKee order instead: every BFS starts from the smallest degree element left, neighbors are
+    // queued by ascending degree, and the whole order is reversed.
+    std::vector<tableint>
+    getLocalityOrder(bool rcm) const {
+        auto n = cur_element_count;
+        std::vector<tableint> order;
+        if (n == 0) {
+            return order;
+        }
+        order.reserve(n);
+        std::vector<bool> queued(n, false);
+        std::vector<tableint> starts;
+        if (rcm) {
+            starts.resize(n);
+            std::iota(starts.begin(), starts.end(), 0);
+            std::stable_sort(starts.begin(), starts.end(), [&](tableint a, tableint b) {
+                return getListCount(get_linklist0(a)) < getListCount(get_linklist0(b));
+            });
+        } else {
+            starts.push_back(enterpoint_node_);
+            for (tableint i = 0; i < n; ++i) {
+                starts.push_back(i);
+            }
+        }
+        std::vector<tableint> neighbors;
+        for (auto start : starts) {
+            if (queued[start]) {
+                continue;
+            }
+            queued[start] = true;
+            order.push_back(start);
+            for (size_t head = order.size() - 1; head < order.size(); ++head) {
+                auto list = get_linklist0(order[head]);
+                auto data = (tableint*)(list + 1);
+                neighbors.assign(data, data + getListCount(list));
+                if (rcm) {
+                    std::stable_sort(neighbors.begin(), neighbors.end(), [&](tableint a, tableint b) {
+                        return getListCount(get_linklist0(a)) < getListCount(get_linklist0(b));
+                    });
+                }
+                for (auto v : neighbors) {
+                    if (!queued[v]) {
+                        queued[v] = true;
+                        order.push_back(v);
+                    }
+                }
+            }
+        }
+        if (rcm) {
+            std::reverse(order.begin(), order.end());
+        }
+        return order;
+    }
+
+    // Renumbers the elements in the given order, new_to_old[i] becoming internal id i, so that the level 0 blocks of
+    // neighbors sit close in memory. Labels keep identifying the elements in results and lookups.
+    void
+    reorder(const std::vector<tableint>& new_to_old) {
+        auto n = cur_element_count;
+        if (new_to_old.size() != n) {
+            throw std::runtime_error("HNSW reorder takes one new id per element");
+        }
+        // an empty index has no entry point to renumber
+        if (n == 0) {
+            return;
+        }
+        std::vector<tableint> old_to_new(n);
+        for (tableint i = 0; i < n; ++i) {
+            old_to_new[new_to_old[i]] = i;
+        }
+        auto remap = [&](linklistsizeint* list) {
+            auto data = (tableint*)(list + 1);
+            for (size_t j = 0; j < getListCount(list); ++j) {
+                data[j] = old_to_new[data[j]];
+            }
+        };
+
+        auto data_level0_memory = (char*)malloc(max_elements_ * size_data_per_element_);  // NOLINT
+        if (data_level0_memory == nullptr) {
+            throw std::runtime_error("Not enough memory: reorder failed to allocate level0");
+        }
+        std::vector<int> element_levels(max_elements_);
+        std::vector<labeltype> internal_to_label(n);
+        auto dim = *(size_t*)dist_func_param_;
+        std::vector<float> refine_data(refine_data_.size());
+        std::vector<float> data_norm_l2(metric_type_ == Metric::COSINE ? n : 0);
+        for (tableint i = 0; i < n; ++i) {
+            auto old = new_to_old[i];
+            memcpy(data_level0_memory + i * size_data_per_element_, get_linklist0(old), size_data_per_element_);
+            remap(get_linklist0(i, data_level0_memory));
+            element_levels[i] = element_levels_[old];
+            internal_to_label[i] = getExternalLabel(old);
+            if (!refine_data.empty()) {
+                memcpy(refine_data.data() + i * dim, refine_data_.data() + old * dim, dim * sizeof(float));
+            }
+            if (!data_norm_l2.empty()) {
+                data_norm_l2[i] = data_norm_l2_[old];
+            }
+        }
+        std::vector<char*> link_lists(n);
+        for (tableint i = 0; i < n; ++i) {
+            link_lists[i] = linkLists_[new_to_old[i]];
+            for (int level = 1; level <= element_levels[i]; ++level) {
+                remap((linklistsizeint*)(link_lists[i] + (level - 1) * size_links_per_element_));
+            }
+        }
+
+        free(data_level0_memory_);
+        data_level0_memory_ = data_level0_memory;
+        std::copy(link_lists.begin(), link_lists.end(), linkLists_);
+        element_levels_ = std::move(element_levels);
+        refine_data_ = std::move(refine_data);
+        std::copy(data_norm_l2.begin(), data_norm_l2.end(), data_norm_l2_);
+        enterpoint_node_ = old_to_new[enterpoint_node_];
+        for (auto& id : entry_points_) {
+            id = old_to_new[id];
+        }
+        compactLinkLists();
+        if (!deleted_.empty()) {
+            std::vector<bool> deleted(deleted_.size(), false);
+            for (tableint i = 0; i < n; ++i) {
+                deleted[i] = deleted_[new_to_old[i]];
+            }
+            deleted_ = std::move(deleted);
+        }
+        internal_to_label_ = std::move(internal_to_label);
+        label_to_internal_.resize(n);
+        for (tableint i = 0; i < n; ++i) {
+            label_to_internal_[internal_to_label_[i]] = i;
+        }
+        extendReorderMaps();
+    }
+
+    // Trains k centroids on a sample of the elements and maps each to the element closest to it. The vectors must still
+    // be in place, i.e. the index not quantized yet.
+    void
+    buildEntryPoints(size_t k) {
+        if (metric_type_ != Metric::L2 && metric_type_ != Metric::INNER_PRODUCT && metric_type_ != Metric::COSINE) {
+            throw std::runtime_error("HNSW entry points support float metrics only");
+        }
+        if (quant_type_ != QuantType::NONE) {
+            throw std::runtime_error("HNSW entry points are built before quantization");
+        }
+        auto n = cur_element_count;
+        k = std::min(k, n);
+        if (k == 0) {
+            entry_centroids_.clear();
+            entry_points_.clear();
+            return;
+        }
+        auto dim = *(size_t*)dist_func_param_;
+        size_t sample = std::min(n, k * kHnswEntryPointSamples);
+        std::vector<float> xs(sample * dim);
+        for (size_t i = 0; i < sample; ++i) {
+            auto x = xs.data() + i * dim;
+            memcpy(x, getDataByInternalId(i * n / sample), data_size_);
+            if (metric_type_ == Metric::COSINE) {
+                knowhere::NormalizeVec(x, dim);
+            }
+        }
+        std::vector<float> centroids(k * dim);
+        faiss::kmeans_clustering(dim, sample, k, xs.data(), centroids.data());
+        if (metric_type_ == Metric::COSINE) {
+            for (size_t c = 0; c < k; ++c) {
+                knowhere::NormalizeVec(centroids.data() + c * dim, dim);
+            }
+        }
+        entry_centroids_ = std::move(centroids);
+        mapEntryPoints();
+    }
+
+    // maps every centroid to the live element closest to it, found by a search from enterpoint_node_
+    void
+    mapEntryPoints() {
+        auto dim = *(size_t*)dist_func_param_;
+        auto k = entry_centroids_.size() / dim;
+        std::vector<tableint> entry_points(k, enterpoint_node_);
+        for (size_t c = 0; c < k; ++c) {
+            QueryDistance qdist(this, entry_centroids_.data() + c * dim);
+            auto candidates = searchBaseLayerST<true>({searchUpperLayers(qdist)}, qdist, ef_construction_, {});
+            for (auto& [dist, id] : candidates) {
+                if (!isMarkedDeleted(id)) {
+                    entry_points[c] = id;
+                    break;
+                }
+            }
+        }
+        entry_points_ = std::move(entry_points);
+    }
+
+    // the entry points of the kHnswEntryPointSeeds centroids closest to the query
+    std::vector<tableint>
+    closestEntryPoints(const float* query) const {
+        auto dim = *(size_t*)dist_func_param_;
+        auto k = entry_points_.size();
+        std::vector<float> dis(k);
+        if (metric_type_ == Metric::L2) {
+            faiss::fvec_L2sqr_ny(dis.data(), query, entry_centroids_.data(), dim, k);
+        } else {
+            faiss::fvec_inner_products_ny(dis.data(), query, entry_centroids_.data(), dim, k);
+            for (auto& d : dis) {
+                d = -d;
+            }
+        }
+        std::vector<size_t> order(k);
+        std::iota(order.begin(), order.end(), 0);
+        auto seeds = std::min(k, kHnswEntryPointSeeds);
+        std::partial_sort(order.begin(), order.begin() + seeds, order.end(),
+                          [&](size_t a, size_t b) { return dis[a] < dis[b]; });
+        std::vector<tableint> eps(seeds);
+        for (size_t i = 0; i < seeds; ++i) {
+            eps[i] = entry_points_[order[i]];
+        }
+        return eps;
+    }
+
+    template <typename W>
+    void
+    saveEntryPoints(W& output) const {
+        writeBinaryPOD(output, entry_points_.size());
+        if (!entry_points_.empty()) {
+            output.write(entry_centroids_.data(), entry_centroids_.size() * sizeof(float));
+            output.write(entry_points_.data(), entry_points_.size() * sizeof(tableint));
+        }
+    }
+
+    // indexes written before entry points were supported end right before this part
+    template <typename R>
+    void
+    loadEntryPoints(R& input) {
+        size_t k;
+        readBinaryPOD(input, k);
+        if (k == 0) {
+            return;
+        }
+        entry_centroids_.resize(k * *(size_t*)dist_func_param_);
+        entry_points_.resize(k);
+        input.read((char*)entry_centroids_.data(), entry_centroids_.size() * sizeof(float));
+        input.read((char*)entry_points_.data(), k * sizeof(tableint));
+    }
+
+    // zeroed room for size bytes of links in the arena
+    char*
+    allocLinkList(size_t size) {
+        std::lock_guard lock(link_blocks_lock_);
+        if (link_blocks_.empty() || link_block_used_ + size > link_block_size_) {
+            link_block_size_ = std::max(kHnswLinkBlockSize, size);
+            link_blocks_.emplace_back(new char[link_block_size_]());
+            link_block_used_ = 0;
+            link_blocks_bytes_ += link_block_size_;
+        }
+        auto list = link_blocks_.back().get() + link_block_used_;
+        link_block_used_ += size;
+        return list;
+    }
+
+    // Moves the upper links into a single block, in the order of the elements, which drops the room left at the end
+    // of the blocks and lets saveLinkLists write them at once. Not thread-safe.
+    void
+    compactLinkLists() {
+        size_t total = 0;
+        for (tableint i = 0; i < cur_element_count; ++i) {
+            total += size_links_per_element_ * element_levels_[i];
+        }
+        if (total == 0 || (link_blocks_.size() == 1 && link_block_size_ == total && isLinkListsContiguous())) {
+            return;
+        }
+        std::unique_ptr<char[]> block(new char[total]);
+        size_t offset = 0;
+        for (tableint i = 0; i < cur_element_count; ++i) {
+            if (element_levels_[i] > 0) {
+                auto size = size_links_per_element_ * element_levels_[i];
+                memcpy(block.get() + offset, linkLists_[i], size);
+                linkLists_[i] = block.get() + offset;
+                offset += size;
+            }
+        }
+        link_blocks_.clear();
+        link_blocks_.emplace_back(std::move(block));
+        link_block_size_ = link_block_used_ = link_blocks_bytes_ = total;
+    }
+
+    // whether the upper links lie back to back in the order of the elements
+    bool
+    isLinkListsContiguous() const {
+        const char* next = nullptr;
+        for (tableint i = 0; i < cur_element_count; ++i) {
+            if (auto level = elementLevel(i); level > 0) {
+                auto list = (const char*)get_linklist(i, 1);
+                if (next != nullptr && list != next) {
+                    return false;
+                }
+                next = list + size_links_per_element_ * level;
+            }
+        }
+        return true;
+    }
+
+    // The upper links go out in the read-only layout: the marker, zeros up to an 8 bytes boundary of the file, the
+    // (n + 1) offsets of the elements' lists and then the lists back to back, so that a mapped file serves them as is.
+    void
+    saveLinkLists(knowhere::MemoryIOWriter& output) const {
+        if (cur_element_count == 0) {
+            return;
+        }
+        writeBinaryPOD(output, kHnswUpperLinksCsr);
+        char padding[sizeof(uint64_t)] = {};
+        if (auto misalign = output.rp % sizeof(uint64_t)) {
+            output.write(padding, sizeof(uint64_t) - misalign);
+        }
+        std::vector<uint64_t> offsets(cur_element_count + 1, 0);
+        for (tableint i = 0; i < cur_element_count; ++i) {
+            offsets[i + 1] = offsets[i] + size_links_per_element_ * elementLevel(i);
+        }
+        output.write(offsets.data(), offsets.size() * sizeof(uint64_t));
+        if (offsets.back() == 0) {
+            return;
+        }
+        if (isLinkListsContiguous()) {
+            tableint first = 0;
+            while (elementLevel(first) == 0) {
+                ++first;
+            }
+            output.write(get_linklist(first, 1), offsets.back());
+            return;
+        }
+        for (tableint i = 0; i < cur_element_count; ++i) {
+            if (auto level = elementLevel(i); level > 0) {
+                output.write(get_linklist(i, 1), size_links_per_element_ * level);
+            }
+        }
+    }
+
+    // reads the upper links into the arena, in the read-only layout, as a single block with a single read, or in the
+    // per element one of older indexes, pos is where they start in the input
+    template <typename R>
+    void
+    loadLinkLists(R& input, size_t pos) {
+        linkLists_ = (char**)malloc(sizeof(void*) * max_elements_);  // NOLINT
+        if (linkLists_ == nullptr) {
+            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
+        }
+        element_levels_ = std::vector<int>(max_elements_);
+        if (cur_element_count == 0) {
+            return;
+        }
+        unsigned int linkListSize;
+        readBinaryPOD(input, linkListSize);
+        if (linkListSize != kHnswUpperLinksCsr) {
+            for (tableint i = 0; i < cur_element_count; ++i) {
+                if (i > 0) {
+                    readBinaryPOD(input, linkListSize);
+                }
+                element_levels_[i] = linkListSize / size_links_per_element_;
+                linkLists_[i] = nullptr;
+                if (linkListSize > 0) {
+                    linkLists_[i] = allocLinkList(linkListSize);
+                    input.read(linkLists_[i], linkListSize);
+                }
+            }
+            return;
+        }
+        pos += sizeof(linkListSize);
+        if (auto misalign = pos % sizeof(uint64_t)) {
+            char padding[sizeof(uint64_t)];
+            input.read(padding, sizeof(uint64_t) - misalign);
+        }
+        std::vector<uint64_t> offsets(cur_element_count + 1);
+        input.read((char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+        char* block = nullptr;
+        if (offsets.back() > 0) {
+            block = allocLinkList(offsets.back());
+            input.read(block, offsets.back());
+        }
+        for (tableint i = 0; i < cur_element_count; ++i) {
+            element_levels_[i] = (offsets[i + 1] - offsets[i]) / size_links_per_element_;
+            linkLists_[i] = element_levels_[i] > 0 ? block + offsets[i] : nullptr;
+        }
+    }
+
+    template <typename W>
+    void
+    saveReorder(W& output) const {
+        // the tail of the maps is room for the elements to come
+        size_t size = std::min<size_t>(internal_to_label_.size(), cur_element_count);
+        writeBinaryPOD(output, size);
+        if (size > 0) {
+            output.write(internal_to_label_.data(), size * sizeof(labeltype));
+        }
+    }
+
+    // indexes written before reordering was supported end right before this part
+    template <typename R>
+    void
+    loadReorder(R& input) {
+        size_t size;
+        readBinaryPOD(input, size);
+        if (size == 0) {
+            return;
+        }
+        internal_to_label_.resize(size);
+        input.read((char*)internal_to_label_.data(), size * sizeof(labeltype));
+        label_to_internal_.resize(size);
+        for (tableint i = 0; i < size; ++i) {
+            label_to_internal_[internal_to_label_[i]] = i;
+        }
+        extendReorderMaps();
+    }
+
+    template <typename W>
+    void
+    saveDeleted(W& output) const {
+        std::vector<tableint> deleted;
+        deleted.reserve(num_deleted_);
+        for (tableint i = 0; i < cur_element_count && deleted.size() < num_deleted_; ++i) {
+            if (deleted_[i]) {
+                deleted.push_back(i);
+            }
+        }
+        writeBinaryPOD(output, deleted.size());
+        writeBinaryPOD(output, num_unrepaired_);
+        if (!deleted.empty()) {
+            output.write(deleted.data(), deleted.size() * sizeof(tableint));
+        }
+    }
+
+    // indexes written before deletion was supported end right before this part
+    template <typename R>
+    void
+    loadDeleted(R& input) {
+        size_t size;
+        readBinaryPOD(input, size);
+        readBinaryPOD(input, num_unrepaired_);
+        if (size == 0) {
+            return;
+        }
+        std::vector<tableint> deleted(size);
+        input.read((char*)deleted.data(), size * sizeof(tableint));
+        deleted_.assign(max_elements_, false);
+        for (auto id : deleted) {
+            deleted_[id] = true;
+        }
+        num_deleted_ = size;
+    }
+
+    // Search results leave the element out from then on, the graph keeps it for routing until repairDeleted.
+    void
+    markDeleted(tableint internal_id) {
+        if (internal_id >= cur_element_count) {
+            throw std::runtime_error("Can not delete an element that is not in the HNSW index");
+        }
+        if (deleted_.size() < max_elements_) {
+            deleted_.resize(max_elements_, false);
+        }
+        if (!deleted_[internal_id]) {
+            deleted_[internal_id] = true;
+            num_deleted_++;
+            num_unrepaired_++;
+        }
+    }
+
+    // whether enough elements were deleted since the last repair for the graph to need one
+    bool
+    needsRepair() const {
+        return isMutable() && num_unrepaired_ > (cur_element_count - num_deleted_) * kHnswRepairDeletedRatio;
+    }
+
+    // Unlinks the deleted elements: every list of a live element that holds some is rebuilt from its live neighbors
+    // and the live neighbors of its deleted ones, much as updatePoint does for the neighbors of an updated element,
+    // and the live elements left without any neighbor at level 0 are connected again with repairConnectionsForUpdate.
+    // The entry point moves to a live element of the highest level if it was deleted.
+    void
+    repairDeleted() {
+        if (!isMutable()) {
+            throw std::runtime_error("Can not repair a read-only HNSW index");
+        }
+        if (num_unrepaired_ == 0 || num_deleted_ == cur_element_count) {
+            return;
+        }
+        if (isMarkedDeleted(enterpoint_node_)) {
+            int maxlevel = -1;
+            for (tableint i = 0; i < cur_element_count; ++i) {
+                if (!isMarkedDeleted(i) && elementLevel(i) > maxlevel) {
+                    maxlevel = elementLevel(i);
+                    enterpoint_node_ = i;
+                }
+            }
+            maxlevel_ = maxlevel;
+        }
+
+        std::vector<tableint> isolated;
+        std::mutex isolated_mutex;
+#pragma omp parallel for schedule(dynamic, 256)
+        for (tableint i = 0; i < cur_element_count; ++i) {
+            if (isMarkedDeleted(i)) {
+                continue;
+            }
+            for (int level = 0; level <= elementLevel(i); ++level) {
+                auto neighbors = getConnectionsWithLock(i, level);
+                if (std::none_of(neighbors.begin(), neighbors.end(), [&](tableint v) { return isMarkedDeleted(v); })) {
+                    continue;
+                }
+                std::unordered_set<tableint> sCand;
+                for (auto v : neighbors) {
+                    if (!isMarkedDeleted(v)) {
+                        sCand.insert(v);
+                        continue;
+                    }
+                    for (auto w : getConnectionsWithLock(v, level)) {
+                        if (w != i && !isMarkedDeleted(w)) {
+                            sCand.insert(w);
+                        }
+                    }
+                }
+                // the heuristic alone leaves too few links once a good share of the graph is gone
+                if (relinkElement(i, sCand, level, true) == 0 && level == 0) {
+                    std::lock_guard lock(isolated_mutex);
+                    isolated.push_back(i);
+                }
+            }
+        }
+        for (auto id : isolated) {
+            repairConnectionsForUpdate(getDataByInternalId(id), enterpoint_node_, id, elementLevel(id), maxlevel_);
+        }
+        // deleted entry points are out of the graph now
+        if (std::any_of(entry_points_.begin(), entry_points_.end(), [&](tableint id) { return isMarkedDeleted(id); })) {
+            mapEntryPoints();
+        }
+        num_unrepaired_ = 0;
+    }
+
+    template <typename W>
+    void
+    saveQuantizer(W& output) const {
+        writeBinaryPOD(output, quant_type_);
+        if (quant_type_ == QuantType::NONE) {
+            return;
+        }
+        writeBinaryPOD(output, code_size_);
+        if (sq_) {
+            writeBinaryPOD(output, sq_->qtype);
+            writeBinaryPOD(output, sq_->rangestat);
+            writeBinaryPOD(output, sq_->rangestat_arg);
+            writeBinaryPOD(output, sq_->trained.size());
+            output.write(sq_->trained.data(), sq_->trained.size() * sizeof(float));
+        } else {
+            writeBinaryPOD(output, pq_->M);
+            writeBinaryPOD(output, pq_->nbits);
+            output.write(pq_->centroids.data(), pq_->centroids.size() * sizeof(float));
+        }
+        writeBinaryPOD(output, refine_data_.size());
+        output.write(refine_data_.data(), refine_data_.size() * sizeof(float));
+    }
+
+    // indexes written before quantization was supported end right before this part
+    template <typename R>
+    void
+    loadQuantizer(R& input) {
+        auto dim = *(size_t*)dist_func_param_;
+        readBinaryPOD(input, quant_type_);
+        if (quant_type_ == QuantType::NONE) {
+            return;
+        }
+        readBinaryPOD(input, code_size_);
+        if (quant_type_ == QuantType::PQ) {
+            size_t M, nbits;
+            readBinaryPOD(input, M);
+            readBinaryPOD(input, nbits);
+            pq_ = std::make_unique<faiss::ProductQuantizer>(dim, M, nbits);
+            input.read((char*)pq_->centroids.data(), pq_->centroids.size() * sizeof(float));
+        } else {
+            faiss::QuantizerType qtype;
+            readBinaryPOD(input, qtype);
+            sq_ = std::make_unique<faiss::ScalarQuantizer>(dim, qtype);
+            readBinaryPOD(input, sq_->rangestat);
+            readBinaryPOD(input, sq_->rangestat_arg);
+            size_t trained_size;
+            readBinaryPOD(input, trained_size);
+            sq_->trained.resize(trained_size);
+            // an fp16 quantizer has no trained values
+            if (trained_size > 0) {
+                input.read((char*)sq_->trained.data(), trained_size * sizeof(float));
+            }
+        }
+        size_t refine_size;
+        readBinaryPOD(input, refine_size);
+        if (refine_size > 0) {
+            refine_data_.resize(refine_size);
+            input.read((char*)refine_data_.data(), refine_size * sizeof(float));
+        }
+    }
+
     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
     searchBaseLayer(tableint ep_id, tableint cur_c, int layer) {
-        auto& visited = visited_list_pool_->getFreeVisitedList();
+        auto visited = visited_list_pool_->getFreeVisitedList();
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
             top_candidates;
@@ -243,8 +1148,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         top_candidates.emplace(dist, ep_id);
         lowerBound = dist;
         candidateSet.emplace(-dist, ep_id);
-        visited[ep_id] = true;
+        visited->set(ep_id);
 
+        // neighbors are copied out under the lock and their distances computed without it, concurrent insertions
+        // only wait for the copy
+        std::vector<tableint> neighbors(std::max(maxM0_, maxM_));
         while (!candidateSet.empty()) {
             std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
             if ((-curr_el_pair.first) > lowerBound && top_candidates.size() == ef_construction_) {
@@ -254,17 +1162,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
             tableint curNodeNum = curr_el_pair.second;
 
-            std::unique_lock<std::mutex> lock(link_list_locks_[curNodeNum]);
-
-            int* data;  // = (int *)(linkList0_ + curNodeNum * size_links_per_element0_);
-            if (layer == 0) {
-                data = (int*)get_linklist0(curNodeNum);
-            } else {
-                data = (int*)get_linklist(curNodeNum, layer);
-                // data = (int *) (linkLists_[curNodeNum] + (layer - 1) * size_links_per_element_);
+            size_t size;
+            {
+                std::unique_lock<std::mutex> lock(link_list_locks_[curNodeNum]);
+                linklistsizeint* data = get_linklist_at_level(curNodeNum, layer);
+                size = getListCount(data);
+                memcpy(neighbors.data(), data + 1, size * sizeof(tableint));
             }
-            size_t size = getListCount((linklistsizeint*)data);
-            tableint* datal = (tableint*)(data + 1);
+            tableint* datal = neighbors.data();
 #if defined(USE_PREFETCH)
             for (size_t j = 0; j < size; ++j) {
                 _mm_prefetch(getDataByInternalId(datal[j]), _MM_HINT_T0);
@@ -273,10 +1178,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             for (size_t j = 0; j < size; j++) {
                 tableint candidate_id = *(datal + j);
                 // if (candidate_id == 0) continue;
-                if (visited[candidate_id]) {
+                if (visited->get(candidate_id)) {
                     continue;
                 }
-                visited[candidate_id] = true;
+                visited->set(candidate_id);
 
                 dist_t dist1 = calcDistance(cur_c, candidate_id);
                 if (top_candidates.size() < ef_construction_ || lowerBound > dist1) {
@@ -302,28 +1207,37 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     mutable std::atomic<long> metric_distance_computations;
     mutable std::atomic<long> metric_hops;
 
-    template <bool has_deletions, bool collect_metrics = false>
+    // With filter_aware, filtered elements take no place among the candidates: a filtered neighbor is passed through
+    // to its own unfiltered neighbors, at most maxM0_ of them per expanded element, so the ef candidates are all
+    // results even when most of the graph is filtered out. The search starts from all of the entry points eps.
+    template <bool has_deletions, bool collect_metrics = false, bool filter_aware = false>
     std::vector<std::pair<dist_t, tableint>>
-    searchBaseLayerST(tableint ep_id, const void* data_point, size_t ef, const knowhere::BitsetView bitset,
+    searchBaseLayerST(const std::vector<tableint>& eps, const QueryDistance& qdist, size_t ef,
+                      const knowhere::BitsetView bitset,
                       const knowhere::feder::hnsw::FederResultUniq& feder_result = nullptr) const {
         if (feder_result != nullptr) {
             feder_result->visit_info_.AddLevelVisitRecord(0);
         }
-        auto& visited = visited_list_pool_->getFreeVisitedList();
+        auto visited = visited_list_pool_->getFreeVisitedList();
         NeighborSet retset(ef);
 
-        if (!has_deletions || !bitset.test((int64_t)ep_id)) {
-            dist_t dist = calcDistance(data_point, ep_id);
-            retset.insert(Neighbor(ep_id, dist, Neighbor::kValid));
-        } else {
-            retset.insert(Neighbor(ep_id, std::numeric_limits<dist_t>::max(), Neighbor::kInvalid));
+        for (auto ep_id : eps) {
+            if (visited->get(ep_id)) {
+                continue;
+            }
+            if (!has_deletions || !isFiltered(ep_id, bitset)) {
+                dist_t dist = qdist(ep_id);
+                retset.insert(Neighbor(ep_id, dist, Neighbor::kValid));
+            } else {
+                retset.insert(Neighbor(ep_id, std::numeric_limits<dist_t>::max(), Neighbor::kInvalid));
+            }
+            visited->set(ep_id);
         }
-
-        visited[ep_id] = true;
         while (retset.has_next()) {
             auto [u, d, s] = retset.pop();
             tableint* list = (tableint*)get_linklist0(u);
             int size = list[0];
+            size_t expanded = 0;
 
             if constexpr (collect_metrics) {
                 metric_hops++;
@@ -336,7 +1250,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 }
 #endif
                 tableint v = list[i];
-                if (visited[v]) {
+                if (visited->get(v)) {
                     if (feder_result != nullptr) {
                         feder_result->visit_info_.AddVisitRecord(0, u, v, -1.0);
                         feder_result->id_set_.insert(u);
@@ -344,15 +1258,34 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     }
                     continue;
                 }
-                visited[v] = true;
-                dist_t dist = calcDistance(data_point, v);
+                visited->set(v);
+                if constexpr (filter_aware) {
+                    if (isFiltered(v, bitset)) {
+                        tableint* hop = (tableint*)get_linklist0(v);
+                        for (size_t j = 1; j <= hop[0] && expanded < maxM0_; ++j) {
+                            tableint w = hop[j];
+                            if (visited->get(w) || isFiltered(w, bitset)) {
+                                continue;
+                            }
+                            visited->set(w);
+                            expanded++;
+                            if constexpr (collect_metrics) {
+                                metric_distance_computations++;
+                            }
+                            retset.insert(Neighbor(w, qdist(w), Neighbor::kValid));
+                        }
+                        continue;
+                    }
+                    expanded++;
+                }
+                dist_t dist = qdist(v);
                 if (feder_result != nullptr) {
                     feder_result->visit_info_.AddVisitRecord(0, u, v, dist);
                     feder_result->id_set_.insert(u);
                     feder_result->id_set_.insert(v);
                 }
                 int status = Neighbor::kValid;
-                if (has_deletions && bitset.test((int64_t)v)) {
+                if (has_deletions && isFiltered(v, bitset)) {
                     status = Neighbor::kInvalid;
                 }
 
@@ -415,10 +1348,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     std::vector<std::pair<dist_t, labeltype>>
-    getNeighboursWithinRadius(std::vector<std::pair<dist_t, tableint>>& top_candidates, const void* data_point,
+    getNeighboursWithinRadius(std::vector<std::pair<dist_t, tableint>>& top_candidates, const QueryDistance& qdist,
                               float radius, const knowhere::BitsetView bitset) const {
         std::vector<std::pair<dist_t, labeltype>> result;
-        auto& visited = visited_list_pool_->getFreeVisitedList();
+        auto visited = visited_list_pool_->getFreeVisitedList();
 
         std::queue<std::pair<dist_t, tableint>> radius_queue;
         while (!top_candidates.empty()) {
@@ -428,7 +1361,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 radius_queue.push(cand);
                 result.emplace_back(cand.first, cand.second);
             }
-            visited[cand.second] = true;
+            visited->set(cand.second);
         }
 
         while (!radius_queue.empty()) {
@@ -446,10 +1379,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 #endif
             for (size_t j = 1; j <= size; j++) {
                 int candidate_id = *(data + j);
-                if (!visited[candidate_id]) {
-                    visited[candidate_id] = true;
-                    if (bitset.empty() || !bitset.test((int64_t)candidate_id)) {
-                        dist_t dist = calcDistance(data_point, candidate_id);
+                if (!visited->get(candidate_id)) {
+                    visited->set(candidate_id);
+                    if (!isFiltered(candidate_id, bitset)) {
+                        dist_t dist = qdist(candidate_id);
                         if (dist < radius) {
                             radius_queue.push({dist, candidate_id});
                             result.emplace_back(dist, candidate_id);
@@ -474,9 +1407,21 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     linklistsizeint*
     get_linklist(tableint internal_id, int level) const {
+        if (upper_links_ != nullptr) {
+            return (linklistsizeint*)(upper_links_ + upper_offsets_[internal_id] +
+                                      (level - 1) * size_links_per_element_);
+        }
         return (linklistsizeint*)(linkLists_[internal_id] + (level - 1) * size_links_per_element_);
     };
 
+    int
+    elementLevel(tableint internal_id) const {
+        if (upper_offsets_ != nullptr) {
+            return (upper_offsets_[internal_id + 1] - upper_offsets_[internal_id]) / size_links_per_element_;
+        }
+        return element_levels_[internal_id];
+    }
+
     linklistsizeint*
     get_linklist_at_level(tableint internal_id, int level) const {
         return level == 0 ? get_linklist0(internal_id) : get_linklist(internal_id, level);
@@ -601,6 +1546,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     resizeIndex(size_t new_max_elements) {
         if (new_max_elements < cur_element_count)
             throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
+        if (mmap_base_ != nullptr)
+            throw std::runtime_error("Cannot resize a mapped index");
 
         delete visited_list_pool_;
         visited_list_pool_ = new VisitedListPool(new_max_elements);
@@ -630,6 +1577,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         linkLists_ = linkLists_new;
 
         max_elements_ = new_max_elements;
+        if (!deleted_.empty()) {
+            deleted_.resize(max_elements_, false);
+        }
+        if (!internal_to_label_.empty()) {
+            extendReorderMaps();
+        }
     }
 
     void
@@ -655,6 +1608,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         } else {
             throw std::runtime_error("Invalid metric type " + std::to_string(metric_type_));
         }
+        fstdistfunc_ = space_->get_dist_func();
+        dist_func_param_ = space_->get_dist_func_param();
 
         readBinaryPOD(input, offsetLevel0_);
         readBinaryPOD(input, max_elements_);
@@ -677,21 +1632,60 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         readBinaryPOD(input, mult_);
         readBinaryPOD(input, ef_construction_);
 
-        auto pos = input.offset();
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+        revSize_ = 1.0 / mult_;
+        ef_ = 10;
+
+        size_t pos = input.offset();
 
         if (cfg.enable_mmap) {
-            // For HNSW, we only mmap the data part, but not the linked lists,
-            // which affects the performance significantly
-            data_level0_memory_ =
-                (char*)mmap(nullptr, max_elements * size_data_per_element_, PROT_READ, MAP_PRIVATE, input.fd, pos);
-            input.advance(max_elements * size_data_per_element_);
+            // The whole file is mapped once and the index is served from it, links included. It is read-only, so
+            // there are no locks nor a table of the upper links to allocate when the links are in the read-only
+            // layout.
+            max_elements_ = cur_element_count;
+            void* base = mmap(nullptr, input.size, PROT_READ, MAP_PRIVATE, input.fd, 0);
+            if (base == MAP_FAILED) {
+                throw std::runtime_error("Failed to mmap the HNSW index file " + location);
+            }
+            mmap_base_ = (char*)base;
+            mmap_size_ = input.size;
+            data_level0_memory_ = mmap_base_ + pos;
+            pos += cur_element_count * size_data_per_element_;
 
             // for COSINE, need load data_norm_l2_
             if (metric_type_ == Metric::COSINE) {
-                data_norm_l2_ =
-                    (float*)mmap(nullptr, max_elements * sizeof(float), PROT_READ, MAP_PRIVATE, input.fd, pos);
-                input.advance(max_elements * sizeof(float));
+                data_norm_l2_ = (float*)(mmap_base_ + pos);
+                pos += cur_element_count * sizeof(float);
             }
+            visited_list_pool_ = new VisitedListPool(max_elements_);
+
+            if (cur_element_count > 0 && *(const unsigned int*)(mmap_base_ + pos) == kHnswUpperLinksCsr) {
+                pos += sizeof(kHnswUpperLinksCsr);
+                pos = (pos + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+                upper_offsets_ = (const uint64_t*)(mmap_base_ + pos);
+                pos += (cur_element_count + 1) * sizeof(uint64_t);
+                upper_links_ = mmap_base_ + pos;
+                pos += upper_offsets_[cur_element_count];
+                input.seek(pos);
+            } else {
+                input.seek(pos);
+                loadLinkLists(input, pos);
+            }
+            if (input.offset() < input.size) {
+                loadQuantizer(input);
+            }
+            if (input.offset() < input.size) {
+                loadReorder(input);
+            }
+            if (input.offset() < input.size) {
+                loadDeleted(input);
+            }
+            if (input.offset() < input.size) {
+                loadEntryPoints(input);
+            }
+            input.close();
+            return;
         } else {
             data_level0_memory_ = (char*)malloc(max_elements * size_data_per_element_);  // NOLINT
             input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
@@ -703,34 +1697,22 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             }
         }
 
-        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
-
-        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
         std::vector<std::mutex>(max_elements).swap(link_list_locks_);
 
         visited_list_pool_ = new VisitedListPool(max_elements);
 
-        linkLists_ = (char**)malloc(sizeof(void*) * max_elements);  // NOLINT
-        if (linkLists_ == nullptr) {
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
+        loadLinkLists(input, input.offset());
+        if (input.offset() < input.size) {
+            loadQuantizer(input);
         }
-        element_levels_ = std::vector<int>(max_elements);
-        revSize_ = 1.0 / mult_;
-        ef_ = 10;
-        for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize == 0) {
-                element_levels_[i] = 0;
-                linkLists_[i] = nullptr;
-            } else {
-                element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char*)malloc(linkListSize);
-                if (linkLists_[i] == nullptr) {
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-                }
-                input.read(linkLists_[i], linkListSize);
-            }
+        if (input.offset() < input.size) {
+            loadReorder(input);
+        }
+        if (input.offset() < input.size) {
+            loadDeleted(input);
+        }
+        if (input.offset() < input.size) {
+            loadEntryPoints(input);
         }
 
         // split
@@ -766,12 +1748,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             output.write(data_norm_l2_, cur_element_count * sizeof(float));
         }
 
-        for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
-            writeBinaryPOD(output, linkListSize);
-            if (linkListSize)
-                output.write(linkLists_[i], linkListSize);
-        }
+        saveLinkLists(output);
+        saveQuantizer(output);
+        saveReorder(output);
+        saveDeleted(output);
+        saveEntryPoints(output);
         // output.close();
     }
 
@@ -839,25 +1820,20 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         visited_list_pool_ = new VisitedListPool(max_elements);
 
-        linkLists_ = (char**)malloc(sizeof(void*) * max_elements);
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
-        element_levels_ = std::vector<int>(max_elements);
         revSize_ = 1.0 / mult_;
         ef_ = 10;
-        for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize == 0) {
-                element_levels_[i] = 0;
-                linkLists_[i] = nullptr;
-            } else {
-                element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char*)malloc(linkListSize);
-                if (linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-                input.read(linkLists_[i], linkListSize);
-            }
+        loadLinkLists(input, input.rp);
+        if (input.rp < input.total) {
+            loadQuantizer(input);
+        }
+        if (input.rp < input.total) {
+            loadReorder(input);
+        }
+        if (input.rp < input.total) {
+            loadDeleted(input);
+        }
+        if (input.rp < input.total) {
+            loadEntryPoints(input);
         }
     }
 
@@ -913,51 +1889,66 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             }
 
             for (auto&& neigh : sNeigh) {
-                // if (neigh == internalId)
-                //     continue;
-
-                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>,
-                                    CompareByFirst>
-                    candidates;
-                size_t size = sCand.find(neigh) == sCand.end()
-                                  ? sCand.size()
-                                  : sCand.size() - 1;  // sCand guaranteed to have size >= 1
-                size_t elementsToKeep = std::min(ef_construction_, size);
-                for (auto&& cand : sCand) {
-                    if (cand == neigh)
-                        continue;
+                relinkElement(neigh, sCand, layer);
+            }
+        }
 
-                    dist_t distance = calcDistance(neigh, cand);
-                    if (candidates.size() < elementsToKeep) {
-                        candidates.emplace(distance, cand);
-                    } else {
-                        if (distance < candidates.top().first) {
-                            candidates.pop();
-                            candidates.emplace(distance, cand);
-                        }
-                    }
-                }
+        repairConnectionsForUpdate(dataPoint, entryPointCopy, internalId, elemLevel, maxLevelCopy);
+    };
 
-                // Retrieve neighbours using heuristic and set connections.
-                getNeighborsByHeuristic2(candidates, layer == 0 ? maxM0_ : maxM_);
+    // Sets the links of the element at the layer to the ones the heuristic picks among the ef_construction_ closest
+    // candidates, the element itself left out, and returns how many there are. With keep_pruned, the closest of the
+    // candidates the heuristic passed over take the links left.
+    size_t
+    relinkElement(tableint neigh, const std::unordered_set<tableint>& sCand, int layer, bool keep_pruned = false) {
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+            candidates;
+        size_t size = sCand.find(neigh) == sCand.end() ? sCand.size() : sCand.size() - 1;
+        size_t elementsToKeep = std::min(ef_construction_, size);
+        for (auto&& cand : sCand) {
+            if (cand == neigh)
+                continue;
 
-                {
-                    std::unique_lock<std::mutex> lock(link_list_locks_[neigh]);
-                    linklistsizeint* ll_cur;
-                    ll_cur = get_linklist_at_level(neigh, layer);
-                    size_t candSize = candidates.size();
-                    setListCount(ll_cur, candSize);
-                    tableint* data = (tableint*)(ll_cur + 1);
-                    for (size_t idx = 0; idx < candSize; idx++) {
-                        data[idx] = candidates.top().second;
-                        candidates.pop();
-                    }
+            dist_t distance = calcDistance(neigh, cand);
+            if (candidates.size() < elementsToKeep) {
+                candidates.emplace(distance, cand);
+            } else {
+                if (distance < candidates.top().first) {
+                    candidates.pop();
+                    candidates.emplace(distance, cand);
                 }
             }
         }
 
-        repairConnectionsForUpdate(dataPoint, entryPointCopy, internalId, elemLevel, maxLevelCopy);
-    };
+        // Retrieve neighbours using heuristic and set connections.
+        size_t M = layer == 0 ? maxM0_ : maxM_;
+        std::vector<tableint> closest;
+        if (keep_pruned) {
+            for (auto rest = candidates; !rest.empty(); rest.pop()) {
+                closest.push_back(rest.top().second);
+            }
+            std::reverse(closest.begin(), closest.end());
+        }
+        auto selected = getNeighborsByHeuristic2(candidates, M);
+        for (auto cand : closest) {
+            if (selected.size() >= M) {
+                break;
+            }
+            if (std::find(selected.begin(), selected.end(), cand) == selected.end()) {
+                selected.push_back(cand);
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(link_list_locks_[neigh]);
+            linklistsizeint* ll_cur;
+            ll_cur = get_linklist_at_level(neigh, layer);
+            setListCount(ll_cur, selected.size());
+            tableint* data = (tableint*)(ll_cur + 1);
+            std::copy(selected.begin(), selected.end(), data);
+        }
+        return selected.size();
+    }
 
     void
     repairConnectionsForUpdate(const void* dataPoint, tableint entryPointInternalId, tableint dataPointInternalId,
@@ -997,12 +1988,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         for (int level = dataPointLevel; level >= 0; level--) {
             std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
-                topCandidates = searchBaseLayer(currObj, dataPoint, level);
+                topCandidates = searchBaseLayer(currObj, dataPointInternalId, level);
 
             std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
                 filteredTopCandidates;
             while (topCandidates.size() > 0) {
-                if (topCandidates.top().second != dataPointInternalId)
+                if (topCandidates.top().second != dataPointInternalId && !isMarkedDeleted(topCandidates.top().second))
                     filteredTopCandidates.push(topCandidates.top());
 
                 topCandidates.pop();
@@ -1017,6 +2008,23 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         }
     }
 
+    // leaves the deleted elements out of the candidates to link to, unless there is no other
+    void
+    dropDeleted(std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>,
+                                    CompareByFirst>& candidates) const {
+        std::vector<std::pair<dist_t, tableint>> live;
+        auto rest = candidates;
+        while (!rest.empty()) {
+            if (!isMarkedDeleted(rest.top().second)) {
+                live.push_back(rest.top());
+            }
+            rest.pop();
+        }
+        if (!live.empty() && live.size() < candidates.size()) {
+            candidates = decltype(rest)(CompareByFirst(), std::move(live));
+        }
+    }
+
     std::vector<tableint>
     getConnectionsWithLock(tableint internalId, int level) {
         std::unique_lock<std::mutex> lock(link_list_locks_[internalId]);
@@ -1028,29 +2036,37 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         return result;
     };
 
+    // a negative level is drawn at random
     tableint
     addPoint(const void* data_point, labeltype label, int level) {
+        if (quant_type_ != QuantType::NONE) {
+            throw std::runtime_error("Can not add points to a quantized HNSW index");
+        }
+        if (mmap_base_ != nullptr) {
+            throw std::runtime_error("Can not add points to a mapped HNSW index");
+        }
+        // the label is the internal id of a new element, also in a reordered index, see extendReorderMaps
         tableint cur_c = label;
         {
             std::unique_lock<std::mutex> templock_curr(cur_element_count_guard_);
-            if (cur_element_count >= max_elements_) {
+            if (cur_element_count >= max_elements_ || label >= max_elements_) {
                 throw std::runtime_error("The number of elements exceeds the specified limit");
             };
             cur_element_count++;
         }
 
         std::unique_lock<std::mutex> lock_el(link_list_locks_[cur_c]);
-        int curlevel = (level > 0) ? level : getRandomLevel(mult_);
+        int curlevel = (level >= 0) ? level : getRandomLevel(mult_);
+        placeElement(data_point, cur_c, curlevel);
+        linkElement(cur_c, curlevel, 0);
+        return cur_c;
+    };
 
+    // copies the element in with blank links at its levels
+    void
+    placeElement(const void* data_point, tableint cur_c, int curlevel) {
         element_levels_[cur_c] = curlevel;
 
-        std::unique_lock<std::mutex> templock(global);
-        int maxlevelcopy = maxlevel_;
-        if (curlevel <= maxlevelcopy)
-            templock.unlock();
-        tableint currObj = enterpoint_node_;
-        tableint enterpoint_copy = enterpoint_node_;
-
         memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
         memcpy(getDataByInternalId(cur_c), data_point, data_size_);
 
@@ -1059,12 +2075,18 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 std::sqrt(faiss::fvec_norm_L2sqr((const float*)data_point, *(size_t*)(dist_func_param_)));
         }
 
-        if (curlevel) {
-            linkLists_[cur_c] = (char*)malloc(size_links_per_element_ * curlevel + 1);
-            if (linkLists_[cur_c] == nullptr)
-                throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
-            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
-        }
+        linkLists_[cur_c] = curlevel > 0 ? allocLinkList(size_links_per_element_ * curlevel) : nullptr;
+    }
+
+    // links the placed element into the graph at its levels down to min_level, the caller holds its lock
+    void
+    linkElement(tableint cur_c, int curlevel, int min_level) {
+        const void* data_point = getDataByInternalId(cur_c);
+        std::unique_lock<std::mutex> templock(global);
+        int maxlevelcopy = maxlevel_;
+        if (curlevel <= maxlevelcopy)
+            templock.unlock();
+        tableint currObj = enterpoint_node_;
 
         if ((signed)currObj != -1) {
             if (curlevel < maxlevelcopy) {
@@ -1073,14 +2095,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     bool changed = true;
                     while (changed) {
                         changed = false;
-                        unsigned int* data;
-                        std::unique_lock<std::mutex> lock(link_list_locks_[currObj]);
-                        data = get_linklist(currObj, level);
-                        int size = getListCount(data);
-
-                        tableint* datal = (tableint*)(data + 1);
-                        for (int i = 0; i < size; i++) {
-                            tableint cand = datal[i];
+                        for (tableint cand : getConnectionsWithLock(currObj, level)) {
                             if (cand < 0 || cand > max_elements_)
                                 throw std::runtime_error("cand error");
                             dist_t d = calcDistance(cur_c, cand);
@@ -1094,13 +2109,16 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 }
             }
 
-            for (int level = std::min(curlevel, maxlevelcopy); level >= 0; level--) {
+            for (int level = std::min(curlevel, maxlevelcopy); level >= min_level; level--) {
                 if (level > maxlevelcopy || level < 0)  // possible?
                     throw std::runtime_error("Level error");
 
                 std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>,
                                     CompareByFirst>
                     top_candidates = searchBaseLayer(currObj, cur_c, level);
+                if (num_deleted_ > 0) {
+                    dropDeleted(top_candidates);
+                }
                 currObj = mutuallyConnectNewElement(data_point, cur_c, top_candidates, level, false);
             }
 
@@ -1115,15 +2133,370 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             enterpoint_node_ = cur_c;
             maxlevel_ = curlevel;
         }
-        return cur_c;
-    };
+    }
+
+    // whether buildByNNDescent can build the index from n points
+    bool
+    canBuildByNNDescent(size_t n) const {
+        return quant_type_ == QuantType::NONE && mmap_base_ == nullptr && cur_element_count == 0 &&
+               n <= max_elements_ && n >= std::max(kHnswNNDescentMinRows, 4 * maxM0_);
+    }
+
+    // Builds an empty index from n points at once. The few elements drawn above level 0 are inserted at their upper
+    // levels first. Level 0 then comes from an approximate kNN graph: the neighbors of each element are pruned by the
+    // heuristic of the insertions, then merged with the elements that picked it and pruned again, as the reverse links
+    // of an insertion are. An upper element keeps its level 1 links at level 0 too, those are the long range ones a
+    // kNN graph lacks and an insertion into a sparser graph leaves.
+    void
+    buildByNNDescent(const char* data, size_t n) {
+        if (!canBuildByNNDescent(n)) {
+            throw std::runtime_error("Can not build this HNSW index by NN-Descent");
+        }
+        std::vector<int> levels(n);
+        for (auto& level : levels) {
+            level = getRandomLevel(mult_);
+        }
+        cur_element_count = n;
+#pragma omp parallel for schedule(static, 1024)
+        for (size_t i = 0; i < n; ++i) {
+            placeElement(data + i * data_size_, i, levels[i]);
+        }
+
+        std::vector<tableint> upper;
+        for (size_t i = 0; i < n; ++i) {
+            if (levels[i] > 0) {
+                upper.push_back(i);
+            }
+        }
+        std::stable_sort(upper.begin(), upper.end(), [&](tableint a, tableint b) { return levels[a] > levels[b]; });
+        if (upper.empty()) {
+            enterpoint_node_ = 0;
+            maxlevel_ = 0;
+        } else {
+            linkElement(upper[0], levels[upper[0]], 1);
+        }
+        std::exception_ptr error;
+        std::mutex error_mutex;
+#pragma omp parallel for schedule(dynamic, 16)
+        for (size_t i = 1; i < upper.size(); ++i) {
+            try {
+                std::unique_lock<std::mutex> lock(link_list_locks_[upper[i]]);
+                linkElement(upper[i], levels[upper[i]], 1);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                error = std::current_exception();
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+
+        auto knn = nnDescent(n, maxM0_);
+        std::vector<std::vector<tableint>> links(n);
+        std::vector<std::vector<tableint>> reverse(n);
+#pragma omp parallel for schedule(dynamic, 256)
+        for (size_t i = 0; i < n; ++i) {
+            std::vector<tableint> neighbors(knn.begin() + i * maxM0_, knn.begin() + (i + 1) * maxM0_);
+            links[i] = pruneNeighbors(i, neighbors, M_);
+            for (auto neighbor : links[i]) {
+                std::unique_lock<std::mutex> lock(link_list_locks_[neighbor]);
+                reverse[neighbor].push_back(i);
+            }
+        }
+        std::vector<tableint>().swap(knn);
+
+#pragma omp parallel for schedule(dynamic, 256)
+        for (size_t i = 0; i < n; ++i) {
+            std::vector<tableint> kept;
+            if (levels[i] > 0) {
+                auto ll = get_linklist(i, 1);
+                kept.assign((tableint*)(ll + 1), (tableint*)(ll + 1) + getListCount(ll));
+            }
+            auto& merged = links[i];
+            merged.insert(merged.end(), reverse[i].begin(), reverse[i].end());
+            std::vector<tableint>().swap(reverse[i]);
+            merged.erase(std::remove_if(merged.begin(), merged.end(),
+                                        [&](tableint id) {
+                                            return std::find(kept.begin(), kept.end(), id) != kept.end();
+                                        }),
+                         merged.end());
+            if (merged.size() + kept.size() > maxM0_) {
+                merged = pruneNeighbors(i, merged, maxM0_ - kept.size());
+            }
+            merged.insert(merged.begin(), kept.begin(), kept.end());
+            linklistsizeint* ll = get_linklist0(i);
+            setListCount(ll, merged.size());
+            std::copy(merged.begin(), merged.end(), (tableint*)(ll + 1));
+            std::vector<tableint>().swap(merged);
+        }
+    }
+
+    // The heuristic's pick of at most m among the candidates of the element, which may repeat, topped up with the
+    // closest of the ones it passed over. Unlike the candidates of an insertion these are all close, the heuristic
+    // alone leaves too few links among them.
+    std::vector<tableint>
+    pruneNeighbors(tableint id, std::vector<tableint>& candidates, size_t m) {
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+            queue;
+        for (auto candidate : candidates) {
+            if (candidate != id) {
+                queue.emplace(calcDistance(id, candidate), candidate);
+            }
+        }
+        std::vector<tableint> closest;
+        for (auto rest = queue; !rest.empty(); rest.pop()) {
+            closest.push_back(rest.top().second);
+        }
+        std::reverse(closest.begin(), closest.end());
+        auto selected = getNeighborsByHeuristic2(queue, m);
+        for (auto candidate : closest) {
+            if (selected.size() >= m) {
+                break;
+            }
+            if (std::find(selected.begin(), selected.end(), candidate) == selected.end()) {
+                selected.push_back(candidate);
+            }
+        }
+        return selected;
+    }
+
+    // Distances from the vector x to the ny vectors laid out one after another at y, with the block kernels for the
+    // float metrics. They rank as calcDistance does, which they equal up to a constant for INNER_PRODUCT.
+    void
+    blockDistances(const char* x, tableint x_id, const char* y, const tableint* y_ids, size_t ny, float* dis) const {
+        auto dim = *(size_t*)dist_func_param_;
+        if (metric_type_ == Metric::L2) {
+            faiss::fvec_L2sqr_ny(dis, (const float*)x, (const float*)y, dim, ny);
+        } else if (metric_type_ == Metric::INNER_PRODUCT || metric_type_ == Metric::COSINE) {
+            faiss::fvec_inner_products_ny(dis, (const float*)x, (const float*)y, dim, ny);
+            for (size_t i = 0; i < ny; ++i) {
+                dis[i] = -dis[i];
+                if (metric_type_ == Metric::COSINE) {
+                    dis[i] /= data_norm_l2_[x_id] * data_norm_l2_[y_ids[i]];
+                }
+            }
+        } else {
+            for (size_t i = 0; i < ny; ++i) {
+                dis[i] = fstdistfunc_(x, y + i * data_size_, dist_func_param_);
+            }
+        }
+    }
+
+    // Approximate k nearest neighbors of each of the first n elements, k ids per element from the closest, by
+    // NN-Descent: starting from random ones, each round joins sampled neighbors and reverse neighbors of every element
+    // with one another, the new ones with all and the old ones only with the new. The vectors of a join are gathered
+    // to compute it row by row with the block kernels, and the updates it finds are kept until the joins of a block of
+    // elements are done, to be applied by element without locks.
+    std::vector<tableint>
+    nnDescent(size_t n, size_t k) const {
+        struct Candidate {
+            float distance;
+            tableint id;
+            bool fresh;
+        };
+        struct Update {
+            tableint element;
+            tableint id;
+            float distance;
+        };
+        std::vector<Candidate> graph(n * k);
+        auto samples = std::min(kHnswNNDescentSamples, k);
+
+#pragma omp parallel
+        {
+            std::minstd_rand rng(omp_get_thread_num() + 1);
+#pragma omp for schedule(static, 1024)
+            for (size_t i = 0; i < n; ++i) {
+                auto list = graph.data() + i * k;
+                for (size_t j = 0; j < k; ++j) {
+                    tableint id;
+                    bool taken;
+                    do {
+                        id = rng() % n;
+                        taken = id == i;
+                        for (size_t t = 0; t < j && !taken; ++t) {
+                            taken = list[t].id == id;
+                        }
+                    } while (taken);
+                    list[j] = {calcDistance(i, id), id, true};
+                }
+                std::sort(list, list + k,
+                          [](const Candidate& a, const Candidate& b) { return a.distance < b.distance; });
+            }
+        }
+
+        // puts id among the neighbors of the element unless it's there or farther than all of them
+        auto insert = [&](tableint element, tableint id, float distance) {
+            auto list = graph.data() + element * k;
+            if (distance >= list[k - 1].distance) {
+                return 0;
+            }
+            size_t pos = k - 1;
+            for (size_t j = 0; j < k; ++j) {
+                if (list[j].id == id) {
+                    return 0;
+                }
+                if (pos == k - 1 && list[j].distance > distance) {
+                    pos = j;
+                }
+            }
+            std::memmove(list + pos + 1, list + pos, (k - 1 - pos) * sizeof(Candidate));
+            list[pos] = {distance, id, true};
+            return 1;
+        };
+
+        std::vector<std::vector<tableint>> fresh(n);
+        std::vector<std::vector<tableint>> old(n);
+        std::vector<std::vector<tableint>> reverse_fresh(n);
+        std::vector<std::vector<tableint>> reverse_old(n);
+        std::vector<uint32_t> seen_fresh(n);
+        std::vector<uint32_t> seen_old(n);
+        std::vector<std::mutex> locks(n);
+        std::vector<std::vector<Update>> thread_updates(omp_get_max_threads());
+        std::vector<Update> updates;
+        std::vector<size_t> offsets(n + 1);
+        std::vector<float> worst(n);
+        // a uniform sample of the elements having the one of the reverse as neighbor, by reservoir
+        auto offer = [&](std::vector<tableint>& reverse, uint32_t& seen, tableint i, std::minstd_rand& rng) {
+            if (reverse.size() < samples) {
+                reverse.push_back(i);
+            } else if (auto pos = rng() % (seen + 1); pos < samples) {
+                reverse[pos] = i;
+            }
+            ++seen;
+        };
+
+        for (int round = 0; round < kHnswNNDescentMaxRounds; ++round) {
+#pragma omp parallel for schedule(static, 1024)
+            for (size_t i = 0; i < n; ++i) {
+                reverse_fresh[i].clear();
+                reverse_old[i].clear();
+                seen_fresh[i] = 0;
+                seen_old[i] = 0;
+            }
+#pragma omp parallel
+            {
+                std::minstd_rand rng(round * omp_get_max_threads() + omp_get_thread_num() + 1);
+#pragma omp for schedule(static, 1024)
+                for (size_t i = 0; i < n; ++i) {
+                    fresh[i].clear();
+                    old[i].clear();
+                    auto list = graph.data() + i * k;
+                    for (size_t j = 0; j < k; ++j) {
+                        auto& sampled = list[j].fresh ? fresh[i] : old[i];
+                        if (sampled.size() < samples) {
+                            sampled.push_back(list[j].id);
+                            list[j].fresh = false;
+                        }
+                    }
+                    for (auto id : fresh[i]) {
+                        std::lock_guard lock(locks[id]);
+                        offer(reverse_fresh[id], seen_fresh[id], i, rng);
+                    }
+                    for (auto id : old[i]) {
+                        std::lock_guard lock(locks[id]);
+                        offer(reverse_old[id], seen_old[id], i, rng);
+                    }
+                }
+            }
+
+            size_t num_updates = 0;
+            for (size_t begin = 0; begin < n; begin += kHnswNNDescentJoinBlock) {
+                auto end = std::min(n, begin + kHnswNNDescentJoinBlock);
+#pragma omp parallel for schedule(static, 4096)
+                for (size_t i = 0; i < n; ++i) {
+                    worst[i] = graph[i * k + k - 1].distance;
+                }
+#pragma omp parallel
+                {
+                    auto& found = thread_updates[omp_get_thread_num()];
+                    found.clear();
+                    std::vector<tableint> ids;
+                    std::vector<char> vectors;
+                    std::vector<float> dis;
+#pragma omp for schedule(dynamic, 256)
+                    for (size_t i = begin; i < end; ++i) {
+                        ids = fresh[i];
+                        ids.insert(ids.end(), reverse_fresh[i].begin(), reverse_fresh[i].end());
+                        std::sort(ids.begin(), ids.end());
+                        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+                        auto num_fresh = ids.size();
+                        for (auto& sampled : {std::cref(old[i]), std::cref(reverse_old[i])}) {
+                            for (auto id : sampled.get()) {
+                                if (std::find(ids.begin(), ids.end(), id) == ids.end()) {
+                                    ids.push_back(id);
+                                }
+                            }
+                        }
+                        vectors.resize(ids.size() * data_size_);
+                        for (size_t j = 0; j < ids.size(); ++j) {
+                            std::memcpy(vectors.data() + j * data_size_, getDataByInternalId(ids[j]), data_size_);
+                        }
+                        dis.resize(ids.size());
+                        for (size_t a = 0; a < num_fresh; ++a) {
+                            auto ny = ids.size() - a - 1;
+                            blockDistances(vectors.data() + a * data_size_, ids[a],
+                                           vectors.data() + (a + 1) * data_size_, ids.data() + a + 1, ny, dis.data());
+                            for (size_t b = 0; b < ny; ++b) {
+                                auto id = ids[a + 1 + b];
+                                if (dis[b] < worst[ids[a]]) {
+                                    found.push_back({ids[a], id, dis[b]});
+                                }
+                                if (dis[b] < worst[id]) {
+                                    found.push_back({id, ids[a], dis[b]});
+                                }
+                            }
+                        }
+                    }
+                }
+
+                std::fill(offsets.begin(), offsets.end(), 0);
+                for (auto& found : thread_updates) {
+                    for (auto& update : found) {
+                        ++offsets[update.element + 1];
+                    }
+                }
+                std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+                updates.resize(offsets[n]);
+                for (auto& found : thread_updates) {
+                    for (auto& update : found) {
+                        updates[offsets[update.element]++] = update;
+                    }
+                }
+                // offsets[i] is now where the updates of element i end
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+ : num_updates)
+                for (size_t i = 0; i < n; ++i) {
+                    for (size_t u = i == 0 ? 0 : offsets[i - 1]; u < offsets[i]; ++u) {
+                        num_updates += insert(i, updates[u].id, updates[u].distance);
+                    }
+                }
+            }
+            if (num_updates < kHnswNNDescentMinUpdates * n * k) {
+                break;
+            }
+        }
+
+        std::vector<tableint> knn(n * k);
+        for (size_t i = 0; i < n * k; ++i) {
+            knn[i] = graph[i].id;
+        }
+        return knn;
+    }
 
     std::vector<std::pair<dist_t, labeltype>>
     searchKnnBF(void* query_data, size_t k, const knowhere::BitsetView bitset) const {
+        return mapToLabels(searchKnnBF(QueryDistance(this, query_data), k, bitset));
+    }
+
+    // results hold internal ids, as do those of the other searches taking a QueryDistance
+    std::vector<std::pair<dist_t, labeltype>>
+    searchKnnBF(const QueryDistance& qdist, size_t k, const knowhere::BitsetView bitset) const {
         knowhere::ResultMaxHeap<dist_t, labeltype> max_heap(k);
         for (labeltype id = 0; id < cur_element_count; ++id) {
-            if (!bitset.test(id)) {
-                dist_t dist = calcDistance(query_data, id);
+            if (!isFiltered(id, bitset)) {
+                dist_t dist = qdist(id);
                 max_heap.Push(dist, id);
             }
         }
@@ -1136,6 +2509,92 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         return result;
     }
 
+    // Picks how to search with bs_cnt of the elements filtered out, by the distances each way computes. Brute force
+    // computes one per unfiltered element; a traversal expands about ef elements at maxM0_ distances each, but runs
+    // into ef / pass_rate elements to find ef unfiltered ones. The filter-aware traversal expands unfiltered ones only,
+    // with ef raised to ef / sqrt(pass_rate), and reads the lists of the filtered neighbors on top.
+    SearchStrategy
+    chooseSearchStrategy(size_t bs_cnt, size_t ef, float bf_threshold) const {
+        if (bs_cnt == 0) {
+            return SearchStrategy::GRAPH;
+        }
+        if (bs_cnt >= cur_element_count * bf_threshold) {
+            return SearchStrategy::BRUTE_FORCE;
+        }
+        double pass_rate = 1.0 - (double)bs_cnt / cur_element_count;
+        double bf_cost = cur_element_count * pass_rate;
+        double graph_cost = ef / pass_rate * maxM0_;
+        double filtered_cost = filteredEf(ef, bs_cnt) * maxM0_ * (2.0 - pass_rate);
+        if (bf_cost <= std::min(graph_cost, filtered_cost)) {
+            return SearchStrategy::BRUTE_FORCE;
+        }
+        return filtered_cost < graph_cost ? SearchStrategy::FILTERED_GRAPH : SearchStrategy::GRAPH;
+    }
+
+    size_t
+    filteredEf(size_t ef, size_t bs_cnt) const {
+        double pass_rate = 1.0 - (double)bs_cnt / cur_element_count;
+        return std::ceil(ef / std::sqrt(pass_rate));
+    }
+
+    // greedy descent of the upper layers from enterpoint_node_, down to the element to start level 0 from
+    tableint
+    searchUpperLayers(const QueryDistance& qdist,
+                      const knowhere::feder::hnsw::FederResultUniq& feder_result = nullptr) const {
+        tableint currObj = enterpoint_node_;
+        dist_t curdist = qdist(enterpoint_node_);
+
+        for (int level = maxlevel_; level > 0; level--) {
+            bool changed = true;
+            if (feder_result != nullptr) {
+                feder_result->visit_info_.AddLevelVisitRecord(level);
+            }
+            while (changed) {
+                changed = false;
+                unsigned int* data;
+
+                data = (unsigned int*)get_linklist(currObj, level);
+                int size = getListCount(data);
+                metric_hops++;
+                metric_distance_computations += size;
+                tableint* datal = (tableint*)(data + 1);
+#if defined(USE_PREFETCH)
+                for (int i = 0; i < size; ++i) {
+                    _mm_prefetch(getDataByInternalId(datal[i]), _MM_HINT_T0);
+                }
+#endif
+                for (int i = 0; i < size; i++) {
+                    tableint cand = datal[i];
+                    if (cand < 0 || cand > max_elements_)
+                        throw std::runtime_error("cand error");
+                    dist_t d = qdist(cand);
+                    if (feder_result != nullptr) {
+                        feder_result->visit_info_.AddVisitRecord(level, currObj, cand, d);
+                        feder_result->id_set_.insert(currObj);
+                        feder_result->id_set_.insert(cand);
+                    }
+
+                    if (d < curdist) {
+                        curdist = d;
+                        currObj = cand;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        return currObj;
+    }
+
+    // the elements a search starts level 0 from, the descent of the upper layers is left to feder, which records it
+    std::vector<tableint>
+    entryPoints(const QueryDistance& qdist, const float* query,
+                const knowhere::feder::hnsw::FederResultUniq& feder_result) const {
+        if (entry_points_.empty() || feder_result != nullptr) {
+            return {searchUpperLayers(qdist, feder_result)};
+        }
+        return closestEntryPoints(query);
+    }
+
     std::vector<std::pair<dist_t, labeltype>>
     searchKnn(void* query_data, size_t k, const knowhere::BitsetView bitset, const SearchParam* param = nullptr,
               const knowhere::feder::hnsw::FederResultUniq& feder_result = nullptr) const {
@@ -1147,85 +2606,62 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             knowhere::NormalizeVec((float*)query_data, *((size_t*)dist_func_param_));
         }
 
+        QueryDistance qdist(this, query_data);
+        size_t ef = std::max(param ? param->ef_ : this->ef_, k);
+
         // do bruteforce search when delete rate high
-        if (!bitset.empty()) {
-            const auto bs_cnt = bitset.count();
+        size_t bs_cnt = 0;
+        auto strategy = SearchStrategy::GRAPH;
+        if (hasFilter(bitset)) {
+            bs_cnt = filteredCount(bitset);
             if (bs_cnt == cur_element_count) return {};
-            if (bs_cnt >= (cur_element_count * kHnswSearchKnnBFThreshold)) {
-                return searchKnnBF(query_data, k, bitset);
+            strategy = chooseSearchStrategy(bs_cnt, ef, kHnswSearchKnnBFThreshold);
+            if (strategy == SearchStrategy::BRUTE_FORCE) {
+                if (hasRefineData()) {
+                    auto candidates = searchKnnBF(qdist, ef, bitset);
+                    return mapToLabels(rerank(query_data, candidates, k));
+                }
+                return mapToLabels(searchKnnBF(qdist, k, bitset));
             }
         }
 
-        tableint currObj = enterpoint_node_;
-        // auto vec_hash = knowhere::hash_vec((const float*)query_data, *(size_t*)dist_func_param_);
-        // for tuning, do not use cache
-        // if (param->for_tuning || !lru_cache.try_get(vec_hash, currObj)) {
-            dist_t curdist = calcDistance(query_data, enterpoint_node_);
-
-            for (int level = maxlevel_; level > 0; level--) {
-                bool changed = true;
-                if (feder_result != nullptr) {
-                    feder_result->visit_info_.AddLevelVisitRecord(level);
-                }
-                while (changed) {
-                    changed = false;
-                    unsigned int* data;
-
-                    data = (unsigned int*)get_linklist(currObj, level);
-                    int size = getListCount(data);
-                    metric_hops++;
-                    metric_distance_computations += size;
-                    tableint* datal = (tableint*)(data + 1);
-#if defined(USE_PREFETCH)
-                    for (int i = 0; i < size; ++i) {
-                        _mm_prefetch(getDataByInternalId(datal[i]), _MM_HINT_T0);
-                    }
-#endif
-                    for (int i = 0; i < size; i++) {
-                        tableint cand = datal[i];
-                        if (cand < 0 || cand > max_elements_)
-                            throw std::runtime_error("cand error");
-                        dist_t d = calcDistance(query_data, cand);
-                        if (feder_result != nullptr) {
-                            feder_result->visit_info_.AddVisitRecord(level, currObj, cand, d);
-                            feder_result->id_set_.insert(currObj);
-                            feder_result->id_set_.insert(cand);
-                        }
-
-                        if (d < curdist) {
-                            curdist = d;
-                            currObj = cand;
-                            changed = true;
-                        }
-                    }
-                }
-            }
-        // }
+        auto eps = entryPoints(qdist, (const float*)query_data, feder_result);
         std::vector<std::pair<dist_t, tableint>> top_candidates;
-        size_t ef = param ? param->ef_ : this->ef_;
-        if (!bitset.empty()) {
-            top_candidates = searchBaseLayerST<true, true>(currObj, query_data, std::max(ef, k), bitset, feder_result);
+        if (strategy == SearchStrategy::FILTERED_GRAPH) {
+            top_candidates =
+                searchBaseLayerST<true, true, true>(eps, qdist, filteredEf(ef, bs_cnt), bitset, feder_result);
+        } else if (hasFilter(bitset)) {
+            top_candidates = searchBaseLayerST<true, true>(eps, qdist, ef, bitset, feder_result);
         } else {
-            top_candidates = searchBaseLayerST<false, true>(currObj, query_data, std::max(ef, k), bitset, feder_result);
+            top_candidates = searchBaseLayerST<false, true>(eps, qdist, ef, bitset, feder_result);
         }
         std::vector<std::pair<dist_t, labeltype>> result;
-        size_t len = std::min(k, top_candidates.size());
+        // all of the ef candidates are re-ranked by exact distance
+        size_t len = hasRefineData() ? top_candidates.size() : std::min(k, top_candidates.size());
         result.reserve(len);
         for (int i = 0; i < len; ++i) {
             result.emplace_back(top_candidates[i].first, (labeltype)top_candidates[i].second);
         }
+        if (hasRefineData()) {
+            return mapToLabels(rerank(query_data, result, k));
+        }
         // if (len > 0) {
         //     lru_cache.put(vec_hash, result[0].second);
         // }
-        return result;
+        return mapToLabels(std::move(result));
     };
 
     std::vector<std::pair<dist_t, labeltype>>
     searchRangeBF(void* query_data, float radius, const knowhere::BitsetView bitset) const {
+        return mapToLabels(searchRangeBF(QueryDistance(this, query_data, hasRefineData()), radius, bitset));
+    }
+
+    std::vector<std::pair<dist_t, labeltype>>
+    searchRangeBF(const QueryDistance& qdist, float radius, const knowhere::BitsetView bitset) const {
         std::vector<std::pair<dist_t, labeltype>> result;
         for (labeltype id = 0; id < cur_element_count; ++id) {
-            if (!bitset.test(id)) {
-                dist_t dist = calcDistance(query_data, id);
+            if (!isFiltered(id, bitset)) {
+                dist_t dist = qdist(id);
                 if (dist < radius) {
                     result.emplace_back(dist, id);
                 }
@@ -1246,65 +2682,46 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             knowhere::NormalizeVec((float*)query_data, *((size_t*)dist_func_param_));
         }
 
+        QueryDistance qdist(this, query_data);
+        // the radius is checked against exact distances when the vectors are kept
+        QueryDistance range_dist(this, query_data, hasRefineData());
+
+        size_t ef = param ? param->ef_ : this->ef_;
+
         // do bruteforce range search when delete rate high
-        if (!bitset.empty()) {
-            const auto bs_cnt = bitset.count();
+        size_t bs_cnt = 0;
+        auto strategy = SearchStrategy::GRAPH;
+        if (hasFilter(bitset)) {
+            bs_cnt = filteredCount(bitset);
             if (bs_cnt == cur_element_count) return {};
-            if (bs_cnt >= (cur_element_count * kHnswSearchRangeBFThreshold)) {
-                return searchRangeBF(query_data, radius, bitset);
+            strategy = chooseSearchStrategy(bs_cnt, ef, kHnswSearchRangeBFThreshold);
+            if (strategy == SearchStrategy::BRUTE_FORCE) {
+                return mapToLabels(searchRangeBF(range_dist, radius, bitset));
             }
         }
 
-        tableint currObj = enterpoint_node_;
-        dist_t curdist = calcDistance(query_data, enterpoint_node_);
-
-        for (int level = maxlevel_; level > 0; level--) {
-            bool changed = true;
-            if (feder_result != nullptr) {
-                feder_result->visit_info_.AddLevelVisitRecord(level);
-            }
-            while (changed) {
-                changed = false;
-                unsigned int* data;
-
-                data = (unsigned int*)get_linklist(currObj, level);
-                int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations += size;
-
-                tableint* datal = (tableint*)(data + 1);
-                for (int i = 0; i < size; i++) {
-                    tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
-                        throw std::runtime_error("cand error");
-                    dist_t d = calcDistance(query_data, cand);
-                    if (feder_result != nullptr) {
-                        feder_result->visit_info_.AddVisitRecord(level, currObj, cand, d);
-                        feder_result->id_set_.insert(currObj);
-                        feder_result->id_set_.insert(cand);
-                    }
-                    if (d < curdist) {
-                        curdist = d;
-                        currObj = cand;
-                        changed = true;
-                    }
-                }
-            }
-        }
+        auto eps = entryPoints(qdist, (const float*)query_data, feder_result);
 
         std::vector<std::pair<dist_t, tableint>> top_candidates;
-        size_t ef = param ? param->ef_ : this->ef_;
-        if (!bitset.empty()) {
-            top_candidates = searchBaseLayerST<true, true>(currObj, query_data, ef, bitset, feder_result);
+        if (strategy == SearchStrategy::FILTERED_GRAPH) {
+            top_candidates =
+                searchBaseLayerST<true, true, true>(eps, qdist, filteredEf(ef, bs_cnt), bitset, feder_result);
+        } else if (hasFilter(bitset)) {
+            top_candidates = searchBaseLayerST<true, true>(eps, qdist, ef, bitset, feder_result);
         } else {
-            top_candidates = searchBaseLayerST<false, true>(currObj, query_data, ef, bitset, feder_result);
+            top_candidates = searchBaseLayerST<false, true>(eps, qdist, ef, bitset, feder_result);
         }
 
         if (top_candidates.size() == 0) {
             return {};
         }
 
-        return getNeighboursWithinRadius(top_candidates, query_data, radius, bitset);
+        if (hasRefineData()) {
+            for (auto& [dist, id] : top_candidates) {
+                dist = range_dist(id);
+            }
+        }
+        return mapToLabels(getNeighboursWithinRadius(top_candidates, range_dist, radius, bitset));
     }
 
     void
@@ -1312,7 +2729,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         int connections_checked = 0;
         std::vector<int> inbound_connections_num(cur_element_count, 0);
         for (int i = 0; i < cur_element_count; i++) {
-            for (int l = 0; l <= element_levels_[i]; l++) {
+            for (int l = 0; l <= elementLevel(i); l++) {
                 linklistsizeint* ll_cur = get_linklist_at_level(i, l);
                 int size = getListCount(ll_cur);
                 tableint* data = (tableint*)(ll_cur + 1);
@@ -1348,12 +2765,20 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         ret += visited_list_pool_->size();
         ret += link_list_locks_.size() * sizeof(std::mutex);
         ret += element_levels_.size() * sizeof(int);
-        ret += max_elements_ * size_data_per_element_;
-        ret += max_elements_ * sizeof(void*);
-        for (auto i = 0; i < max_elements_; ++i) {
-            if (element_levels_[i] > 0) {
-                ret += size_links_per_element_ * element_levels_[i];
-            }
+        if (mmap_base_ == nullptr) {
+            ret += max_elements_ * size_data_per_element_;
+        }
+        if (linkLists_ != nullptr) {
+            ret += max_elements_ * sizeof(void*);
+        }
+        ret += link_blocks_bytes_;
+        ret += refine_data_.size() * sizeof(float);
+        ret += internal_to_label_.size() * sizeof(labeltype) + label_to_internal_.size() * sizeof(tableint);
+        if (sq_) {
+            ret += sq_->trained.size() * sizeof(float);
+        }
+        if (pq_) {
+            ret += pq_->centroids.size() * sizeof(float);
         }
         return ret;
     }
@@ -1,13 +1,56 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <thread>
-#include <unordered_map>
 #include <vector>
 
 namespace hnswlib {
 
+typedef uint16_t vl_type;
+
+///////////////////////////////////////////////////////////
+//
+// Visited marks of one search. An element is visited when its tag equals the current epoch, so a new search only
+// bumps the epoch; the tags are cleared once every 65535 searches, when the epoch wraps around.
+//
+/////////////////////////////////////////////////////////
+
+class VisitedList {
+ public:
+    explicit VisitedList(size_t numelements) : tags_(numelements, 0) {
+    }
+
+    void
+    reset() {
+        if (++epoch_ == 0) {
+            std::fill(tags_.begin(), tags_.end(), 0);
+            epoch_ = 1;
+        }
+    }
+
+    bool
+    get(size_t id) const {
+        return tags_[id] == epoch_;
+    }
+
+    void
+    set(size_t id) {
+        tags_[id] = epoch_;
+    }
+
+    size_t
+    size() const {
+        return tags_.size();
+    }
+
+ private:
+    std::vector<vl_type> tags_;
+    vl_type epoch_ = 0;
+};
+
 ///////////////////////////////////////////////////////////
 //
 // Class for multi-threaded pool-management of VisitedLists
@@ -15,31 +58,69 @@ namespace hnswlib {
 /////////////////////////////////////////////////////////
 
 class VisitedListPool {
-    int numelements;
-    std::unordered_map<std::thread::id, std::vector<bool>> map;
-    std::mutex mtx;
+    struct Release {
+        VisitedListPool* pool;
+        void
+        operator()(VisitedList* list) const {
+            pool->releaseVisitedList(list);
+        }
+    };
 
  public:
-    VisitedListPool(int numelements1) {
-        numelements = numelements1;
+    // back to the pool when it goes out of scope
+    using Handle = std::unique_ptr<VisitedList, Release>;
+
+    VisitedListPool(int numelements1) : numelements(numelements1) {
+        max_pooled = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    ~VisitedListPool() {
+        for (auto list : pool) {
+            delete list;
+        }
     }
 
-    std::vector<bool>&
+    // a list of any earlier search, not necessarily of this thread, reset for a new one
+    Handle
     getFreeVisitedList() {
-        std::unique_lock lk(mtx);
-        auto& res = map[std::this_thread::get_id()];
-        lk.unlock();
-        if (res.size() != numelements) {
-            res.assign(numelements, false);
-        } else {
-            std::fill(res.begin(), res.end(), false);
+        VisitedList* list = nullptr;
+        {
+            std::lock_guard lk(mtx);
+            if (!pool.empty()) {
+                list = pool.back();
+                pool.pop_back();
+            }
         }
-        return res;
+        if (list == nullptr) {
+            list = new VisitedList(numelements);
+        }
+        list->reset();
+        return Handle(list, Release{this});
     };
 
     int64_t
     size() {
-        return numelements * (sizeof(std::thread::id) + numelements / 8) + sizeof(*this);
+        std::lock_guard lk(mtx);
+        return pool.size() * (numelements * sizeof(vl_type) + sizeof(VisitedList)) + sizeof(*this);
+    }
+
+ private:
+    // a list beyond the bound is one of a burst of concurrent searches, it's freed instead of kept
+    void
+    releaseVisitedList(VisitedList* list) {
+        {
+            std::lock_guard lk(mtx);
+            if (pool.size() < max_pooled) {
+                pool.push_back(list);
+                return;
+            }
+        }
+        delete list;
     }
+
+    size_t numelements;
+    size_t max_pooled;
+    std::vector<VisitedList*> pool;
+    std::mutex mtx;
 };
 }  // namespace hnswlib